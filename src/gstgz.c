@@ -47,6 +47,7 @@
 
 #include "gstgzenc.h"
 #include "gstgzdec.h"
+#include "gstgzparse.h"
 
 #include <gst/gstplugin.h>
 
@@ -59,6 +60,10 @@ plugin_init (GstPlugin * p)
         return FALSE;
     if (!gst_element_register (p, "gzdec", GST_RANK_NONE, GST_TYPE_GZDEC))
         return FALSE;
+#if GST_CHECK_VERSION(1,0,0)
+    if (!gst_element_register (p, "gzparse", GST_RANK_NONE, GST_TYPE_GZPARSE))
+        return FALSE;
+#endif
     return TRUE;
 }
 
@@ -0,0 +1,1613 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstgzarchive.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* Size of the deflate window */
+#define WINDOW_SIZE 32768
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+/* Candidates examined per position by the match search */
+#define MAX_CHAIN_HITS 8192
+#define HASH_BITS 15
+
+/* Matches kept per position, see gst_gz_archive_find_matches() */
+#define MAX_PAIRS 8
+
+/* Blocks per chunk and split points tried per round of the block split */
+#define MAX_BLOCKS 15
+#define SPLIT_SAMPLES 9
+
+/* Largest payload of a stored deflate block */
+#define MAX_STORED_BLOCK_SIZE 65535
+
+#define LARGE_COST 1e30
+
+/* Order of the code length code lengths in a dynamic block header */
+static const guint8 clcl_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Smallest distance of each distance symbol */
+static const guint16 dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+/* Sequence of literals and matches: a literal has a distance of 0, the
+ * length of a match is in litlens */
+typedef struct
+{
+    guint16 *litlens;
+    guint16 *dists;
+    /* Input position of each symbol */
+    gsize *pos;
+    gsize len;
+    gsize alloc;
+} GstGzArchiveStore;
+
+/* Symbol frequencies and the cost in bits they give to each symbol */
+typedef struct
+{
+    gsize litlens[288];
+    gsize dists[32];
+    gdouble ll_costs[288];
+    gdouble d_costs[32];
+} GstGzArchiveStats;
+
+/* Deflate output, least significant bit first */
+typedef struct
+{
+    guint8 *data;
+    gsize len;
+    gsize alloc;
+    guint32 bits;
+    guint n_bits;
+} GstGzArchiveWriter;
+
+typedef struct
+{
+    /* Window then data */
+    const guint8 *in;
+    gsize start;
+    gsize end;
+
+    /* Number of bytes equal to each byte following it */
+    guint16 *same;
+    /* Matches of each position of the data, as pairs of length and
+     * distance, the distance applies to the lengths up to its length. The
+     * pairs of position start + i are pairs[first[i]] to
+     * pairs[first[i + 1]]. */
+    guint32 *first;
+    guint16 *pairs;
+    gsize n_pairs;
+    gsize pairs_alloc;
+
+    /* Random generator of the statistics, seeded the same way for each
+     * block so that the output only depends on the input */
+    guint32 ran_w;
+    guint32 ran_z;
+
+    /* Scratch space of the parsing */
+    gfloat *costs;
+    guint16 *lengths;
+    guint16 *path;
+} GstGzArchive;
+
+    static guint
+gst_gz_archive_length_symbol (guint length)
+{
+    guint v, extra;
+
+    if (length == MAX_MATCH)
+        return 285;
+    v = length - MIN_MATCH;
+    if (v < 8)
+        return 257 + v;
+    extra = g_bit_storage (v) - 3;
+    return 257 + 4 * (extra + 1) + ((v >> extra) & 3);
+}
+
+    static guint
+gst_gz_archive_length_extra (guint symbol)
+{
+    return symbol < 265 || symbol == 285 ? 0 : (symbol - 261) / 4;
+}
+
+    static guint
+gst_gz_archive_dist_symbol (guint dist)
+{
+    guint v, lg;
+
+    if (dist < 5)
+        return dist - 1;
+    v = dist - 1;
+    lg = g_bit_storage (v) - 1;
+    return 2 * lg + ((v >> (lg - 1)) & 1);
+}
+
+    static guint
+gst_gz_archive_dist_extra (guint symbol)
+{
+    return symbol < 4 ? 0 : symbol / 2 - 1;
+}
+
+/* log2() without libm: the integer part by scaling, then the bits of the
+ * fraction by squaring */
+    static gdouble
+gst_gz_archive_log2 (gdouble x)
+{
+    gdouble result = 0, bit = 1;
+    guint i;
+
+    while (x >= 2)
+    {
+        x /= 2;
+        result += 1;
+    }
+    while (x < 1)
+    {
+        x *= 2;
+        result -= 1;
+    }
+    for (i = 0; i < 24; i++)
+    {
+        x *= x;
+        bit /= 2;
+        if (x >= 2)
+        {
+            x /= 2;
+            result += bit;
+        }
+    }
+    return result;
+}
+
+/* Store */
+
+    static void
+gst_gz_archive_store_add (GstGzArchiveStore * store, guint litlen, guint dist,
+        gsize pos)
+{
+    if (store->len == store->alloc)
+    {
+        store->alloc = MAX (store->alloc * 2, 1024);
+        store->litlens = g_renew (guint16, store->litlens, store->alloc);
+        store->dists = g_renew (guint16, store->dists, store->alloc);
+        store->pos = g_renew (gsize, store->pos, store->alloc);
+    }
+    store->litlens[store->len] = litlen;
+    store->dists[store->len] = dist;
+    store->pos[store->len] = pos;
+    store->len++;
+}
+
+    static void
+gst_gz_archive_store_append (GstGzArchiveStore * store,
+        const GstGzArchiveStore * other, gsize from, gsize to)
+{
+    gsize i;
+
+    for (i = from; i < to; i++)
+        gst_gz_archive_store_add (store, other->litlens[i], other->dists[i],
+                other->pos[i]);
+}
+
+    static void
+gst_gz_archive_store_clear (GstGzArchiveStore * store)
+{
+    g_free (store->litlens);
+    g_free (store->dists);
+    g_free (store->pos);
+    memset (store, 0, sizeof (*store));
+}
+
+/* Input bytes covered by symbols [from, to) of a store */
+    static gsize
+gst_gz_archive_store_bytes (const GstGzArchiveStore * store, gsize from,
+        gsize to)
+{
+    gsize last = to - 1;
+
+    if (from == to)
+        return 0;
+    return store->pos[last] - store->pos[from]
+        + (store->dists[last] ? store->litlens[last] : 1);
+}
+
+    static void
+gst_gz_archive_store_counts (const GstGzArchiveStore * store, gsize from,
+        gsize to, gsize * ll_counts, gsize * d_counts)
+{
+    gsize i;
+
+    memset (ll_counts, 0, 288 * sizeof (gsize));
+    memset (d_counts, 0, 32 * sizeof (gsize));
+    for (i = from; i < to; i++)
+    {
+        if (!store->dists[i])
+            ll_counts[store->litlens[i]]++;
+        else
+        {
+            ll_counts[gst_gz_archive_length_symbol (store->litlens[i])]++;
+            d_counts[gst_gz_archive_dist_symbol (store->dists[i])]++;
+        }
+    }
+    /* End of block */
+    ll_counts[256] = 1;
+}
+
+/* Huffman codes */
+
+typedef struct _GstGzArchiveNode GstGzArchiveNode;
+struct _GstGzArchiveNode
+{
+    gsize weight;
+    /* Symbol of a leaf, -1 for a package of two nodes */
+    gint symbol;
+    GstGzArchiveNode *a;
+    GstGzArchiveNode *b;
+};
+
+    static int
+gst_gz_archive_node_compare (const void *p1, const void *p2)
+{
+    const GstGzArchiveNode *n1 = p1, *n2 = p2;
+
+    if (n1->weight != n2->weight)
+        return n1->weight < n2->weight ? -1 : 1;
+    return n1->symbol - n2->symbol;
+}
+
+    static void
+gst_gz_archive_node_count (const GstGzArchiveNode * node, guint * lengths)
+{
+    if (node->symbol >= 0)
+        lengths[node->symbol]++;
+    else
+    {
+        gst_gz_archive_node_count (node->a, lengths);
+        gst_gz_archive_node_count (node->b, lengths);
+    }
+}
+
+/* Lengths of a Huffman code limited to max_bits, with the package-merge
+ * algorithm */
+    static void
+gst_gz_archive_code_lengths (const gsize * counts, guint n, guint max_bits,
+        guint * lengths)
+{
+    GstGzArchiveNode *leaves, *nodes, *list, *next;
+    guint n_leaves = 0, n_list, n_next, i, level;
+
+    memset (lengths, 0, n * sizeof (guint));
+    leaves = g_new (GstGzArchiveNode, n);
+    for (i = 0; i < n; i++)
+    {
+        if (!counts[i])
+            continue;
+        leaves[n_leaves].weight = counts[i];
+        leaves[n_leaves].symbol = i;
+        leaves[n_leaves].a = leaves[n_leaves].b = NULL;
+        n_leaves++;
+    }
+    if (n_leaves <= 2)
+    {
+        for (i = 0; i < n_leaves; i++)
+            lengths[leaves[i].symbol] = 1;
+        g_free (leaves);
+        return;
+    }
+    qsort (leaves, n_leaves, sizeof (GstGzArchiveNode),
+            gst_gz_archive_node_compare);
+
+    /* Each list has at most 2 * n_leaves - 1 nodes and stays in place as
+     * the packages of the next one point to its nodes */
+    nodes = g_new (GstGzArchiveNode, (gsize) max_bits * 2 * n_leaves);
+    list = nodes;
+    memcpy (list, leaves, n_leaves * sizeof (GstGzArchiveNode));
+    n_list = n_leaves;
+    for (level = 1; level < max_bits; level++)
+    {
+        guint l = 0, p = 0, n_packages = n_list / 2;
+
+        next = list + n_list;
+        n_next = 0;
+        /* Merge the leaves with the packages of pairs of the list, the
+         * leaves first on equal weights */
+        while (l < n_leaves || p < n_packages)
+        {
+            gsize weight = p < n_packages ?
+                list[2 * p].weight + list[2 * p + 1].weight : 0;
+
+            if (l < n_leaves && (p == n_packages || leaves[l].weight <= weight))
+                next[n_next++] = leaves[l++];
+            else
+            {
+                next[n_next].weight = weight;
+                next[n_next].symbol = -1;
+                next[n_next].a = &list[2 * p];
+                next[n_next].b = &list[2 * p + 1];
+                n_next++;
+                p++;
+            }
+        }
+        list = next;
+        n_list = n_next;
+    }
+    for (i = 0; i < 2 * n_leaves - 2; i++)
+        gst_gz_archive_node_count (&list[i], lengths);
+
+    g_free (nodes);
+    g_free (leaves);
+}
+
+/* Canonical codes of code lengths */
+    static void
+gst_gz_archive_code_symbols (const guint * lengths, guint n, guint * symbols)
+{
+    guint bl_count[16] = { 0 }, next_code[16];
+    guint i, code = 0;
+
+    for (i = 0; i < n; i++)
+        bl_count[lengths[i]]++;
+    bl_count[0] = 0;
+    for (i = 1; i < 16; i++)
+    {
+        code = (code + bl_count[i - 1]) << 1;
+        next_code[i] = code;
+    }
+    for (i = 0; i < n; i++)
+        symbols[i] = lengths[i] ? next_code[lengths[i]]++ : 0;
+}
+
+/* Some decoders need at least two distance codes */
+    static void
+gst_gz_archive_patch_distances (guint * d_lengths)
+{
+    guint i, n = 0;
+
+    for (i = 0; i < 30; i++)
+        if (d_lengths[i] && ++n >= 2)
+            return;
+    if (n == 0)
+        d_lengths[0] = d_lengths[1] = 1;
+    else
+        d_lengths[d_lengths[0] ? 1 : 0] = 1;
+}
+
+/* Make the counts more uniform where it lets the code lengths be written
+ * with more repeat codes, it can make the dynamic block smaller overall (as
+ * in zopfli and brotli) */
+    static void
+gst_gz_archive_optimize_for_rle (gsize * counts, gint length)
+{
+    gboolean good[288];
+    gsize symbol, sum, limit;
+    gint i, k, stride;
+
+    /* The trailing zeros are not written */
+    for (; length > 0; length--)
+        if (counts[length - 1])
+            break;
+    if (length == 0)
+        return;
+
+    /* Mark the counts that can already be written with repeat codes */
+    memset (good, 0, sizeof (good));
+    symbol = counts[0];
+    stride = 0;
+    for (i = 0; i < length + 1; i++)
+    {
+        if (i == length || counts[i] != symbol)
+        {
+            if ((symbol == 0 && stride >= 5) || (symbol != 0 && stride >= 7))
+                for (k = 0; k < stride; k++)
+                    good[i - k - 1] = TRUE;
+            stride = 1;
+            if (i != length)
+                symbol = counts[i];
+        }
+        else
+            stride++;
+    }
+
+    /* Replace the runs of close counts with their average */
+    stride = 0;
+    limit = counts[0];
+    sum = 0;
+    for (i = 0; i < length + 1; i++)
+    {
+        if (i == length || good[i]
+                || (counts[i] > limit ? counts[i] - limit : limit - counts[i]) >= 4)
+        {
+            if (stride >= 4 || (stride >= 3 && sum == 0))
+            {
+                gsize count = (sum + stride / 2) / stride;
+
+                if (count < 1)
+                    count = 1;
+                if (sum == 0)
+                    count = 0;
+                for (k = 0; k < stride; k++)
+                    counts[i - k - 1] = count;
+            }
+            stride = 0;
+            sum = 0;
+            if (i < length - 3)
+                limit = (counts[i] + counts[i + 1] + counts[i + 2]
+                        + counts[i + 3] + 2) / 4;
+            else if (i < length)
+                limit = counts[i];
+            else
+                limit = 0;
+        }
+        stride++;
+        if (i != length)
+            sum += counts[i];
+    }
+}
+
+/* Writer */
+
+    static void
+gst_gz_archive_put_byte (GstGzArchiveWriter * writer, guint8 byte)
+{
+    if (writer->len == writer->alloc)
+    {
+        writer->alloc = MAX (writer->alloc * 2, 4096);
+        writer->data = g_realloc (writer->data, writer->alloc);
+    }
+    writer->data[writer->len++] = byte;
+}
+
+    static void
+gst_gz_archive_put_bits (GstGzArchiveWriter * writer, guint value, guint n)
+{
+    writer->bits |= (guint32) value << writer->n_bits;
+    writer->n_bits += n;
+    while (writer->n_bits >= 8)
+    {
+        gst_gz_archive_put_byte (writer, writer->bits & 0xff);
+        writer->bits >>= 8;
+        writer->n_bits -= 8;
+    }
+}
+
+/* Huffman codes are written from their most significant bit */
+    static void
+gst_gz_archive_put_code (GstGzArchiveWriter * writer, guint code, guint n)
+{
+    guint reversed = 0, i;
+
+    for (i = 0; i < n; i++)
+        reversed |= ((code >> (n - i - 1)) & 1) << i;
+    gst_gz_archive_put_bits (writer, reversed, n);
+}
+
+/* Pad to a byte boundary */
+    static void
+gst_gz_archive_align (GstGzArchiveWriter * writer)
+{
+    if (writer->n_bits)
+        gst_gz_archive_put_bits (writer, 0, 8 - writer->n_bits);
+}
+
+/* Block sizes */
+
+/* Write the code lengths of a dynamic block with the given repeat codes
+ * allowed, or only compute the size in bits when writer is NULL */
+    static gsize
+gst_gz_archive_encode_tree (const guint * ll_lengths, const guint * d_lengths,
+        gboolean use_16, gboolean use_17, gboolean use_18,
+        GstGzArchiveWriter * writer)
+{
+    guint8 rle[286 + 30];
+    guint8 rle_bits[286 + 30];
+    gsize clcounts[19] = { 0 };
+    guint clcl[19], clsymbols[19];
+    guint hlit = 29, hdist = 29, hclen, total, n_rle = 0, n_used = 0;
+    guint i, j;
+    gsize size;
+
+    /* Trim the unused codes at the end */
+    while (hlit > 0 && ll_lengths[257 + hlit - 1] == 0)
+        hlit--;
+    while (hdist > 0 && d_lengths[1 + hdist - 1] == 0)
+        hdist--;
+    total = hlit + 257 + hdist + 1;
+
+#define LENGTH_AT(k) ((k) < hlit + 257 ? ll_lengths[k] : d_lengths[(k) - hlit - 257])
+    for (i = 0; i < total; i++)
+    {
+        guint symbol = LENGTH_AT (i);
+        guint count = 1;
+
+        if (use_16 || (symbol == 0 && (use_17 || use_18)))
+            for (j = i + 1; j < total && LENGTH_AT (j) == symbol; j++)
+                count++;
+        i += count - 1;
+
+        /* Runs of zeros */
+        if (symbol == 0 && count >= 3)
+        {
+            if (use_18)
+                while (count >= 11)
+                {
+                    guint n = MIN (count, 138);
+
+                    rle[n_rle] = 18;
+                    rle_bits[n_rle++] = n - 11;
+                    clcounts[18]++;
+                    count -= n;
+                }
+            if (use_17)
+                while (count >= 3)
+                {
+                    guint n = MIN (count, 10);
+
+                    rle[n_rle] = 17;
+                    rle_bits[n_rle++] = n - 3;
+                    clcounts[17]++;
+                    count -= n;
+                }
+        }
+
+        /* Runs of any length, after the length itself */
+        if (use_16 && count >= 4)
+        {
+            count--;
+            rle[n_rle] = symbol;
+            rle_bits[n_rle++] = 0;
+            clcounts[symbol]++;
+            while (count >= 3)
+            {
+                guint n = MIN (count, 6);
+
+                rle[n_rle] = 16;
+                rle_bits[n_rle++] = n - 3;
+                clcounts[16]++;
+                count -= n;
+            }
+        }
+
+        clcounts[symbol] += count;
+        while (count > 0)
+        {
+            rle[n_rle] = symbol;
+            rle_bits[n_rle++] = 0;
+            count--;
+        }
+    }
+#undef LENGTH_AT
+
+    gst_gz_archive_code_lengths (clcounts, 19, 7, clcl);
+    /* A single code length code would be an incomplete code, which zlib
+     * rejects: give a length to one of the first codes written */
+    for (i = 0; i < 19; i++)
+        if (clcl[i])
+            n_used++;
+    if (n_used == 1)
+        clcl[clcl[clcl_order[0]] ? clcl_order[1] : clcl_order[0]] = 1;
+
+    hclen = 15;
+    while (hclen > 0 && clcounts[clcl_order[hclen + 4 - 1]] == 0
+            && !clcl[clcl_order[hclen + 4 - 1]])
+        hclen--;
+
+    if (writer)
+    {
+        gst_gz_archive_code_symbols (clcl, 19, clsymbols);
+        gst_gz_archive_put_bits (writer, hlit, 5);
+        gst_gz_archive_put_bits (writer, hdist, 5);
+        gst_gz_archive_put_bits (writer, hclen, 4);
+        for (i = 0; i < hclen + 4; i++)
+            gst_gz_archive_put_bits (writer, clcl[clcl_order[i]], 3);
+        for (i = 0; i < n_rle; i++)
+        {
+            gst_gz_archive_put_code (writer, clsymbols[rle[i]], clcl[rle[i]]);
+            if (rle[i] == 16)
+                gst_gz_archive_put_bits (writer, rle_bits[i], 2);
+            else if (rle[i] == 17)
+                gst_gz_archive_put_bits (writer, rle_bits[i], 3);
+            else if (rle[i] == 18)
+                gst_gz_archive_put_bits (writer, rle_bits[i], 7);
+        }
+    }
+
+    size = 14 + (hclen + 4) * 3;
+    for (i = 0; i < 19; i++)
+        size += clcl[i] * clcounts[i];
+    size += clcounts[16] * 2 + clcounts[17] * 3 + clcounts[18] * 7;
+    return size;
+}
+
+/* Smallest header of a dynamic block, the repeat codes used are returned
+ * in use */
+    static gsize
+gst_gz_archive_tree_size (const guint * ll_lengths, const guint * d_lengths,
+        guint * use)
+{
+    gsize best = G_MAXSIZE;
+    guint i;
+
+    for (i = 0; i < 8; i++)
+    {
+        gsize size = gst_gz_archive_encode_tree (ll_lengths, d_lengths,
+                i & 1, i & 2, i & 4, NULL);
+
+        if (size < best)
+        {
+            best = size;
+            if (use)
+                *use = i;
+        }
+    }
+    return best;
+}
+
+/* Bits of the symbols of a block, end of block included */
+    static gsize
+gst_gz_archive_data_size (const gsize * ll_counts, const gsize * d_counts,
+        const guint * ll_lengths, const guint * d_lengths)
+{
+    gsize size = 0;
+    guint i;
+
+    for (i = 0; i < 286; i++)
+        size += ll_counts[i] * (ll_lengths[i]
+                + (i > 256 ? gst_gz_archive_length_extra (i) : 0));
+    for (i = 0; i < 30; i++)
+        size += d_counts[i] * (d_lengths[i] + gst_gz_archive_dist_extra (i));
+    return size;
+}
+
+    static void
+gst_gz_archive_huffman_lengths (gsize * ll_counts, gsize * d_counts,
+        guint * ll_lengths, guint * d_lengths)
+{
+    gst_gz_archive_code_lengths (ll_counts, 288, 15, ll_lengths);
+    gst_gz_archive_code_lengths (d_counts, 32, 15, d_lengths);
+    gst_gz_archive_patch_distances (d_lengths);
+}
+
+/* Code lengths of a dynamic block for symbols [from, to) of a store, and
+ * the size of the block in bits without its 3 bits header */
+    static gsize
+gst_gz_archive_dynamic_lengths (const GstGzArchiveStore * store, gsize from,
+        gsize to, guint * ll_lengths, guint * d_lengths)
+{
+    gsize ll_counts[288], d_counts[32], ll_counts2[288], d_counts2[32];
+    guint ll_lengths2[288], d_lengths2[32];
+    gsize size, size2;
+
+    gst_gz_archive_store_counts (store, from, to, ll_counts, d_counts);
+    memcpy (ll_counts2, ll_counts, sizeof (ll_counts));
+    memcpy (d_counts2, d_counts, sizeof (d_counts));
+
+    gst_gz_archive_huffman_lengths (ll_counts, d_counts, ll_lengths, d_lengths);
+    size = gst_gz_archive_tree_size (ll_lengths, d_lengths, NULL)
+        + gst_gz_archive_data_size (ll_counts, d_counts, ll_lengths, d_lengths);
+
+    gst_gz_archive_optimize_for_rle (ll_counts2, 288);
+    gst_gz_archive_optimize_for_rle (d_counts2, 32);
+    gst_gz_archive_huffman_lengths (ll_counts2, d_counts2, ll_lengths2,
+            d_lengths2);
+    size2 = gst_gz_archive_tree_size (ll_lengths2, d_lengths2, NULL)
+        + gst_gz_archive_data_size (ll_counts, d_counts, ll_lengths2,
+                d_lengths2);
+
+    if (size2 < size)
+    {
+        memcpy (ll_lengths, ll_lengths2, sizeof (ll_lengths2));
+        memcpy (d_lengths, d_lengths2, sizeof (d_lengths2));
+        size = size2;
+    }
+    return size;
+}
+
+    static void
+gst_gz_archive_fixed_lengths (guint * ll_lengths, guint * d_lengths)
+{
+    guint i;
+
+    for (i = 0; i < 288; i++)
+        ll_lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    for (i = 0; i < 32; i++)
+        d_lengths[i] = 5;
+}
+
+/* Size in bits of symbols [from, to) of a store as a stored (0), fixed (1)
+ * or dynamic (2) block */
+    static gsize
+gst_gz_archive_block_size (const GstGzArchiveStore * store, gsize from,
+        gsize to, guint type)
+{
+    guint ll_lengths[288], d_lengths[32];
+    gsize ll_counts[288], d_counts[32];
+
+    if (type == 0)
+    {
+        gsize bytes = gst_gz_archive_store_bytes (store, from, to);
+        gsize blocks = MAX ((bytes + MAX_STORED_BLOCK_SIZE - 1)
+                / MAX_STORED_BLOCK_SIZE, 1);
+
+        return blocks * 5 * 8 + bytes * 8;
+    }
+    if (type == 2)
+        return 3 + gst_gz_archive_dynamic_lengths (store, from, to,
+                ll_lengths, d_lengths);
+    gst_gz_archive_fixed_lengths (ll_lengths, d_lengths);
+    gst_gz_archive_store_counts (store, from, to, ll_counts, d_counts);
+    return 3 + gst_gz_archive_data_size (ll_counts, d_counts, ll_lengths,
+            d_lengths);
+}
+
+    static gsize
+gst_gz_archive_block_size_auto (const GstGzArchiveStore * store, gsize from,
+        gsize to)
+{
+    gsize stored = gst_gz_archive_block_size (store, from, to, 0);
+    gsize fixed = gst_gz_archive_block_size (store, from, to, 1);
+    gsize dynamic = gst_gz_archive_block_size (store, from, to, 2);
+
+    return MIN (stored, MIN (fixed, dynamic));
+}
+
+/* Match search */
+
+    static guint
+gst_gz_archive_hash (const guint8 * p)
+{
+    guint32 v = p[0] | (p[1] << 8) | (p[2] << 16);
+
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+    static void
+gst_gz_archive_add_pairs (GstGzArchive * archive, guint16 * pairs, guint n)
+{
+    guint i;
+
+    /* Dropping a pair gives its lengths the distance of the next one,
+     * which matches them too: keep the shortest distances and the longest
+     * match */
+    if (n > MAX_PAIRS)
+    {
+        memmove (pairs + 2 * (MAX_PAIRS - 1),
+                pairs + 2 * (n - 1), 2 * sizeof (guint16));
+        n = MAX_PAIRS;
+    }
+    if (archive->n_pairs + n > archive->pairs_alloc)
+    {
+        archive->pairs_alloc = MAX (archive->pairs_alloc * 2, 65536);
+        archive->pairs = g_renew (guint16, archive->pairs,
+                2 * archive->pairs_alloc);
+    }
+    for (i = 0; i < 2 * n; i++)
+        archive->pairs[2 * archive->n_pairs + i] = pairs[i];
+    archive->n_pairs += n;
+}
+
+/* Search the matches of every position of the data with hash chains. For
+ * each position and each length, the smallest distance of a match of at
+ * least that length is kept: it is recorded as the increasing lengths
+ * reached by the successive candidates, with their distance. */
+    static void
+gst_gz_archive_find_matches (GstGzArchive * archive)
+{
+    const guint8 *in = archive->in;
+    gsize end = archive->end, i;
+    gint32 *head, *prev;
+    guint16 pairs[2 * MAX_MATCH];
+
+    archive->same = g_new (guint16, end);
+    archive->same[end - 1] = 0;
+    for (i = end - 1; i-- > 0;)
+        archive->same[i] = in[i] == in[i + 1] ?
+            MIN (archive->same[i + 1] + 1, G_MAXUINT16) : 0;
+
+    archive->first = g_new (guint32, end - archive->start + 1);
+    head = g_new (gint32, 1 << HASH_BITS);
+    memset (head, 0xff, sizeof (gint32) << HASH_BITS);
+    prev = g_new (gint32, end);
+
+    for (i = 0; i < end; i++)
+    {
+        guint limit = MIN (MAX_MATCH, end - i), best = MIN_MATCH - 1;
+        guint n = 0, hits = 0, h;
+        gint32 cand;
+
+        if (i >= archive->start)
+            archive->first[i - archive->start] = archive->n_pairs;
+        if (limit < MIN_MATCH)
+            continue;
+        h = gst_gz_archive_hash (in + i);
+
+        /* The window is only indexed */
+        cand = i >= archive->start ? head[h] : -1;
+        for (; cand >= 0 && i - cand <= WINDOW_SIZE && hits < MAX_CHAIN_HITS;
+                cand = prev[cand], hits++)
+        {
+            const guint8 *scan = in + i, *match = in + cand;
+            const guint8 *stop = scan + limit;
+            guint len;
+
+            if (match[best] != scan[best])
+                continue;
+            /* Skip the common run of a repeated byte at once */
+            if (archive->same[i] > 2 && *scan == *match)
+            {
+                guint same = MIN (archive->same[i], archive->same[cand]);
+
+                same = MIN (same, limit);
+                scan += same;
+                match += same;
+            }
+            while (scan != stop && *scan == *match)
+            {
+                scan++;
+                match++;
+            }
+            len = scan - (in + i);
+            if (len > best)
+            {
+                pairs[2 * n] = len;
+                pairs[2 * n + 1] = i - cand;
+                n++;
+                best = len;
+                if (len >= limit)
+                    break;
+            }
+        }
+        if (n)
+            gst_gz_archive_add_pairs (archive, pairs, n);
+
+        prev[i] = head[h];
+        head[h] = i;
+    }
+    archive->first[end - archive->start] = archive->n_pairs;
+
+    g_free (prev);
+    g_free (head);
+}
+
+/* Longest match at pos, limited to max, 0 if none */
+    static guint
+gst_gz_archive_longest (GstGzArchive * archive, gsize pos, guint max,
+        guint * dist)
+{
+    gsize i = pos - archive->start;
+    guint32 p, first = archive->first[i], last = archive->first[i + 1];
+    guint len;
+
+    if (first == last)
+        return 0;
+    len = MIN (archive->pairs[2 * (last - 1)], max);
+    if (len < MIN_MATCH)
+        return 0;
+    for (p = first; archive->pairs[2 * p] < len; p++);
+    *dist = archive->pairs[2 * p + 1];
+    return len;
+}
+
+/* Distance of the match of the given length at pos */
+    static guint
+gst_gz_archive_match_dist (GstGzArchive * archive, gsize pos, guint len)
+{
+    guint32 p = archive->first[pos - archive->start];
+
+    while (archive->pairs[2 * p] < len)
+        p++;
+    return archive->pairs[2 * p + 1];
+}
+
+/* Parsing */
+
+/* Cost in bits of a literal or a match, with the fixed codes when stats is
+ * NULL */
+    static gdouble
+gst_gz_archive_cost (const GstGzArchiveStats * stats, guint litlen, guint dist)
+{
+    guint lsym, dsym;
+
+    if (!stats)
+    {
+        if (!dist)
+            return litlen < 144 ? 8 : 9;
+        lsym = gst_gz_archive_length_symbol (litlen);
+        dsym = gst_gz_archive_dist_symbol (dist);
+        return (lsym < 280 ? 7 : 8) + gst_gz_archive_length_extra (lsym)
+            + 5 + gst_gz_archive_dist_extra (dsym);
+    }
+    if (!dist)
+        return stats->ll_costs[litlen];
+    lsym = gst_gz_archive_length_symbol (litlen);
+    dsym = gst_gz_archive_dist_symbol (dist);
+    return stats->ll_costs[lsym] + gst_gz_archive_length_extra (lsym)
+        + stats->d_costs[dsym] + gst_gz_archive_dist_extra (dsym);
+}
+
+/* Cost of the cheapest match, the lengths and distances cost separately */
+    static gdouble
+gst_gz_archive_min_cost (const GstGzArchiveStats * stats)
+{
+    gdouble best = LARGE_COST;
+    guint i, length = MIN_MATCH, dist = 1;
+
+    for (i = MIN_MATCH; i <= MAX_MATCH; i++)
+    {
+        gdouble c = gst_gz_archive_cost (stats, i, 1);
+
+        if (c < best)
+        {
+            best = c;
+            length = i;
+        }
+    }
+    best = LARGE_COST;
+    for (i = 0; i < 30; i++)
+    {
+        gdouble c = gst_gz_archive_cost (stats, MIN_MATCH, dist_base[i]);
+
+        if (c < best)
+        {
+            best = c;
+            dist = dist_base[i];
+        }
+    }
+    return gst_gz_archive_cost (stats, length, dist);
+}
+
+/* Cheapest parse of [from, to) with the cost model, into store */
+    static void
+gst_gz_archive_parse (GstGzArchive * archive, gsize from, gsize to,
+        const GstGzArchiveStats * stats, GstGzArchiveStore * store)
+{
+    const guint8 *in = archive->in;
+    gfloat *costs = archive->costs;
+    guint16 *lengths = archive->lengths, *path = archive->path;
+    gsize n = to - from, n_path = 0, i, j;
+    gdouble min_cost = gst_gz_archive_min_cost (stats);
+
+    costs[0] = 0;
+    for (j = 1; j <= n; j++)
+        costs[j] = LARGE_COST;
+
+    for (j = 0; j < n; j++)
+    {
+        guint32 p, first, last;
+        guint k, max;
+        gdouble cost;
+
+        i = from + j;
+        /* In a long run of the same byte, the matches of maximum length at
+         * distance 1 are the best choice */
+        if (archive->same[i] > MAX_MATCH * 2 && to - i > MAX_MATCH * 2 + 1
+                && i > from + MAX_MATCH + 1
+                && archive->same[i - MAX_MATCH] > MAX_MATCH)
+        {
+            cost = gst_gz_archive_cost (stats, MAX_MATCH, 1);
+            for (k = 0; k < MAX_MATCH; k++, j++)
+            {
+                costs[j + MAX_MATCH] = costs[j] + cost;
+                lengths[j + MAX_MATCH] = MAX_MATCH;
+            }
+            i = from + j;
+        }
+
+        cost = costs[j] + gst_gz_archive_cost (stats, in[i], 0);
+        if (cost < costs[j + 1])
+        {
+            costs[j + 1] = cost;
+            lengths[j + 1] = 1;
+        }
+
+        first = archive->first[i - archive->start];
+        last = archive->first[i - archive->start + 1];
+        max = MIN (MAX_MATCH, n - j);
+        k = MIN_MATCH;
+        for (p = first; p < last && k <= max; p++)
+        {
+            guint len = MIN (archive->pairs[2 * p], max);
+            guint dist = archive->pairs[2 * p + 1];
+
+            for (; k <= len; k++)
+            {
+                if (costs[j + k] - costs[j] <= min_cost)
+                    continue;
+                cost = costs[j] + gst_gz_archive_cost (stats, k, dist);
+                if (cost < costs[j + k])
+                {
+                    costs[j + k] = cost;
+                    lengths[j + k] = k;
+                }
+            }
+        }
+    }
+
+    /* Walk the cheapest path back, then store it forward */
+    for (j = n; j > 0; j -= lengths[j])
+        path[n_path++] = lengths[j];
+    for (i = from; n_path-- > 0; i += path[n_path])
+    {
+        if (path[n_path] == 1)
+            gst_gz_archive_store_add (store, in[i], 0, i);
+        else
+            gst_gz_archive_store_add (store, path[n_path],
+                    gst_gz_archive_match_dist (archive, i, path[n_path]), i);
+    }
+}
+
+/* Lazy matching as in zlib, for the first statistics and the block split */
+    static void
+gst_gz_archive_greedy (GstGzArchive * archive, gsize from, gsize to,
+        GstGzArchiveStore * store)
+{
+    const guint8 *in = archive->in;
+    guint prev_len = 0, prev_dist = 0;
+    gboolean available = FALSE;
+    gsize i;
+
+#define SCORE(len, dist) ((gint) (len) - ((dist) > 1024 ? 1 : 0))
+    for (i = from; i < to; i++)
+    {
+        guint dist = 0, len;
+
+        len = gst_gz_archive_longest (archive, i, MIN (MAX_MATCH, to - i),
+                &dist);
+        if (available)
+        {
+            available = FALSE;
+            if (SCORE (len, dist) > SCORE (prev_len, prev_dist) + 1)
+            {
+                gst_gz_archive_store_add (store, in[i - 1], 0, i - 1);
+                if (SCORE (len, dist) >= MIN_MATCH && len < MAX_MATCH)
+                {
+                    available = TRUE;
+                    prev_len = len;
+                    prev_dist = dist;
+                    continue;
+                }
+            }
+            else
+            {
+                gst_gz_archive_store_add (store, prev_len, prev_dist, i - 1);
+                i += prev_len - 2;
+                continue;
+            }
+        }
+        else if (SCORE (len, dist) >= MIN_MATCH && len < MAX_MATCH)
+        {
+            available = TRUE;
+            prev_len = len;
+            prev_dist = dist;
+            continue;
+        }
+
+        if (SCORE (len, dist) >= MIN_MATCH)
+        {
+            gst_gz_archive_store_add (store, len, dist, i);
+            i += len - 1;
+        }
+        else
+            gst_gz_archive_store_add (store, in[i], 0, i);
+    }
+#undef SCORE
+}
+
+    static void
+gst_gz_archive_stats_costs (GstGzArchiveStats * stats)
+{
+    gsize *counts[2] = { stats->litlens, stats->dists };
+    gdouble *costs[2] = { stats->ll_costs, stats->d_costs };
+    guint sizes[2] = { 288, 32 };
+    guint t, i;
+
+    /* Entropy of each symbol */
+    for (t = 0; t < 2; t++)
+    {
+        gsize sum = 0;
+        gdouble log2sum;
+
+        for (i = 0; i < sizes[t]; i++)
+            sum += counts[t][i];
+        log2sum = gst_gz_archive_log2 (sum ? sum : sizes[t]);
+        for (i = 0; i < sizes[t]; i++)
+        {
+            costs[t][i] = counts[t][i] ?
+                log2sum - gst_gz_archive_log2 (counts[t][i]) : log2sum;
+            if (costs[t][i] < 0)
+                costs[t][i] = 0;
+        }
+    }
+}
+
+    static void
+gst_gz_archive_stats_from_store (GstGzArchiveStats * stats,
+        const GstGzArchiveStore * store)
+{
+    gst_gz_archive_store_counts (store, 0, store->len, stats->litlens,
+            stats->dists);
+    gst_gz_archive_stats_costs (stats);
+}
+
+    static guint32
+gst_gz_archive_random (GstGzArchive * archive)
+{
+    archive->ran_z = 36969 * (archive->ran_z & 65535) + (archive->ran_z >> 16);
+    archive->ran_w = 18000 * (archive->ran_w & 65535) + (archive->ran_w >> 16);
+    return (archive->ran_z << 16) + archive->ran_w;
+}
+
+/* Get the parsing out of a fixed point by replacing some frequencies with
+ * others */
+    static void
+gst_gz_archive_randomize (GstGzArchive * archive, gsize * counts, guint n)
+{
+    guint i;
+
+    for (i = 0; i < n; i++)
+        if ((gst_gz_archive_random (archive) >> 4) % 3 == 0)
+            counts[i] = counts[gst_gz_archive_random (archive) % n];
+}
+
+/* Parse [from, to) several times, each time with the statistics of the
+ * previous parse, and keep the smallest result as a dynamic block */
+    static void
+gst_gz_archive_optimal (GstGzArchive * archive, gsize from, gsize to,
+        guint iterations, GstGzArchiveStore * best)
+{
+    GstGzArchiveStore current = { 0 };
+    GstGzArchiveStats stats, best_stats, last_stats;
+    gsize best_cost = G_MAXSIZE, last_cost = 0;
+    gboolean randomized = FALSE;
+    guint i, k;
+
+    archive->ran_w = 1;
+    archive->ran_z = 2;
+    gst_gz_archive_greedy (archive, from, to, &current);
+    gst_gz_archive_stats_from_store (&stats, &current);
+    best_stats = stats;
+
+    for (i = 0; i < MAX (iterations, 1); i++)
+    {
+        gsize cost;
+
+        current.len = 0;
+        gst_gz_archive_parse (archive, from, to, &stats, &current);
+        cost = gst_gz_archive_block_size (&current, 0, current.len, 2);
+        if (cost < best_cost)
+        {
+            best->len = 0;
+            gst_gz_archive_store_append (best, &current, 0, current.len);
+            best_stats = stats;
+            best_cost = cost;
+        }
+
+        last_stats = stats;
+        gst_gz_archive_store_counts (&current, 0, current.len, stats.litlens,
+                stats.dists);
+        /* Once randomized, converge slowly */
+        if (randomized)
+        {
+            for (k = 0; k < 288; k++)
+                stats.litlens[k] += last_stats.litlens[k] / 2;
+            for (k = 0; k < 32; k++)
+                stats.dists[k] += last_stats.dists[k] / 2;
+            stats.litlens[256] = 1;
+        }
+        gst_gz_archive_stats_costs (&stats);
+
+        if (i > 5 && cost == last_cost)
+        {
+            stats = best_stats;
+            gst_gz_archive_randomize (archive, stats.litlens, 288);
+            gst_gz_archive_randomize (archive, stats.dists, 32);
+            stats.litlens[256] = 1;
+            gst_gz_archive_stats_costs (&stats);
+            randomized = TRUE;
+        }
+        last_cost = cost;
+    }
+    gst_gz_archive_store_clear (&current);
+}
+
+/* Block split */
+
+/* Position in [start, end) where f is the smallest, f being assumed to
+ * have few local minimums: sampled and narrowed down on large ranges */
+    static gsize
+gst_gz_archive_split_minimum (const GstGzArchiveStore * store, gsize lstart,
+        gsize lend, gsize start, gsize end, gsize * smallest)
+{
+#define SPLIT_COST(p) (gst_gz_archive_block_size_auto (store, lstart, p) \
+        + gst_gz_archive_block_size_auto (store, p, lend))
+    gsize best = G_MAXSIZE, result = start, last_best = G_MAXSIZE, i;
+
+    if (end - start < 1024)
+    {
+        for (i = start; i < end; i++)
+        {
+            gsize cost = SPLIT_COST (i);
+
+            if (cost < best)
+            {
+                best = cost;
+                result = i;
+            }
+        }
+        *smallest = best;
+        return result;
+    }
+
+    while (end - start > SPLIT_SAMPLES)
+    {
+        gsize p[SPLIT_SAMPLES], cost[SPLIT_SAMPLES];
+        guint besti = 0;
+
+        for (i = 0; i < SPLIT_SAMPLES; i++)
+        {
+            p[i] = start + (i + 1) * ((end - start) / (SPLIT_SAMPLES + 1));
+            cost[i] = SPLIT_COST (p[i]);
+            if (cost[i] < cost[besti])
+                besti = i;
+        }
+        if (cost[besti] > last_best)
+            break;
+        start = besti == 0 ? start : p[besti - 1];
+        end = besti == SPLIT_SAMPLES - 1 ? end : p[besti + 1];
+        result = p[besti];
+        last_best = cost[besti];
+    }
+    *smallest = last_best;
+    return result;
+#undef SPLIT_COST
+}
+
+/* Split points of a store into blocks of smaller total size: the largest
+ * block that can still be split is split at its best point, until no split
+ * helps */
+    static GArray *
+gst_gz_archive_split (const GstGzArchiveStore * store)
+{
+    GArray *points = g_array_new (FALSE, FALSE, sizeof (gsize));
+    gsize lstart = 0, lend = store->len;
+    guint8 *done;
+
+    if (store->len < 10)
+        return points;
+    done = g_malloc0 (store->len);
+    while (points->len + 1 < MAX_BLOCKS)
+    {
+        gsize split_cost, cost, pos, longest = 0;
+        guint i;
+        gboolean found = FALSE;
+
+        pos = gst_gz_archive_split_minimum (store, lstart, lend, lstart + 1,
+                lend, &split_cost);
+        cost = gst_gz_archive_block_size_auto (store, lstart, lend);
+        if (split_cost > cost || pos == lstart + 1 || pos == lend)
+            done[lstart] = 1;
+        else
+        {
+            for (i = 0; i < points->len; i++)
+                if (g_array_index (points, gsize, i) > pos)
+                    break;
+            g_array_insert_val (points, i, pos);
+        }
+
+        for (i = 0; i <= points->len; i++)
+        {
+            gsize start = i == 0 ? 0 : g_array_index (points, gsize, i - 1);
+            gsize end = i == points->len ? store->len - 1 :
+                g_array_index (points, gsize, i);
+
+            if (!done[start] && end - start > longest)
+            {
+                lstart = start;
+                lend = end;
+                longest = end - start;
+                found = TRUE;
+            }
+        }
+        if (!found || lend - lstart < 10)
+            break;
+    }
+    g_free (done);
+    return points;
+}
+
+/* Output */
+
+    static void
+gst_gz_archive_write_stored (GstGzArchive * archive,
+        GstGzArchiveWriter * writer, gboolean final, gsize from, gsize to)
+{
+    gsize pos = from;
+
+    do
+    {
+        gsize len = MIN (to - pos, MAX_STORED_BLOCK_SIZE), i;
+
+        gst_gz_archive_put_bits (writer, final && pos + len == to, 1);
+        gst_gz_archive_put_bits (writer, 0, 2);
+        gst_gz_archive_align (writer);
+        gst_gz_archive_put_bits (writer, len, 16);
+        gst_gz_archive_put_bits (writer, ~len & 0xffff, 16);
+        for (i = 0; i < len; i++)
+            gst_gz_archive_put_byte (writer, archive->in[pos + i]);
+        pos += len;
+    } while (pos < to);
+}
+
+/* Write symbols [from, to) of a store as a fixed (1) or dynamic (2) block */
+    static void
+gst_gz_archive_write_huffman (GstGzArchiveWriter * writer, gboolean final,
+        guint type, const GstGzArchiveStore * store, gsize from, gsize to)
+{
+    guint ll_lengths[288], d_lengths[32], ll_symbols[288], d_symbols[32];
+    gsize i;
+
+    gst_gz_archive_put_bits (writer, final, 1);
+    gst_gz_archive_put_bits (writer, type, 2);
+    if (type == 1)
+        gst_gz_archive_fixed_lengths (ll_lengths, d_lengths);
+    else
+    {
+        guint use = 0;
+
+        gst_gz_archive_dynamic_lengths (store, from, to, ll_lengths, d_lengths);
+        gst_gz_archive_tree_size (ll_lengths, d_lengths, &use);
+        gst_gz_archive_encode_tree (ll_lengths, d_lengths, use & 1, use & 2,
+                use & 4, writer);
+    }
+    gst_gz_archive_code_symbols (ll_lengths, 288, ll_symbols);
+    gst_gz_archive_code_symbols (d_lengths, 32, d_symbols);
+
+    for (i = from; i < to; i++)
+    {
+        guint litlen = store->litlens[i], dist = store->dists[i];
+        guint lsym, dsym, v;
+
+        if (!dist)
+        {
+            gst_gz_archive_put_code (writer, ll_symbols[litlen],
+                    ll_lengths[litlen]);
+            continue;
+        }
+        lsym = gst_gz_archive_length_symbol (litlen);
+        gst_gz_archive_put_code (writer, ll_symbols[lsym], ll_lengths[lsym]);
+        if (gst_gz_archive_length_extra (lsym))
+        {
+            v = litlen - MIN_MATCH;
+            gst_gz_archive_put_bits (writer,
+                    v & ((1 << gst_gz_archive_length_extra (lsym)) - 1),
+                    gst_gz_archive_length_extra (lsym));
+        }
+        dsym = gst_gz_archive_dist_symbol (dist);
+        gst_gz_archive_put_code (writer, d_symbols[dsym], d_lengths[dsym]);
+        if (gst_gz_archive_dist_extra (dsym))
+            gst_gz_archive_put_bits (writer, dist - dist_base[dsym],
+                    gst_gz_archive_dist_extra (dsym));
+    }
+    gst_gz_archive_put_code (writer, ll_symbols[256], ll_lengths[256]);
+}
+
+/* Write symbols [from, to) of a store as the smallest of a stored, fixed or
+ * dynamic block. A parse made for the fixed codes is tried when they come
+ * close. */
+    static void
+gst_gz_archive_write_block (GstGzArchive * archive,
+        GstGzArchiveWriter * writer, gboolean final,
+        const GstGzArchiveStore * store, gsize from, gsize to)
+{
+    GstGzArchiveStore fixed_store = { 0 };
+    gsize stored, fixed, dynamic, start, end;
+    gboolean fixed_parse;
+
+    start = store->pos[from];
+    end = start + gst_gz_archive_store_bytes (store, from, to);
+    stored = gst_gz_archive_block_size (store, from, to, 0);
+    fixed = gst_gz_archive_block_size (store, from, to, 1);
+    dynamic = gst_gz_archive_block_size (store, from, to, 2);
+
+    fixed_parse = to - from < 1000 || fixed <= dynamic * 1.1;
+    if (fixed_parse)
+    {
+        gst_gz_archive_parse (archive, start, end, NULL, &fixed_store);
+        fixed = MIN (fixed, gst_gz_archive_block_size (&fixed_store, 0,
+                    fixed_store.len, 1));
+    }
+
+    if (stored < fixed && stored < dynamic)
+        gst_gz_archive_write_stored (archive, writer, final, start, end);
+    else if (fixed < dynamic)
+    {
+        if (fixed_parse && gst_gz_archive_block_size (&fixed_store, 0,
+                    fixed_store.len, 1) == fixed)
+            gst_gz_archive_write_huffman (writer, final, 1, &fixed_store, 0,
+                    fixed_store.len);
+        else
+            gst_gz_archive_write_huffman (writer, final, 1, store, from, to);
+    }
+    else
+        gst_gz_archive_write_huffman (writer, final, 2, store, from, to);
+    gst_gz_archive_store_clear (&fixed_store);
+}
+
+    static gsize
+gst_gz_archive_split_size (const GstGzArchiveStore * store, GArray * points)
+{
+    gsize size = 0;
+    guint i;
+
+    for (i = 0; i <= points->len; i++)
+    {
+        gsize start = i == 0 ? 0 : g_array_index (points, gsize, i - 1);
+        gsize end = i == points->len ? store->len :
+            g_array_index (points, gsize, i);
+
+        size += gst_gz_archive_block_size_auto (store, start, end);
+    }
+    return size;
+}
+
+    void
+gst_gz_archive_deflate (GstGzArchiveChunk * chunk)
+{
+    GstGzArchive archive = { 0 };
+    GstGzArchiveWriter writer = { 0 };
+    GstGzArchiveStore greedy = { 0 }, store = { 0 };
+    GArray *points, *points2;
+    gsize window = MIN (chunk->window, WINDOW_SIZE);
+    gsize size, start;
+    guint i;
+
+    archive.in = chunk->data - window;
+    archive.start = window;
+    archive.end = window + chunk->size;
+
+    if (!chunk->size)
+    {
+        /* Empty fixed block */
+        gst_gz_archive_put_bits (&writer, chunk->final, 1);
+        gst_gz_archive_put_bits (&writer, 1, 2);
+        gst_gz_archive_put_bits (&writer, 0, 7);
+        goto done;
+    }
+
+    gst_gz_archive_find_matches (&archive);
+    archive.costs = g_new (gfloat, chunk->size + 1);
+    archive.lengths = g_new (guint16, chunk->size + 1);
+    archive.path = g_new (guint16, chunk->size);
+
+    /* Split the data where the greedy parse suggests, then parse each block
+     * on its own */
+    gst_gz_archive_greedy (&archive, archive.start, archive.end, &greedy);
+    points = gst_gz_archive_split (&greedy);
+    for (i = 0; i < points->len; i++)
+        g_array_index (points, gsize, i) =
+            greedy.pos[g_array_index (points, gsize, i)];
+    gst_gz_archive_store_clear (&greedy);
+
+    size = 0;
+    start = archive.start;
+    for (i = 0; i <= points->len; i++)
+    {
+        gsize end = i == points->len ? archive.end :
+            g_array_index (points, gsize, i);
+        GstGzArchiveStore block = { 0 };
+
+        gst_gz_archive_optimal (&archive, start, end, chunk->iterations,
+                &block);
+        size += gst_gz_archive_block_size_auto (&block, 0, block.len);
+        gst_gz_archive_store_append (&store, &block, 0, block.len);
+        gst_gz_archive_store_clear (&block);
+        if (i < points->len)
+            g_array_index (points, gsize, i) = store.len;
+        start = end;
+    }
+
+    /* The optimal parse can split better */
+    if (points->len > 1)
+    {
+        points2 = gst_gz_archive_split (&store);
+        if (gst_gz_archive_split_size (&store, points2) < size)
+        {
+            g_array_free (points, TRUE);
+            points = points2;
+        }
+        else
+            g_array_free (points2, TRUE);
+    }
+
+    for (i = 0; i <= points->len; i++)
+    {
+        gsize from = i == 0 ? 0 : g_array_index (points, gsize, i - 1);
+        gsize to = i == points->len ? store.len :
+            g_array_index (points, gsize, i);
+
+        gst_gz_archive_write_block (&archive, &writer,
+                chunk->final && i == points->len, &store, from, to);
+    }
+    g_array_free (points, TRUE);
+    gst_gz_archive_store_clear (&store);
+
+done:
+    /* An empty stored block ends on a byte boundary */
+    if (!chunk->final && writer.n_bits)
+    {
+        gst_gz_archive_put_bits (&writer, 0, 3);
+        gst_gz_archive_align (&writer);
+        gst_gz_archive_put_bits (&writer, 0, 16);
+        gst_gz_archive_put_bits (&writer, 0xffff, 16);
+    }
+    gst_gz_archive_align (&writer);
+
+    chunk->output = g_byte_array_sized_new (writer.len);
+    g_byte_array_append (chunk->output, writer.data, writer.len);
+    g_free (writer.data);
+    g_free (archive.costs);
+    g_free (archive.lengths);
+    g_free (archive.path);
+    g_free (archive.same);
+    g_free (archive.first);
+    g_free (archive.pairs);
+}
+
+    void
+gst_gz_archive_chunk_clear (GstGzArchiveChunk * chunk)
+{
+    if (chunk->output)
+        g_byte_array_free (chunk->output, TRUE);
+    chunk->output = NULL;
+}
@@ -0,0 +1,80 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __GST_GZ_ARCHIVE_H__
+#define __GST_GZ_ARCHIVE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Deflate encoder of the archive mode of gzenc, in the way of zopfli. The
+ * matches of every position are searched once, then the input is split into
+ * blocks and each block is parsed with the matches that are the cheapest
+ * with a model of its Huffman codes, the model being refined over several
+ * iterations. It is much slower than zlib and the output is standard
+ * deflate data, smaller than with level 9. */
+typedef struct
+{
+    /* Input, the window bytes before data can be referenced by the matches
+     * (at most 32 KiB of them are used) */
+    const guint8 *data;
+    gsize size;
+    gsize window;
+
+    /* Parsing iterations per block */
+    guint iterations;
+    /* The last block is marked final. Otherwise the output is completed to
+     * a byte boundary with an empty stored block when needed, so that the
+     * output of the next chunk can follow it. */
+    gboolean final;
+
+    /* Deflate blocks */
+    GByteArray *output;
+} GstGzArchiveChunk;
+
+void gst_gz_archive_deflate (GstGzArchiveChunk * chunk);
+void gst_gz_archive_chunk_clear (GstGzArchiveChunk * chunk);
+
+G_END_DECLS
+#endif /* __GST_GZ_ARCHIVE_H__ */
@@ -45,7 +45,12 @@
 #include "config.h"
 #endif
 #include "gstgzdec.h"
+#include "gstgzpool.h"
+#include "gstgzmeta.h"
+#include "gstgzspec.h"
+#include "gstgzprobes.h"
 
+#include <gst/base/gstadapter.h>
 #include <gst/base/gsttypefindhelper.h>
 #include <zlib.h>
 #include <string.h>
@@ -53,276 +58,2679 @@
 GST_DEBUG_CATEGORY_STATIC (gzdec_debug);
 #define GST_CAT_DEFAULT gzdec_debug
 
+/* Any input is accepted in auto-passthrough mode, see
+ * gst_gzdec_get_sink_caps() */
 static GstStaticPadTemplate sink_template = 
 GST_STATIC_PAD_TEMPLATE ("sink", GST_PAD_SINK, GST_PAD_ALWAYS, 
-        GST_STATIC_CAPS ("application/x-gzip"));
+        GST_STATIC_CAPS_ANY);
+static GstStaticCaps gzip_caps = GST_STATIC_CAPS ("application/x-gzip");
 static GstStaticPadTemplate src_template = 
 GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS, 
         GST_STATIC_CAPS_ANY);
 
-#define DEFAULT_FIRST_BUFFER_SIZE 1024
-#define DEFAULT_BUFFER_SIZE 1024
+#define DEFAULT_FIRST_BUFFER_SIZE 1024
+#define DEFAULT_BUFFER_SIZE 1024
+#define DEFAULT_WHOLE_FILE_MAX_SIZE 0
+#define DEFAULT_WORKER_POOL FALSE
+#define DEFAULT_AUTO_PASSTHROUGH FALSE
+#define DEFAULT_MAX_RATIO 0
+#define DEFAULT_MAX_OUTPUT_BYTES 0
+#define DEFAULT_MAX_OUTPUT_RATE 0
+#define DEFAULT_PARALLEL_CHUNK_SIZE 0
+#define DEFAULT_FORMAT GST_GZDEC_FORMAT_AUTO
+#define DEFAULT_OUTPUT_QUEUE_BUFFERS 0
+#define DEFAULT_OUTPUT_QUEUE_BYTES 0
+#define DEFAULT_VERIFY GST_GZDEC_VERIFY_FULL
+#define DEFAULT_MIN_INPUT_SIZE 0
+#define DEFAULT_MAX_INPUT_LATENCY (20 * GST_MSECOND)
+
+/* Buffers queued on the worker pool before the chain function blocks */
+#define MAX_POOL_JOBS 4
+
+/* Output buffers queued by the worker pool jobs when output-queue-buffers
+ * is not set */
+#define POOL_OUTPUT_BUFFERS 16
+
+/* Speculative decoding of a chunk stops after this many times the chunk
+ * size of output, the rest is left to the sequential decoder */
+#define MAX_SPEC_EXPANSION 16
+
+/* Largest expansion deflate can achieve, used to sanity check ISIZE */
+#define MAX_DEFLATE_RATIO 1032
+
+/* ISIZE comes from the input, the output buffer it sizes starts with at
+ * most this many times the input and grows as the data is inflated */
+#define SIZE_HINT_EXPANSION 8
+
+/* Output is held back until typefinding succeeds, at most this many bytes */
+#define MAX_TYPEFIND_SIZE (16 * 1024)
+
+/* Stored blocks are pushed without copy, this needs inflatePrime() to drop
+ * the bits held by inflate and inflateSetDictionary() to amend the window of
+ * a raw inflate at any time */
+#if ZLIB_VERNUM >= 0x1290
+#define HAVE_ZERO_COPY_STORED 1
+#endif
+
+/* gzdec parses the gzip/zlib wrapper itself and inflates the deflate data
+ * with a raw inflate stopping at every block boundary, so that stored blocks
+ * can be found and passed through. The check value is computed by gzdec. */
+typedef enum
+{
+    GZDEC_STATE_HEADER,
+    GZDEC_STATE_DEFLATE,
+    GZDEC_STATE_STORED,
+    GZDEC_STATE_TRAILER,
+    GZDEC_STATE_DONE
+} GstGzdecState;
+
+/* Raw deflate data has no header to detect it, it has to be told by the
+ * format property or by the format field of the sink caps */
+typedef enum
+{
+    GST_GZDEC_FORMAT_AUTO,
+    GST_GZDEC_FORMAT_GZIP,
+    GST_GZDEC_FORMAT_ZLIB,
+    GST_GZDEC_FORMAT_DEFLATE
+} GstGzdecFormat;
+
+/* How the check value of gzip and zlib members is verified. Deferred
+ * checks are computed on the worker pool while the next data is inflated,
+ * a mismatch is reported there once the member is complete. */
+typedef enum
+{
+    GST_GZDEC_VERIFY_FULL,
+    GST_GZDEC_VERIFY_DEFERRED,
+    GST_GZDEC_VERIFY_NONE
+} GstGzdecVerify;
+
+#define GST_TYPE_GZDEC_FORMAT (gst_gzdec_format_get_type ())
+
+    static GType
+gst_gzdec_format_get_type (void)
+{
+    static GType gzdec_format_type = 0;
+
+    if (!gzdec_format_type)
+    {
+        static GEnumValue format_types[] = {
+            { GST_GZDEC_FORMAT_AUTO, "gzip or zlib, detected from the header "
+                "(raw deflate if the sink caps say so)", "auto"},
+            { GST_GZDEC_FORMAT_GZIP, "RFC 1952 (gzip compressed format)",
+                "gzip"},
+            { GST_GZDEC_FORMAT_ZLIB, "RFC 1950 (zlib compressed format)",
+                "zlib"},
+            { GST_GZDEC_FORMAT_DEFLATE, "RFC 1951 (raw deflate data)",
+                "deflate"},
+            { 0, NULL, NULL },
+        };
+
+        gzdec_format_type =
+            g_enum_register_static ("GstGzdecFormat", format_types);
+    }
+    return gzdec_format_type;
+}
+
+#define GST_TYPE_GZDEC_VERIFY (gst_gzdec_verify_get_type ())
+
+    static GType
+gst_gzdec_verify_get_type (void)
+{
+    static GType gzdec_verify_type = 0;
+
+    if (!gzdec_verify_type)
+    {
+        static GEnumValue verify_types[] = {
+            { GST_GZDEC_VERIFY_FULL, "Check while decoding", "full"},
+            { GST_GZDEC_VERIFY_DEFERRED, "Check on the worker pool, errors "
+                "are reported after the member end", "deferred"},
+            { GST_GZDEC_VERIFY_NONE, "No check, for trusted input", "none"},
+            { 0, NULL, NULL },
+        };
+
+        gzdec_verify_type =
+            g_enum_register_static ("GstGzdecVerify", verify_types);
+    }
+    return gzdec_verify_type;
+}
+
+enum
+{
+    PROP_0,
+    PROP_FIRST_BUFFER_SIZE,
+    PROP_BUFFER_SIZE,
+    PROP_WHOLE_FILE_MAX_SIZE,
+    PROP_WORKER_POOL,
+    PROP_AUTO_PASSTHROUGH,
+    PROP_MAX_RATIO,
+    PROP_MAX_OUTPUT_BYTES,
+    PROP_MAX_OUTPUT_RATE,
+    PROP_PARALLEL_CHUNK_SIZE,
+    PROP_FORMAT,
+    PROP_OUTPUT_QUEUE_BUFFERS,
+    PROP_OUTPUT_QUEUE_BYTES,
+    PROP_VERIFY,
+    PROP_MIN_INPUT_SIZE,
+    PROP_MAX_INPUT_LATENCY
+};
+
+struct _GstGzdec
+{
+    GstElement parent;
+
+    GstPad *sink;
+    GstPad *src;
+
+    /* Properties */
+    guint first_buffer_size;
+    guint buffer_size;
+    guint whole_file_max_size;
+    gboolean worker_pool;
+    gboolean auto_passthrough;
+    guint max_ratio;
+    guint64 max_output_bytes;
+    guint64 max_output_rate;
+    guint parallel_chunk_size;
+    GstGzdecFormat format;
+    guint output_queue_buffers;
+    guint64 output_queue_bytes;
+    GstGzdecVerify verify;
+    guint min_input_size;
+    guint64 max_input_latency;
+
+    gboolean ready;
+    z_stream stream;
+    guint64 offset;
+
+    GstGzdecState state;
+    gboolean zlib_wrap;
+    /* The current stream is raw deflate data, without header nor check */
+    gboolean raw;
+    /* Header or trailer split over several input buffers */
+    GByteArray *wrap;
+    /* Members decoded so far */
+    guint members;
+    /* Check value and size of the output of the current member */
+    guint32 check;
+    guint64 member_size;
+    /* verify in use for the current member */
+    GstGzdecVerify member_verify;
+    /* Deferred checks: the last output buffer is held back while its check
+     * value is computed on the worker pool, then added to verify_check */
+    GstGzPoolClient *verify_client;
+    gpointer verify_held;
+    GMutex verify_lock;
+    GCond verify_cond;
+    guint32 verify_check;
+    guint64 verify_size;
+    /* inflate stopped at a block boundary with boundary_bits bits of the
+     * next block header read from last_byte */
+    gboolean at_boundary;
+    guint boundary_bits;
+    guint8 last_byte;
+    /* inflate stopped on a full output buffer */
+    gboolean more_output;
+    /* Stored block being passed through */
+    guint stored_left;
+    gboolean stored_last;
+    /* The input is not compressed and is pushed unchanged */
+    gboolean passthrough;
+
+    /* Compressed bytes received, for max-ratio */
+    guint64 input_bytes;
+    /* max-output-rate: output pushed since rate_start */
+    gint64 rate_start;
+    guint64 rate_bytes;
+    GMutex throttle_lock;
+    GCond throttle_cond;
+    gboolean throttle_flushing;
+
+    /* Caps received on the sink pad */
+    GstCaps *sink_caps;
+    /* Source caps are known, either from the sink caps or by typefinding */
+    gboolean have_caps;
+    /* Decompressed data waiting for the typefinding to complete */
+    GstBuffer *pending;
+    /* Segment held back until the caps are set */
+    GstEvent *segment;
+#if GST_CHECK_VERSION(1,0,0)
+    /* Allocator proposed by downstream for the output buffers, protected
+     * by the object lock as the output thread sets it */
+    GstAllocator *allocator;
+    GstAllocationParams params;
+#endif
+
+    /* Size of the input in pull mode */
+    guint64 input_size;
+    /* Uncompressed size read from the gzip trailer, 0 if unknown */
+    guint64 isize;
+    /* Input read so far by the parallel pull mode loop */
+    guint64 pull_offset;
+    /* One pool client per chunk decoded in parallel */
+    GstGzPoolClient **spec_clients;
+    guint n_spec_clients;
+
+    GstGzPoolClient *pool_client;
+
+    /* Small input buffers accumulated up to min-input-size, only used with
+     * the sink pad stream lock held */
+    GstAdapter *input;
+    /* Monotonic time the oldest accumulated byte was received, 0 when
+     * nothing is held. Written with input_lock held too, for the thread
+     * flushing the input after max-input-latency. */
+    gint64 input_start;
+    GThread *input_thread;
+    GMutex input_lock;
+    GCond input_cond;
+    gboolean input_thread_stop;
+    /* Flow return of an input flushed by an event, returned by the next
+     * chain */
+    GstFlowReturn input_flow;
+
+    /* Output thread: the src pad task pushes the buffers and serialized
+     * events queued by the streaming thread (output-queue-buffers) */
+    gboolean output_thread;
+    /* worker-pool when the src pad was activated: the pool jobs only queue
+     * their output, the output thread pushes it */
+    gboolean use_pool;
+    /* Buffers queued before the decompressing side waits */
+    guint output_max_buffers;
+    GQueue output_queue;
+    guint output_queued_buffers;
+    guint64 output_queued_bytes;
+    GMutex output_lock;
+    GCond output_cond;
+    gboolean output_flushing;
+    /* Last flow return of a push by the output thread */
+    GstFlowReturn output_flow;
+};
+
+struct _GstGzdecClass
+{
+    GstElementClass parent_class;
+};
+
+#if GST_CHECK_VERSION(1,0,0)
+#define gst_gzdec_parent_class parent_class
+G_DEFINE_TYPE (GstGzdec, gst_gzdec, GST_TYPE_ELEMENT);
+#else
+GST_BOILERPLATE (GstGzdec, gst_gzdec, GstElement, GST_TYPE_ELEMENT);
+#endif
+
+    static void
+gst_gzdec_decompress_end (GstGzdec * dec)
+{
+    g_return_if_fail (GST_IS_GZDEC (dec));
+
+    if (dec->ready)
+    {
+        GST_DEBUG_OBJECT (dec, "Finalize gzdec decompressing feature");
+        (void)inflateEnd(&dec->stream);
+        memset (&dec->stream, 0, sizeof (dec->stream));
+        dec->ready = FALSE;
+    }
+}
+
+    static void
+gst_gzdec_decompress_init (GstGzdec * dec)
+{
+    GST_DEBUG_OBJECT (dec, "Initialize gzdec decompressing feature");
+    g_return_if_fail (GST_IS_GZDEC (dec));
+    GST_GZ_PROBE_REINIT (dec);
+    gst_gzdec_decompress_end (dec);
+
+    /* Initialise zlib default values for inflateInit() */
+    dec->stream.zalloc = Z_NULL;
+    dec->stream.zfree = Z_NULL;
+    dec->stream.opaque = Z_NULL;
+    dec->stream.avail_in = 0;
+    dec->stream.next_in = Z_NULL;
+
+    dec->offset = 0;
+
+    dec->state = GZDEC_STATE_HEADER;
+    dec->members = 0;
+    dec->passthrough = FALSE;
+    dec->input_bytes = 0;
+    dec->rate_start = 0;
+    g_byte_array_set_size (dec->wrap, 0);
+
+    switch (inflateInit2 (&dec->stream, -MAX_WBITS))
+    {
+        case Z_OK:
+            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_OK");
+            dec->ready = TRUE;
+            return;
+            /* Handle initialisation errors */
+        case Z_MEM_ERROR:
+            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_MEM_ERROR");
+            break;
+        case Z_VERSION_ERROR:
+            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_VERSION_ERROR");
+            break;
+        case Z_STREAM_ERROR:
+            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_STREAM_ERROR");
+            break;
+        default:
+            GST_DEBUG_OBJECT (dec, "inflateInit2() return unknown error");
+            break;
+    }
+    dec->ready = FALSE;
+    GST_ELEMENT_ERROR (dec, CORE, FAILED, (NULL), 
+            ("Failed to start decompression."));
+    return;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Use the allocator downstream proposes for the output buffers. With an
+ * fd-backed one (memfd, shared memory) the data is inflated straight into
+ * memory that can be passed to another process. Called by the thread that
+ * pushes on the src pad, after the caps. */
+    static void
+gst_gzdec_decide_allocation (GstGzdec * dec, GstCaps * caps)
+{
+    GstAllocator *allocator = NULL;
+    GstAllocationParams params;
+    GstQuery *query;
+
+    gst_allocation_params_init (&params);
+    query = gst_query_new_allocation (caps, FALSE);
+    if (gst_pad_peer_query (dec->src, query)
+            && gst_query_get_n_allocation_params (query) > 0)
+        gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+    gst_query_unref (query);
+    GST_DEBUG_OBJECT (dec, "Using allocator %s",
+            allocator ? GST_OBJECT_NAME (allocator) : "default");
+
+    GST_OBJECT_LOCK (dec);
+    if (dec->allocator)
+        gst_object_unref (dec->allocator);
+    dec->allocator = allocator;
+    dec->params = params;
+    GST_OBJECT_UNLOCK (dec);
+}
+
+    static GstBuffer *
+gst_gzdec_alloc_buffer (GstGzdec * dec, gsize size)
+{
+    GstAllocator *allocator;
+    GstAllocationParams params;
+    GstBuffer *out;
+
+    GST_OBJECT_LOCK (dec);
+    allocator = dec->allocator ? gst_object_ref (dec->allocator) : NULL;
+    params = dec->params;
+    GST_OBJECT_UNLOCK (dec);
+    out = gst_buffer_new_allocate (allocator, size, &params);
+    if (allocator)
+        gst_object_unref (allocator);
+    if (!out)
+    {
+        GST_WARNING_OBJECT (dec, "Allocation failed, using the default allocator");
+        out = gst_buffer_new_and_alloc (size);
+    }
+    return out;
+}
+#endif
+
+/* Hold the output back so that no more than max-output-rate bytes per
+ * second are pushed. Bursts are limited to one second worth of data. */
+    static GstFlowReturn
+gst_gzdec_throttle (GstGzdec * dec, gsize size)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    gint64 now, deadline;
+
+    if (!dec->max_output_rate)
+        return GST_FLOW_OK;
+
+    now = g_get_monotonic_time ();
+    if (!dec->rate_start)
+    {
+        dec->rate_start = now;
+        dec->rate_bytes = 0;
+    }
+    deadline = dec->rate_start + gst_util_uint64_scale (dec->rate_bytes,
+            G_USEC_PER_SEC, dec->max_output_rate);
+    if (deadline < now - G_USEC_PER_SEC)
+    {
+        dec->rate_start = now;
+        dec->rate_bytes = 0;
+        deadline = now;
+    }
+    dec->rate_bytes += size;
+
+    g_mutex_lock (&dec->throttle_lock);
+    while (!dec->throttle_flushing && now < deadline)
+    {
+        g_cond_wait_until (&dec->throttle_cond, &dec->throttle_lock, deadline);
+        now = g_get_monotonic_time ();
+    }
+    if (dec->throttle_flushing)
+#if GST_CHECK_VERSION(1,0,0)
+        flow = GST_FLOW_FLUSHING;
+#else
+        flow = GST_FLOW_WRONG_STATE;
+#endif
+    g_mutex_unlock (&dec->throttle_lock);
+    return flow;
+}
+
+    static GstFlowReturn
+gst_gzdec_pad_push (GstGzdec * dec, GstBuffer * out)
+{
+    GstFlowReturn flow;
+    gsize size;
+
+    GST_GZ_HOT_LOG (dec, "Push data on src pad");
+#if GST_CHECK_VERSION(1,0,0)
+    /* Downstream was relinked or asks for a new allocator */
+    if (gst_pad_check_reconfigure (dec->src))
+    {
+        GstCaps *caps = gst_pad_get_current_caps (dec->src);
+
+        if (caps)
+        {
+            gst_gzdec_decide_allocation (dec, caps);
+            gst_caps_unref (caps);
+        }
+    }
+    size = gst_buffer_get_size (out);
+#else
+    size = GST_BUFFER_SIZE (out);
+#endif
+    GST_GZ_PROBE_PUSH_START (dec, size);
+    flow = gst_pad_push (dec->src, out);
+    GST_GZ_PROBE_PUSH_DONE (dec, size, flow);
+    return flow;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Drop what is queued for the output thread when flushing. The task pauses
+ * itself when it sees the flag and is started again when it's cleared. */
+    static void
+gst_gzdec_set_output_flushing (GstGzdec * dec, gboolean flushing)
+{
+    GstMiniObject *obj;
+
+    g_mutex_lock (&dec->output_lock);
+    dec->output_flushing = flushing;
+    while ((obj = g_queue_pop_head (&dec->output_queue)))
+        gst_mini_object_unref (obj);
+    dec->output_queued_buffers = 0;
+    dec->output_queued_bytes = 0;
+    dec->output_flow = GST_FLOW_OK;
+    g_cond_broadcast (&dec->output_cond);
+    g_mutex_unlock (&dec->output_lock);
+}
+
+/* Src pad task: push the queued buffers and events. After a push failed
+ * the buffers are dropped, the streaming thread returns the flow upstream. */
+    static void
+gst_gzdec_output_loop (GstPad * pad)
+{
+    GstGzdec *dec = GST_GZDEC (GST_PAD_PARENT (pad));
+    GstMiniObject *obj;
+    GstFlowReturn flow;
+
+    g_mutex_lock (&dec->output_lock);
+    while (g_queue_is_empty (&dec->output_queue) && !dec->output_flushing)
+        g_cond_wait (&dec->output_cond, &dec->output_lock);
+    if (dec->output_flushing)
+    {
+        g_mutex_unlock (&dec->output_lock);
+        gst_pad_pause_task (pad);
+        return;
+    }
+    obj = g_queue_pop_head (&dec->output_queue);
+    if (GST_IS_BUFFER (obj))
+    {
+        dec->output_queued_buffers--;
+        dec->output_queued_bytes -= gst_buffer_get_size (GST_BUFFER_CAST (obj));
+    }
+    flow = dec->output_flow;
+    g_cond_broadcast (&dec->output_cond);
+    g_mutex_unlock (&dec->output_lock);
+
+    if (GST_IS_EVENT (obj))
+    {
+        GstEvent *event = GST_EVENT_CAST (obj);
+        GstCaps *caps = NULL;
+
+        if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS)
+        {
+            gst_event_parse_caps (event, &caps);
+            gst_caps_ref (caps);
+        }
+        if (gst_pad_push_event (pad, event) && caps)
+            gst_gzdec_decide_allocation (dec, caps);
+        if (caps)
+            gst_caps_unref (caps);
+        return;
+    }
+    if (flow == GST_FLOW_OK)
+        flow = gst_gzdec_throttle (dec,
+                gst_buffer_get_size (GST_BUFFER_CAST (obj)));
+    if (flow != GST_FLOW_OK)
+    {
+        gst_mini_object_unref (obj);
+        return;
+    }
+    flow = gst_gzdec_pad_push (dec, GST_BUFFER_CAST (obj));
+    if (flow != GST_FLOW_OK)
+    {
+        g_mutex_lock (&dec->output_lock);
+        if (!dec->output_flushing)
+            dec->output_flow = flow;
+        g_cond_broadcast (&dec->output_cond);
+        g_mutex_unlock (&dec->output_lock);
+    }
+}
+
+/* Whether size more bytes have to wait for room in the output queue, a
+ * single buffer is always accepted. Called with the output lock held. */
+    static gboolean
+gst_gzdec_output_full (GstGzdec * dec, gsize size)
+{
+    return !dec->output_flushing && dec->output_flow == GST_FLOW_OK
+        && dec->output_queued_buffers
+        && (dec->output_queued_buffers >= dec->output_max_buffers
+                || (dec->output_queue_bytes && dec->output_queued_bytes
+                    + size > dec->output_queue_bytes));
+}
+
+/* Wait for room in the output queue before giving an input buffer to the
+ * worker pool, the jobs never wait for the output thread. The flow of the
+ * last push is returned. */
+    static GstFlowReturn
+gst_gzdec_output_wait (GstGzdec * dec)
+{
+    GstFlowReturn flow;
+
+    g_mutex_lock (&dec->output_lock);
+    while (gst_gzdec_output_full (dec, 0))
+        g_cond_wait (&dec->output_cond, &dec->output_lock);
+    flow = dec->output_flushing ? GST_FLOW_FLUSHING : dec->output_flow;
+    g_mutex_unlock (&dec->output_lock);
+    return flow;
+}
+
+/* Queue a buffer or a serialized event for the output thread. Buffers wait
+ * until the queue is below both limits, except on the worker pool (see
+ * gst_gzdec_output_wait()). The flow of the last push is returned. */
+    static GstFlowReturn
+gst_gzdec_output_enqueue (GstGzdec * dec, GstMiniObject * obj)
+{
+    gboolean is_buffer = GST_IS_BUFFER (obj);
+    gsize size = is_buffer ? gst_buffer_get_size (GST_BUFFER_CAST (obj)) : 0;
+    GstFlowReturn flow;
+
+    g_mutex_lock (&dec->output_lock);
+    while (is_buffer && !dec->use_pool && gst_gzdec_output_full (dec, size))
+        g_cond_wait (&dec->output_cond, &dec->output_lock);
+    flow = dec->output_flushing ? GST_FLOW_FLUSHING : dec->output_flow;
+    /* Events still go through after an error, EOS in particular */
+    if (!dec->output_flushing && (flow == GST_FLOW_OK || !is_buffer))
+    {
+        g_queue_push_tail (&dec->output_queue, obj);
+        if (is_buffer)
+        {
+            dec->output_queued_buffers++;
+            dec->output_queued_bytes += size;
+        }
+        g_cond_broadcast (&dec->output_cond);
+        obj = NULL;
+    }
+    g_mutex_unlock (&dec->output_lock);
+    if (obj)
+        gst_mini_object_unref (obj);
+    return flow;
+}
+
+/* Push a serialized event on the src pad, after the queued output */
+    static gboolean
+gst_gzdec_push_event (GstGzdec * dec, GstEvent * event)
+{
+    if (!dec->output_thread)
+        return gst_pad_push_event (dec->src, event);
+    gst_gzdec_output_enqueue (dec, GST_MINI_OBJECT_CAST (event));
+    return TRUE;
+}
+#endif
+
+    static void
+gst_gzdec_set_src_caps (GstGzdec * dec, GstCaps * caps)
+{
+    GST_DEBUG_OBJECT (dec, "Setting src caps to %" GST_PTR_FORMAT, caps);
+#if GST_CHECK_VERSION(1,0,0)
+    /* The output thread asks for the allocator once it pushed the caps */
+    if (dec->output_thread)
+        gst_gzdec_push_event (dec, gst_event_new_caps (caps));
+    else if (gst_pad_set_caps (dec->src, caps))
+        gst_gzdec_decide_allocation (dec, caps);
+#else
+    gst_pad_set_caps (dec->src, caps);
+#endif
+    gst_pad_use_fixed_caps (dec->src);
+    dec->have_caps = TRUE;
+}
+
+/* gzenc with allow-bypass flags its caps with compressed. Uncompressed
+ * input is passed through with its caps, compressed input starts a new
+ * stream. */
+    static gboolean
+gst_gzdec_follow_bypass (GstGzdec * dec, GstStructure * s)
+{
+    gboolean compressed;
+    GstCaps *srccaps;
+
+    if (!gst_structure_get_boolean (s, "compressed", &compressed))
+        return FALSE;
+    if (compressed)
+    {
+        if (dec->passthrough)
+        {
+            GST_DEBUG_OBJECT (dec, "Compressed input again");
+            gst_gzdec_decompress_init (dec);
+        }
+        return FALSE;
+    }
+
+    GST_DEBUG_OBJECT (dec, "Uncompressed input, passing it through");
+    dec->passthrough = TRUE;
+    dec->state = GZDEC_STATE_DONE;
+    srccaps = gst_caps_new_full (gst_structure_copy (s), NULL);
+    gst_structure_remove_field (gst_caps_get_structure (srccaps, 0),
+            "compressed");
+    gst_gzdec_set_src_caps (dec, srccaps);
+    gst_caps_unref (srccaps);
+    return TRUE;
+}
+
+/* Use the caps of the uncompressed data when gzenc advertised them in the
+ * original-caps field, no typefinding is needed then. */
+    static void
+gst_gzdec_handle_sink_caps (GstGzdec * dec, GstCaps * caps)
+{
+    GstStructure *s;
+    const gchar *str;
+    GstCaps *srccaps;
+
+    GST_DEBUG_OBJECT (dec, "Received sink caps %" GST_PTR_FORMAT, caps);
+    if (dec->sink_caps)
+        gst_caps_unref (dec->sink_caps);
+    dec->sink_caps = gst_caps_ref (caps);
+    if (gst_caps_is_any (caps) || gst_caps_is_empty (caps))
+        return;
+
+    s = gst_caps_get_structure (caps, 0);
+    if (gst_gzdec_follow_bypass (dec, s))
+        return;
+    str = gst_structure_get_string (s, "original-caps");
+    if (!str)
+        return;
+
+    srccaps = gst_caps_from_string (str);
+    if (!srccaps)
+    {
+        GST_WARNING_OBJECT (dec, "Invalid original caps \"%s\"", str);
+        return;
+    }
+    if (gst_caps_is_fixed (srccaps))
+        gst_gzdec_set_src_caps (dec, srccaps);
+    gst_caps_unref (srccaps);
+}
+
+    static GstCaps *
+gst_gzdec_get_sink_caps (GstGzdec * dec)
+{
+    if (dec->auto_passthrough)
+        return gst_caps_new_any ();
+    return gst_static_caps_get (&gzip_caps);
+}
+
+/* Wake up a throttled streaming thread when flushing */
+    static void
+gst_gzdec_set_throttle_flushing (GstGzdec * dec, gboolean flushing)
+{
+    g_mutex_lock (&dec->throttle_lock);
+    dec->throttle_flushing = flushing;
+    dec->rate_start = 0;
+    g_cond_broadcast (&dec->throttle_cond);
+    g_mutex_unlock (&dec->throttle_lock);
+}
+
+/* Largest output allowed by max-ratio and max-output-bytes so far */
+    static guint64
+gst_gzdec_output_limit (GstGzdec * dec)
+{
+    guint64 limit = G_MAXUINT64;
+
+    if (dec->max_ratio)
+        limit = dec->input_bytes * dec->max_ratio;
+    if (dec->max_output_bytes)
+        limit = MIN (limit, dec->max_output_bytes);
+    return limit;
+}
+
+    static GstFlowReturn
+gst_gzdec_limit_exceeded (GstGzdec * dec)
+{
+    GST_ELEMENT_ERROR (dec, STREAM, DECODE, (NULL),
+            ("Output limit exceeded after %" G_GUINT64_FORMAT " bytes (%"
+             G_GUINT64_FORMAT " bytes of input).", dec->offset,
+             dec->input_bytes));
+    dec->state = GZDEC_STATE_DONE;
+    return GST_FLOW_ERROR;
+}
+
+    static GstFlowReturn
+gst_gzdec_push_downstream (GstGzdec * dec, GstBuffer * out)
+{
+    GstFlowReturn flow;
+
+#if GST_CHECK_VERSION(1,0,0)
+    /* Sticky events have to stay ordered, the segment goes after the caps */
+    if (dec->segment)
+    {
+        gst_gzdec_push_event (dec, dec->segment);
+        dec->segment = NULL;
+    }
+    /* The output thread throttles the pushes itself */
+    if (dec->output_thread)
+        return gst_gzdec_output_enqueue (dec, GST_MINI_OBJECT_CAST (out));
+    flow = gst_gzdec_throttle (dec, gst_buffer_get_size (out));
+#else
+    flow = gst_gzdec_throttle (dec, GST_BUFFER_SIZE (out));
+#endif
+    if (flow != GST_FLOW_OK)
+    {
+        gst_buffer_unref (out);
+        return flow;
+    }
+    return gst_gzdec_pad_push (dec, out);
+}
+
+/* Push the decompressed data kept back for typefinding. Without a type at
+ * this point the data is pushed without caps. */
+    static GstFlowReturn
+gst_gzdec_flush_pending (GstGzdec * dec)
+{
+    GstBuffer *out = dec->pending;
+
+    if (!out)
+        return GST_FLOW_OK;
+    dec->pending = NULL;
+
+    if (!dec->have_caps)
+    {
+        GstCaps *caps;
+
+        caps = gst_type_find_helper_for_buffer (GST_OBJECT (dec), out, NULL);
+        if (caps)
+        {
+#if !GST_CHECK_VERSION(1,0,0)
+            gst_buffer_set_caps (out, caps);
+#endif
+            gst_gzdec_set_src_caps (dec, caps);
+            gst_caps_unref (caps);
+        }
+        else
+        {
+            GST_WARNING_OBJECT (dec, "Could not determine the type of the "
+                    "decompressed data");
+            /* Do not try again for the rest of the stream */
+            dec->have_caps = TRUE;
+        }
+    }
+    return gst_gzdec_push_downstream (dec, out);
+}
+
+/* Push a decompressed buffer. Until the source caps are known the output is
+ * queued and typefinding is retried on the whole queued data. */
+    static GstFlowReturn
+gst_gzdec_push (GstGzdec * dec, GstBuffer * out)
+{
+    GstTypeFindProbability prob = GST_TYPE_FIND_NONE;
+    GstCaps *caps;
+    gsize size;
+
+    if (dec->have_caps && !dec->pending)
+        return gst_gzdec_push_downstream (dec, out);
+
+#if GST_CHECK_VERSION(1,0,0)
+    dec->pending = dec->pending ? gst_buffer_append (dec->pending, out) : out;
+    size = gst_buffer_get_size (dec->pending);
+#else
+    dec->pending = dec->pending ? gst_buffer_join (dec->pending, out) : out;
+    size = GST_BUFFER_SIZE (dec->pending);
+#endif
+    if (dec->have_caps)
+        return gst_gzdec_flush_pending (dec);
+
+    caps = gst_type_find_helper_for_buffer (GST_OBJECT (dec), dec->pending, &prob);
+    if (caps && (prob >= GST_TYPE_FIND_LIKELY || size >= MAX_TYPEFIND_SIZE))
+    {
+#if !GST_CHECK_VERSION(1,0,0)
+        gst_buffer_set_caps (dec->pending, caps);
+#endif
+        gst_gzdec_set_src_caps (dec, caps);
+    }
+    if (caps)
+        gst_caps_unref (caps);
+
+    if (!dec->have_caps && size < MAX_TYPEFIND_SIZE)
+    {
+        GST_DEBUG_OBJECT (dec, "No type found yet, queuing %" G_GSIZE_FORMAT
+                " bytes", size);
+        return GST_FLOW_OK;
+    }
+    return gst_gzdec_flush_pending (dec);
+}
+
+/* Output buffer held back while its check value is computed on the worker
+ * pool. The job doesn't keep a reference, the buffer is pushed writable. */
+typedef struct
+{
+    GstGzdec *dec;
+    GstBuffer *buffer;
+    gsize size;
+    gboolean adler;
+    guint32 check;
+    /* The job ran, done is also set when it was dropped by a flush */
+    gboolean checked;
+    gboolean done;
+} GstGzdecVerifyChunk;
+
+    static GstFlowReturn
+gst_gzdec_verify_data_job (gpointer user_data, gpointer data)
+{
+    GstGzdecVerifyChunk *chunk = data;
+    const guint8 *bytes;
+#if GST_CHECK_VERSION(1,0,0)
+    GstMapInfo map;
+
+    gst_buffer_map (chunk->buffer, &map, GST_MAP_READ);
+    bytes = map.data;
+#else
+    bytes = GST_BUFFER_DATA (chunk->buffer);
+#endif
+    if (chunk->adler)
+        chunk->check = adler32 (adler32 (0L, Z_NULL, 0), bytes, chunk->size);
+    else
+        chunk->check = crc32 (crc32 (0L, Z_NULL, 0), bytes, chunk->size);
+#if GST_CHECK_VERSION(1,0,0)
+    gst_buffer_unmap (chunk->buffer, &map);
+#endif
+    chunk->checked = TRUE;
+    return GST_FLOW_OK;
+}
+
+    static void
+gst_gzdec_verify_data_done (gpointer data)
+{
+    GstGzdecVerifyChunk *chunk = data;
+    GstGzdec *dec = chunk->dec;
+
+    g_mutex_lock (&dec->verify_lock);
+    chunk->done = TRUE;
+    g_cond_broadcast (&dec->verify_cond);
+    g_mutex_unlock (&dec->verify_lock);
+}
+
+/* Wait for the check of the buffer held back, add it to the member check
+ * value and push the buffer */
+    static GstFlowReturn
+gst_gzdec_verify_release (GstGzdec * dec)
+{
+    GstGzdecVerifyChunk *chunk = dec->verify_held;
+    GstFlowReturn flow;
+
+    if (!chunk)
+        return GST_FLOW_OK;
+    dec->verify_held = NULL;
+
+    g_mutex_lock (&dec->verify_lock);
+    while (!chunk->done)
+        g_cond_wait (&dec->verify_cond, &dec->verify_lock);
+    g_mutex_unlock (&dec->verify_lock);
+
+    if (chunk->checked)
+    {
+        if (chunk->adler)
+            dec->verify_check = adler32_combine (dec->verify_check,
+                    chunk->check, chunk->size);
+        else
+            dec->verify_check = crc32_combine (dec->verify_check,
+                    chunk->check, chunk->size);
+        dec->verify_size += chunk->size;
+        flow = gst_gzdec_push (dec, chunk->buffer);
+    }
+    else
+    {
+        gst_buffer_unref (chunk->buffer);
+#if GST_CHECK_VERSION(1,0,0)
+        flow = GST_FLOW_FLUSHING;
+#else
+        flow = GST_FLOW_WRONG_STATE;
+#endif
+    }
+    g_slice_free (GstGzdecVerifyChunk, chunk);
+    return flow;
+}
+
+/* Drop the buffer held back, on flushes */
+    static void
+gst_gzdec_verify_drop (GstGzdec * dec)
+{
+    GstGzdecVerifyChunk *chunk = dec->verify_held;
+
+    if (!chunk)
+        return;
+    dec->verify_held = NULL;
+    g_mutex_lock (&dec->verify_lock);
+    while (!chunk->done)
+        g_cond_wait (&dec->verify_cond, &dec->verify_lock);
+    g_mutex_unlock (&dec->verify_lock);
+    gst_buffer_unref (chunk->buffer);
+    g_slice_free (GstGzdecVerifyChunk, chunk);
+}
+
+/* Push everything held back before the end of the stream */
+    static void
+gst_gzdec_drain (GstGzdec * dec)
+{
+    /* The last member is truncated, its check can't be verified */
+    gst_gzdec_verify_release (dec);
+    gst_gzdec_flush_pending (dec);
+#if GST_CHECK_VERSION(1,0,0)
+    if (dec->segment)
+    {
+        gst_gzdec_push_event (dec, dec->segment);
+        dec->segment = NULL;
+    }
+#endif
+}
+
+    static void
+gst_gzdec_reset (GstGzdec * dec)
+{
+    gst_gzdec_verify_drop (dec);
+    if (dec->pending)
+    {
+        gst_buffer_unref (dec->pending);
+        dec->pending = NULL;
+    }
+    if (dec->segment)
+    {
+        gst_event_unref (dec->segment);
+        dec->segment = NULL;
+    }
+    if (dec->sink_caps)
+    {
+        gst_caps_unref (dec->sink_caps);
+        dec->sink_caps = NULL;
+    }
+    dec->have_caps = FALSE;
+    dec->input_size = 0;
+    dec->isize = 0;
+    dec->pull_offset = 0;
+#if GST_CHECK_VERSION(1,0,0)
+    GST_OBJECT_LOCK (dec);
+    if (dec->allocator)
+    {
+        gst_object_unref (dec->allocator);
+        dec->allocator = NULL;
+    }
+    gst_allocation_params_init (&dec->params);
+    GST_OBJECT_UNLOCK (dec);
+#endif
+}
+
+    static gboolean
+gst_gzdec_handle_event (GstGzdec * dec, GstEvent * e)
+{
+    /* The output held back for its check goes before the event */
+    if (GST_EVENT_IS_SERIALIZED (e) && GST_EVENT_TYPE (e) != GST_EVENT_FLUSH_STOP)
+        gst_gzdec_verify_release (dec);
+
+    switch (GST_EVENT_TYPE (e))
+    {
+#if GST_CHECK_VERSION(1,0,0)
+        case GST_EVENT_CAPS:
+            {
+                GstCaps *caps;
+
+                gst_event_parse_caps (e, &caps);
+                /* Output held back for typefinding belongs to the previous
+                 * caps */
+                gst_gzdec_flush_pending (dec);
+                gst_gzdec_handle_sink_caps (dec, caps);
+                break;
+            }
+        case GST_EVENT_SEGMENT:
+            if (dec->segment)
+                gst_event_unref (dec->segment);
+            dec->segment = e;
+            return TRUE;
+#endif
+        case GST_EVENT_EOS:
+            if (dec->state != GZDEC_STATE_DONE && (dec->state !=
+                        GZDEC_STATE_HEADER || dec->wrap->len || !dec->members))
+                GST_WARNING_OBJECT (dec, "Truncated stream");
+            gst_gzdec_drain (dec);
+            break;
+        case GST_EVENT_FLUSH_STOP:
+            gst_gzdec_verify_drop (dec);
+            if (dec->pending)
+            {
+                gst_buffer_unref (dec->pending);
+                dec->pending = NULL;
+            }
+            break;
+        default:
+            break;
+    }
+#if GST_CHECK_VERSION(1,0,0)
+    /* Keep the serialized events in order with the queued output */
+    if (dec->output_thread && GST_EVENT_IS_SERIALIZED (e)
+            && GST_EVENT_TYPE (e) != GST_EVENT_FLUSH_STOP
+            && GST_EVENT_TYPE (e) != GST_EVENT_CAPS)
+        return gst_gzdec_push_event (dec, e);
+    return gst_pad_event_default (dec->sink, GST_OBJECT (dec), e);
+#else
+    return gst_pad_event_default (dec->sink, e);
+#endif
+}
+
+#if !GST_CHECK_VERSION(1,0,0)
+    static GstCaps *
+gst_gzdec_sink_getcaps (GstPad * pad)
+{
+    GstGzdec *dec = GST_GZDEC (GST_PAD_PARENT (pad));
+
+    return gst_gzdec_get_sink_caps (dec);
+}
+
+    static gboolean
+gst_gzdec_sink_setcaps (GstPad * pad, GstCaps * caps)
+{
+    GstGzdec *dec = GST_GZDEC (GST_PAD_PARENT (pad));
+
+    gst_gzdec_handle_sink_caps (dec, caps);
+    return TRUE;
+}
+#endif
+
+/* Size of the output buffer for a member whose ISIZE is known */
+    static gsize
+gst_gzdec_size_hint (guint64 isize, gsize input_size)
+{
+    if (isize / MAX_DEFLATE_RATIO > input_size)
+        return 0;
+    return MIN (isize, (guint64) input_size * SIZE_HINT_EXPANSION);
+}
+
+    static void
+gst_gzdec_update_check (GstGzdec * dec, const guint8 * data, gsize size)
+{
+    dec->member_size += size;
+    /* Raw deflate data has no check value */
+    if (dec->member_verify != GST_GZDEC_VERIFY_FULL || dec->raw)
+        return;
+    if (dec->zlib_wrap)
+        dec->check = adler32 (dec->check, data, size);
+    else
+        dec->check = crc32 (dec->check, data, size);
+}
+
+/* Return the size of the gzip (RFC 1952) or zlib (RFC 1950) header at the
+ * start of data, 0 if more data is needed and -1 if it's not a valid header.
+ * need is set to the number of bytes needed to go further. */
+    static gssize
+gst_gzdec_header_size (const guint8 * data, gsize size, gsize * need)
+{
+    gsize pos = 10;
+    guint8 flags;
+
+    *need = 2;
+    if (size < 2)
+        return 0;
+    if (data[0] != 0x1f || data[1] != 0x8b)
+    {
+        /* Preset dictionaries are not supported */
+        if ((data[0] & 0x0f) != 8 || (data[0] >> 4) > 7 || (data[1] & 0x20)
+                || ((data[0] << 8) | data[1]) % 31)
+            return -1;
+        return 2;
+    }
+
+    *need = pos;
+    if (size < pos)
+        return 0;
+    flags = data[3];
+    if (data[2] != 8 || (flags & 0xe0))
+        return -1;
+    if (flags & 0x04)
+    {
+        /* FEXTRA */
+        *need = pos + 2;
+        if (size < *need)
+            return 0;
+        pos += 2 + GST_READ_UINT16_LE (data + pos);
+    }
+    if (flags & 0x08)
+    {
+        /* FNAME, zero terminated */
+        while (pos < size && data[pos])
+            pos++;
+        *need = pos + 1;
+        if (size < *need)
+            return 0;
+        pos++;
+    }
+    if (flags & 0x10)
+    {
+        /* FCOMMENT, zero terminated */
+        while (pos < size && data[pos])
+            pos++;
+        *need = pos + 1;
+        if (size < *need)
+            return 0;
+        pos++;
+    }
+    if (flags & 0x02)
+        pos += 2;
+    *need = pos;
+    if (size < pos)
+        return 0;
+    return pos;
+}
+
+/* Move input bytes to dec->wrap until it holds size bytes. Returns FALSE if
+ * the input runs out first. */
+    static gboolean
+gst_gzdec_gather (GstGzdec * dec, gsize size)
+{
+    gsize n;
+
+    if (dec->wrap->len < size)
+    {
+        n = MIN (size - dec->wrap->len, dec->stream.avail_in);
+        g_byte_array_append (dec->wrap, dec->stream.next_in, n);
+        dec->stream.next_in += n;
+        dec->stream.avail_in -= n;
+    }
+    return dec->wrap->len >= size;
+}
+
+/* Whether the input is raw deflate data, see GstGzdecFormat */
+    static gboolean
+gst_gzdec_is_raw (GstGzdec * dec)
+{
+    const gchar *format = NULL;
+
+    if (dec->format != GST_GZDEC_FORMAT_AUTO)
+        return dec->format == GST_GZDEC_FORMAT_DEFLATE;
+    if (dec->sink_caps && !gst_caps_is_any (dec->sink_caps)
+            && !gst_caps_is_empty (dec->sink_caps))
+        format = gst_structure_get_string (
+                gst_caps_get_structure (dec->sink_caps, 0), "format");
+    return g_strcmp0 (format, "deflate") == 0;
+}
+
+/* Start inflating a member, or a raw deflate stream */
+    static void
+gst_gzdec_start_member (GstGzdec * dec)
+{
+    inflateReset (&dec->stream);
+    dec->check = dec->zlib_wrap ? adler32 (0L, Z_NULL, 0) : crc32 (0L, Z_NULL, 0);
+    dec->member_size = 0;
+    /* Pool threads can't wait for each other, the check is not deferred
+     * when decoding on the worker pool */
+    dec->member_verify = dec->verify;
+    if (dec->verify == GST_GZDEC_VERIFY_DEFERRED && dec->use_pool)
+        dec->member_verify = GST_GZDEC_VERIFY_FULL;
+    dec->verify_check = dec->check;
+    dec->verify_size = 0;
+    dec->at_boundary = TRUE;
+    dec->boundary_bits = 0;
+    dec->more_output = FALSE;
+    dec->state = GZDEC_STATE_DEFLATE;
+}
+
+    static GstFlowReturn
+gst_gzdec_parse_header (GstGzdec * dec)
+{
+    gssize size;
+    gsize need;
+
+    /* Raw deflate streams follow each other without header */
+    dec->raw = gst_gzdec_is_raw (dec);
+    if (dec->raw)
+    {
+        if (!dec->stream.avail_in)
+            return GST_FLOW_OK;
+        GST_DEBUG_OBJECT (dec, "Start of deflate stream %u", dec->members);
+        dec->zlib_wrap = FALSE;
+        gst_gzdec_start_member (dec);
+        return GST_FLOW_OK;
+    }
+
+    while ((size = gst_gzdec_header_size (dec->wrap->data, dec->wrap->len,
+                    &need)) == 0)
+    {
+        if (!gst_gzdec_gather (dec, need))
+            return GST_FLOW_OK;
+    }
+    /* Only the format asked for is accepted */
+    if (size > 0 && dec->format != GST_GZDEC_FORMAT_AUTO
+            && (dec->wrap->data[0] != 0x1f) !=
+            (dec->format == GST_GZDEC_FORMAT_ZLIB))
+        size = -1;
+    if (size < 0)
+    {
+        g_byte_array_set_size (dec->wrap, 0);
+        dec->state = GZDEC_STATE_DONE;
+        if (dec->members)
+        {
+            GST_WARNING_OBJECT (dec, "Ignoring trailing garbage");
+            return GST_FLOW_OK;
+        }
+        GST_ELEMENT_ERROR (dec, STREAM, WRONG_TYPE, (NULL),
+                ("Not a %s stream.", dec->format == GST_GZDEC_FORMAT_GZIP ?
+                 "gzip" : dec->format == GST_GZDEC_FORMAT_ZLIB ? "zlib" :
+                 "gzip or zlib"));
+        return GST_FLOW_ERROR;
+    }
+
+    dec->zlib_wrap = dec->wrap->data[0] != 0x1f;
+    GST_DEBUG_OBJECT (dec, "Start of %s member %u", dec->zlib_wrap ? "zlib" :
+            "gzip", dec->members);
+    /* ISIZE of a whole file is the size of its last member only */
+    if (dec->members && dec->isize)
+    {
+        dec->isize = 0;
+        gst_element_post_message (GST_ELEMENT (dec),
+                gst_message_new_duration_changed (GST_OBJECT (dec)));
+    }
+    g_byte_array_set_size (dec->wrap, 0);
+    gst_gzdec_start_member (dec);
+    return GST_FLOW_OK;
+}
+
+/* Push inflated data. When the check is deferred, the buffer is held back
+ * while its check value is computed and the previous one is pushed. */
+    static GstFlowReturn
+gst_gzdec_push_decoded (GstGzdec * dec, GstBuffer * out)
+{
+    GstGzdecVerifyChunk *chunk;
+    GstFlowReturn flow;
+
+    if (dec->member_verify != GST_GZDEC_VERIFY_DEFERRED || dec->raw)
+        return gst_gzdec_push (dec, out);
+
+    flow = gst_gzdec_verify_release (dec);
+    if (flow != GST_FLOW_OK)
+    {
+        gst_buffer_unref (out);
+        return flow;
+    }
+    chunk = g_slice_new0 (GstGzdecVerifyChunk);
+    chunk->dec = dec;
+    chunk->buffer = out;
+#if GST_CHECK_VERSION(1,0,0)
+    chunk->size = gst_buffer_get_size (out);
+#else
+    chunk->size = GST_BUFFER_SIZE (out);
+#endif
+    chunk->adler = dec->zlib_wrap;
+    dec->verify_held = chunk;
+    /* A dropped job still marks the chunk done */
+    return gst_gz_pool_client_push (dec->verify_client,
+            gst_gzdec_verify_data_job, chunk, gst_gzdec_verify_data_done);
+}
+
+    static GstFlowReturn
+gst_gzdec_parse_trailer (GstGzdec * dec)
+{
+    const guint8 *data;
+    gboolean valid;
+
+    if (dec->raw)
+    {
+        dec->members++;
+        dec->state = GZDEC_STATE_HEADER;
+        return GST_FLOW_OK;
+    }
+    if (!gst_gzdec_gather (dec, dec->zlib_wrap ? 4 : 8))
+        return GST_FLOW_OK;
+
+    data = dec->wrap->data;
+    if (dec->member_verify == GST_GZDEC_VERIFY_DEFERRED)
+    {
+        /* The last buffer of the member completes its check value */
+        GstFlowReturn flow = gst_gzdec_verify_release (dec);
+
+        if (flow != GST_FLOW_OK)
+        {
+            dec->state = GZDEC_STATE_DONE;
+            return flow;
+        }
+        if (dec->zlib_wrap)
+            valid = GST_READ_UINT32_BE (data) == dec->verify_check;
+        else
+            valid = GST_READ_UINT32_LE (data) == dec->verify_check
+                && GST_READ_UINT32_LE (data + 4) == (guint32) dec->verify_size;
+    }
+    else if (dec->member_verify == GST_GZDEC_VERIFY_NONE)
+        valid = TRUE;
+    else if (dec->zlib_wrap)
+        valid = GST_READ_UINT32_BE (data) == dec->check;
+    else
+        valid = GST_READ_UINT32_LE (data) == dec->check
+            && GST_READ_UINT32_LE (data + 4) == (guint32) dec->member_size;
+    g_byte_array_set_size (dec->wrap, 0);
+    if (!valid)
+    {
+        dec->state = GZDEC_STATE_DONE;
+        GST_ELEMENT_ERROR (dec, STREAM, DECODE, (NULL),
+                ("Data check failed at the end of member %u.", dec->members));
+        return GST_FLOW_ERROR;
+    }
+
+    dec->members++;
+    /* zlib streams can't be concatenated, gzip members can */
+    dec->state = dec->zlib_wrap ? GZDEC_STATE_DONE : GZDEC_STATE_HEADER;
+    return GST_FLOW_OK;
+}
+
+/* Called when inflate stopped at a block boundary. If the next block is a
+ * stored block whose header is in the input, the header is consumed and the
+ * block data will be pushed without copy. The bits of the block header that
+ * inflate already read are the high bits of the last byte it consumed. */
+    static gboolean
+gst_gzdec_start_stored (GstGzdec * dec)
+{
+#ifdef HAVE_ZERO_COPY_STORED
+    const guint8 *p = dec->stream.next_in;
+    guint bits = dec->boundary_bits;
+    guint header, len, nlen;
+
+    if (dec->stream.avail_in < (bits >= 3 ? 4 : 5))
+        return FALSE;
+    header = dec->last_byte >> (8 - bits);
+    if (bits < 3)
+        header |= *p++ << bits;
+    /* BTYPE 00 is a stored block, then LEN and NLEN on a byte boundary */
+    if (header & 0x06)
+        return FALSE;
+    len = GST_READ_UINT16_LE (p);
+    nlen = GST_READ_UINT16_LE (p + 2);
+    if (len != (~nlen & 0xffff))
+        return FALSE;
+    /* Drop the bits inflate holds, the next block is byte aligned */
+    if (inflatePrime (&dec->stream, -1, 0) != Z_OK)
+        return FALSE;
+
+    p += 4;
+    dec->stream.avail_in -= p - dec->stream.next_in;
+    dec->stream.next_in = (z_const Bytef *) p;
+    dec->stored_left = len;
+    dec->stored_last = header & 1;
+    dec->state = GZDEC_STATE_STORED;
+    GST_GZ_HOT_LOG (dec, "Stored block of %u bytes", len);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/* Push the data of the current stored block that is in the input as a
+ * sub-buffer of the input buffer, base being mapped at base_offset in it */
+    static GstFlowReturn
+gst_gzdec_push_stored (GstGzdec * dec, GstBuffer * in, const guint8 * base,
+        gsize base_offset)
+{
+    const guint8 *data = dec->stream.next_in;
+    GstFlowReturn flow;
+    GstBuffer *out;
+    guint n, dict;
+
+    n = MIN (dec->stored_left, dec->stream.avail_in);
+    if (dec->offset + n > gst_gzdec_output_limit (dec))
+        return gst_gzdec_limit_exceeded (dec);
+    if (n)
+    {
+        gst_gzdec_update_check (dec, data, n);
+        /* Amend the inflate window for the blocks that follow */
+        dict = MIN (n, 32768);
+        inflateSetDictionary (&dec->stream, data + n - dict, dict);
+#if GST_CHECK_VERSION(1,0,0)
+        out = gst_buffer_copy_region (in, GST_BUFFER_COPY_MEMORY,
+                base_offset + (data - base), n);
+#else
+        out = gst_buffer_create_sub (in, base_offset + (data - base), n);
+#endif
+        GST_BUFFER_OFFSET (out) = dec->offset;
+        dec->stream.next_in += n;
+        dec->stream.avail_in -= n;
+        dec->stored_left -= n;
+        flow = gst_gzdec_push_decoded (dec, out);
+        if (flow != GST_FLOW_OK)
+            return flow;
+        dec->offset += n;
+    }
+
+    if (!dec->stored_left)
+    {
+        if (dec->stored_last)
+            dec->state = GZDEC_STATE_TRAILER;
+        else
+        {
+            dec->state = GZDEC_STATE_DEFLATE;
+            dec->at_boundary = TRUE;
+            dec->boundary_bits = 0;
+        }
+    }
+    return GST_FLOW_OK;
+}
+
+/* Inflate block by block into the output set in the z_stream, until it is
+ * full, the input runs out, a stored block starts or the member ends */
+    static int
+gst_gzdec_inflate_blocks (GstGzdec * dec)
+{
+    int ret = Z_OK;
+
+    do
+    {
+        uInt avail_in = dec->stream.avail_in;
+        uInt avail_out = dec->stream.avail_out;
+
+        if (dec->at_boundary)
+        {
+            dec->at_boundary = FALSE;
+            if (gst_gzdec_start_stored (dec))
+                break;
+        }
+        GST_GZ_PROBE_CODEC_START (inflate, dec, avail_in, avail_out);
+        ret = inflate (&dec->stream, Z_BLOCK);
+        GST_GZ_PROBE_CODEC_DONE (inflate, dec, avail_in - dec->stream.avail_in,
+                avail_out - dec->stream.avail_out, ret);
+        GST_GZ_HOT_LOG (dec, "inflate() return %d [%s]", ret, dec->stream.msg);
+        if (dec->stream.avail_in < avail_in)
+            dec->last_byte = dec->stream.next_in[-1];
+        dec->more_output = dec->stream.avail_out == 0;
+        /* The end of the final block is reported as a boundary (bit 64 set)
+         * and Z_STREAM_END only comes with the next call, which raw deflate
+         * input may never give at the end of the stream */
+        if (ret == Z_STREAM_END
+                || (ret == Z_OK && (dec->stream.data_type & 192) == 192))
+        {
+            dec->state = GZDEC_STATE_TRAILER;
+            break;
+        }
+        if (ret == Z_OK && (dec->stream.data_type & 128))
+        {
+            dec->at_boundary = TRUE;
+            dec->boundary_bits = dec->stream.data_type & 7;
+        }
+    } while (ret == Z_OK && dec->stream.avail_out && dec->stream.avail_in);
+    return ret;
+}
+
+/* Inflate the input into one output buffer, stopping early when a stored
+ * block is found. The output buffer is allocated with *size_hint bytes when
+ * non-zero and then grows until the member ends. */
+    static GstFlowReturn
+gst_gzdec_inflate (GstGzdec * dec, gsize * size_hint)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    GstBuffer *out;
+    gsize size, have;
+    guint64 limit;
+    int ret;
+#if GST_CHECK_VERSION(1,0,0)
+    GstMapInfo outmap;
+    gboolean grow = FALSE;
+#endif
+
+    /* Nothing to do until more input comes */
+    if (!dec->stream.avail_in && !dec->more_output)
+        return GST_FLOW_OK;
+
+    if (*size_hint)
+    {
+        size = *size_hint;
+        *size_hint = 0;
+#if GST_CHECK_VERSION(1,0,0)
+        grow = TRUE;
+#endif
+    }
+    else
+        size = dec->offset ? dec->buffer_size : dec->first_buffer_size;
+    /* Never allocate more than the limits allow, at least one byte is needed
+     * to tell whether the limit is exceeded */
+    limit = gst_gzdec_output_limit (dec);
+    size = MIN (size, MAX (limit - MIN (limit, dec->offset), 1));
+#if GST_CHECK_VERSION(1,0,0)
+    /* Create and map the output buffer */
+    out = gst_gzdec_alloc_buffer (dec, size);
+    GST_GZ_PROBE_ALLOC (dec, size);
+    gst_buffer_map (out, &outmap, GST_MAP_WRITE);
+    dec->stream.next_out = (Bytef *) outmap.data;
+    dec->stream.avail_out = outmap.size;
+#else
+    /* Create the output buffer */
+    flow = gst_pad_alloc_buffer (dec->src, dec->offset, size,
+            GST_PAD_CAPS (dec->src), &out);
+    if (flow != GST_FLOW_OK) {
+        GST_DEBUG_OBJECT (dec, "pad alloc failed: %s", gst_flow_get_name (flow));
+        return flow;
+    }
+    GST_GZ_PROBE_ALLOC (dec, size);
+    dec->stream.next_out = (void *) GST_BUFFER_DATA (out);
+    dec->stream.avail_out = GST_BUFFER_SIZE (out);
+#endif
+
+    ret = gst_gzdec_inflate_blocks (dec);
+
+#if GST_CHECK_VERSION(1,0,0)
+    have = outmap.size - dec->stream.avail_out;
+    gst_gzdec_update_check (dec, outmap.data, have);
+    gst_buffer_unmap (out, &outmap);
+    /* The hint was capped, the buffer doubles with memories appended to it
+     * while the member goes on */
+    while (grow && ret == Z_OK && !dec->stream.avail_out
+            && dec->state == GZDEC_STATE_DEFLATE && dec->offset + have < limit)
+    {
+        GstBuffer *more;
+        GstMemory *mem;
+        gsize n;
+
+        more = gst_gzdec_alloc_buffer (dec, MIN (have,
+                    limit - dec->offset - have));
+        GST_GZ_PROBE_ALLOC (dec, gst_buffer_get_size (more));
+        mem = gst_buffer_get_memory (more, 0);
+        gst_buffer_unref (more);
+        gst_memory_map (mem, &outmap, GST_MAP_WRITE);
+        dec->stream.next_out = (Bytef *) outmap.data;
+        dec->stream.avail_out = outmap.size;
+        ret = gst_gzdec_inflate_blocks (dec);
+        n = outmap.size - dec->stream.avail_out;
+        gst_gzdec_update_check (dec, outmap.data, n);
+        gst_memory_unmap (mem, &outmap);
+        gst_buffer_append_memory (out, mem);
+        have += n;
+    }
+#else
+    have = GST_BUFFER_SIZE (out) - dec->stream.avail_out;
+    gst_gzdec_update_check (dec, GST_BUFFER_DATA (out), have);
+#endif
+
+    /* Z_BUF_ERROR only means that more input is needed */
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+    {
+        GST_ELEMENT_ERROR (dec, STREAM, DECODE, (NULL),
+                ("Failed to decompress data (error code %i).", ret));
+        dec->state = GZDEC_STATE_DONE;
+        gst_buffer_unref (out);
+        return GST_FLOW_ERROR;
+    }
+    if (!have)
+    {
+        gst_buffer_unref (out);
+        return GST_FLOW_OK;
+    }
+    if (dec->offset + have > limit)
+    {
+        gst_buffer_unref (out);
+        return gst_gzdec_limit_exceeded (dec);
+    }
+
+    /* Resize the output buffer */
+#if GST_CHECK_VERSION(1,0,0)
+    gst_buffer_resize (out, 0, have);
+#else
+    GST_BUFFER_SIZE (out) = have;
+#endif
+    GST_BUFFER_OFFSET (out) = dec->offset;
+    flow = gst_gzdec_push_decoded (dec, out);
+    if (flow == GST_FLOW_OK)
+        dec->offset += have;
+    return flow;
+}
+
+/* Decompress the input currently set in the z_stream and push the output.
+ * in is the buffer holding the input, the bytes from base_offset in it are
+ * mapped at base. The first output buffer is allocated with size_hint bytes
+ * when non-zero. */
+    static GstFlowReturn
+gst_gzdec_decompress (GstGzdec * dec, GstBuffer * in, const guint8 * base,
+        gsize base_offset, gsize size_hint)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    while (flow == GST_FLOW_OK)
+    {
+        GstGzdecState state = dec->state;
+        uInt avail_in = dec->stream.avail_in;
+        guint64 offset = dec->offset;
+
+        switch (dec->state)
+        {
+            case GZDEC_STATE_HEADER:
+                flow = gst_gzdec_parse_header (dec);
+                break;
+            case GZDEC_STATE_DEFLATE:
+                flow = gst_gzdec_inflate (dec, &size_hint);
+                break;
+            case GZDEC_STATE_STORED:
+                flow = gst_gzdec_push_stored (dec, in, base, base_offset);
+                break;
+            case GZDEC_STATE_TRAILER:
+                flow = gst_gzdec_parse_trailer (dec);
+                break;
+            case GZDEC_STATE_DONE:
+                /* Ignore anything after the end of the stream */
+                dec->stream.avail_in = 0;
+                break;
+        }
+        /* Nothing moved, wait for more input */
+        if (dec->state == state && dec->stream.avail_in == avail_in
+                && dec->offset == offset)
+            break;
+    }
+    return flow;
+}
+
+/* With auto-passthrough, a stream that doesn't start with a gzip or zlib
+ * header is pushed unchanged. The sink caps are used on the src pad unless
+ * they claim gzip data, typefinding is done then. */
+    static gboolean
+gst_gzdec_check_passthrough (GstGzdec * dec, GstBuffer * in)
+{
+    guint8 data[10];
+    gsize size, need;
+    GstCaps *caps;
+
+    if (dec->passthrough)
+        return TRUE;
+    if (!dec->auto_passthrough || gst_gzdec_is_raw (dec)
+            || dec->state != GZDEC_STATE_HEADER
+            || dec->members || dec->wrap->len)
+        return FALSE;
+#if GST_CHECK_VERSION(1,0,0)
+    size = gst_buffer_extract (in, 0, data, sizeof (data));
+#else
+    size = MIN (GST_BUFFER_SIZE (in), sizeof (data));
+    memcpy (data, GST_BUFFER_DATA (in), size);
+#endif
+    if (!size || gst_gzdec_header_size (data, size, &need) >= 0)
+        return FALSE;
+
+    GST_DEBUG_OBJECT (dec, "No gzip or zlib header, passing the input through");
+    dec->passthrough = TRUE;
+    dec->state = GZDEC_STATE_DONE;
+    if (dec->have_caps || !dec->sink_caps || !gst_caps_is_fixed (dec->sink_caps))
+        return TRUE;
+    caps = gst_static_caps_get (&gzip_caps);
+    if (!gst_caps_can_intersect (dec->sink_caps, caps))
+        gst_gzdec_set_src_caps (dec, dec->sink_caps);
+    gst_caps_unref (caps);
+    return TRUE;
+}
+
+/* Decompress an input buffer, the buffer is not consumed */
+    static GstFlowReturn
+gst_gzdec_process (GstGzdec * dec, GstBuffer * in)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+#if GST_CHECK_VERSION(1,0,0)
+    GstMapInfo inmap = GST_MAP_INFO_INIT;
+#endif
+
+    if (!dec->ready)
+    {
+        /* Don't go further if not ready */
+        GST_ELEMENT_ERROR (dec, LIBRARY, FAILED, (NULL), 
+                ("Decompressor not ready."));
+#if GST_CHECK_VERSION(1,0,0)
+        flow = GST_FLOW_FLUSHING;
+#else
+        flow = GST_FLOW_WRONG_STATE;
+#endif
+    }
+    else if (gst_gzdec_check_passthrough (dec, in))
+    {
+#if GST_CHECK_VERSION(1,0,0)
+        gsize size = gst_buffer_get_size (in);
+#else
+        gsize size = GST_BUFFER_SIZE (in);
+#endif
+        if (dec->max_output_bytes && dec->offset + size > dec->max_output_bytes)
+            return gst_gzdec_limit_exceeded (dec);
+        flow = gst_gzdec_push (dec, gst_buffer_ref (in));
+        if (flow == GST_FLOW_OK)
+            dec->offset += size;
+    }
+    else
+    {
+#if GST_CHECK_VERSION(1,0,0)
+        GstGzMemberMeta *meta;
+        gsize size = gst_buffer_get_size (in), offset = 0;
+        guint i, n;
+
+        GST_GZ_HOT_LOG (dec, "Input buffer size : %" G_GSIZE_FORMAT, size);
+        dec->input_bytes += size;
+
+        /* Whole members from gzparse are inflated in a single buffer */
+        meta = gst_buffer_get_gz_member_meta (in);
+        if (meta && gst_gzdec_size_hint (meta->isize, size))
+        {
+            gst_buffer_map (in, &inmap, GST_MAP_READ);
+            dec->stream.next_in = (z_const Bytef *) inmap.data;
+            dec->stream.avail_in = inmap.size;
+            flow = gst_gzdec_decompress (dec, in, inmap.data, 0,
+                    gst_gzdec_size_hint (meta->isize, size));
+            gst_buffer_unmap (in, &inmap);
+            return flow;
+        }
+
+        /* Each memory is inflated where it is, mapping the whole buffer
+         * would merge the memories into a copy */
+        n = gst_buffer_n_memory (in);
+        for (i = 0; i < n && flow == GST_FLOW_OK; i++)
+        {
+            GstMemory *mem = gst_buffer_peek_memory (in, i);
+
+            if (!gst_memory_map (mem, &inmap, GST_MAP_READ))
+            {
+                GST_ELEMENT_ERROR (dec, STREAM, DECODE, (NULL),
+                        ("Failed to map input memory."));
+                return GST_FLOW_ERROR;
+            }
+            dec->stream.next_in = (z_const Bytef *) inmap.data;
+            dec->stream.avail_in = inmap.size;
+            flow = gst_gzdec_decompress (dec, in, inmap.data, offset, 0);
+            offset += inmap.size;
+            gst_memory_unmap (mem, &inmap);
+        }
+        dec->stream.next_in = Z_NULL;
+        dec->stream.avail_in = 0;
+#else
+        dec->stream.next_in = (void *) GST_BUFFER_DATA (in);
+        dec->stream.avail_in = GST_BUFFER_SIZE (in);
+        dec->input_bytes += GST_BUFFER_SIZE (in);
+        flow = gst_gzdec_decompress (dec, in, GST_BUFFER_DATA (in), 0, 0);
+#endif
+    }
+    return flow; 
+}
+
+    static GstFlowReturn
+gst_gzdec_process_job (gpointer user_data, gpointer data)
+{
+    GstGzdec *dec = GST_GZDEC (user_data);
+    GstFlowReturn flow;
+
+    /* Stop decompressing once downstream returned an error */
+    flow = gst_gz_pool_client_get_flow (dec->pool_client);
+    if (flow != GST_FLOW_OK)
+        return flow;
+    return gst_gzdec_process (dec, GST_BUFFER_CAST (data));
+}
+
+    static GstFlowReturn
+gst_gzdec_event_job (gpointer user_data, gpointer data)
+{
+    GstGzdec *dec = GST_GZDEC (user_data);
+
+    /* The job owns a reference that is released when the job is destroyed */
+    gst_gzdec_handle_event (dec, gst_event_ref (GST_EVENT_CAST (data)));
+    return GST_FLOW_OK;
+}
+
+/* Decompress an input buffer, either right away or on the worker pool.
+ * The buffer is consumed. */
+    static GstFlowReturn
+gst_gzdec_submit (GstGzdec * dec, GstBuffer * in)
+{
+    GstFlowReturn flow;
+
+#if GST_CHECK_VERSION(1,0,0)
+    if (dec->use_pool)
+    {
+        /* Return right away, the buffer is decompressed by the worker pool
+         * and the output is pushed by the output thread */
+        flow = gst_gzdec_output_wait (dec);
+        if (flow != GST_FLOW_OK)
+        {
+            gst_buffer_unref (in);
+            return flow;
+        }
+        return gst_gz_pool_client_push (dec->pool_client,
+                gst_gzdec_process_job, in, (GDestroyNotify) gst_buffer_unref);
+    }
+#endif
+
+    flow = gst_gzdec_process (dec, in);
+    gst_buffer_unref (in);
+    return flow;
+}
+
+/* Decompress the accumulated input as a single buffer */
+    static GstFlowReturn
+gst_gzdec_flush_input (GstGzdec * dec)
+{
+    gsize size = gst_adapter_available (dec->input);
+    GstBuffer *in;
+
+    if (!size)
+        return GST_FLOW_OK;
+    GST_GZ_HOT_LOG (dec, "Flushing %" G_GSIZE_FORMAT " accumulated bytes",
+            size);
+    in = gst_adapter_take_buffer (dec->input, size);
+    g_mutex_lock (&dec->input_lock);
+    dec->input_start = 0;
+    g_mutex_unlock (&dec->input_lock);
+    return gst_gzdec_submit (dec, in);
+}
+
+    static void
+gst_gzdec_clear_input (GstGzdec * dec)
+{
+    gst_adapter_clear (dec->input);
+    g_mutex_lock (&dec->input_lock);
+    dec->input_start = 0;
+    g_mutex_unlock (&dec->input_lock);
+    dec->input_flow = GST_FLOW_OK;
+}
+
+/* Flushes the accumulated input once it has been held for
+ * max-input-latency, also when no buffer comes in anymore. It decompresses
+ * and pushes like the chain function, with the sink pad stream lock held. */
+    static gpointer
+gst_gzdec_input_thread (gpointer data)
+{
+    GstGzdec *dec = GST_GZDEC (data);
+
+    g_mutex_lock (&dec->input_lock);
+    while (!dec->input_thread_stop)
+    {
+        gint64 deadline = dec->input_start + dec->max_input_latency / GST_USECOND;
+        GstFlowReturn flow;
+        gboolean due;
+
+        if (!dec->input_start || !dec->max_input_latency)
+        {
+            g_cond_wait (&dec->input_cond, &dec->input_lock);
+            continue;
+        }
+        if (g_get_monotonic_time () < deadline)
+        {
+            g_cond_wait_until (&dec->input_cond, &dec->input_lock, deadline);
+            continue;
+        }
+
+        /* The stream lock is taken before input_lock by the chain function */
+        g_mutex_unlock (&dec->input_lock);
+        GST_PAD_STREAM_LOCK (dec->sink);
+        g_mutex_lock (&dec->input_lock);
+        /* The chain function may have flushed it meanwhile */
+        due = dec->input_start && dec->input_start
+            + dec->max_input_latency / GST_USECOND <= g_get_monotonic_time ();
+        g_mutex_unlock (&dec->input_lock);
+        if (due)
+        {
+            GST_LOG_OBJECT (dec, "Max input latency reached");
+            flow = gst_gzdec_flush_input (dec);
+            /* Returned by the next chain, like for the events */
+            if (flow != GST_FLOW_OK && dec->input_flow == GST_FLOW_OK)
+                dec->input_flow = flow;
+        }
+        GST_PAD_STREAM_UNLOCK (dec->sink);
+        g_mutex_lock (&dec->input_lock);
+    }
+    g_mutex_unlock (&dec->input_lock);
+    return NULL;
+}
+
+    static void
+gst_gzdec_stop_input_thread (GstGzdec * dec)
+{
+    if (!dec->input_thread)
+        return;
+    g_mutex_lock (&dec->input_lock);
+    dec->input_thread_stop = TRUE;
+    g_cond_signal (&dec->input_cond);
+    g_mutex_unlock (&dec->input_lock);
+    g_thread_join (dec->input_thread);
+    dec->input_thread = NULL;
+    dec->input_thread_stop = FALSE;
+}
+
+/* Whether an input buffer is accumulated rather than decompressed right
+ * away. Whole members from gzparse don't need to be. */
+    static gboolean
+gst_gzdec_hold_input (GstGzdec * dec, GstBuffer * in, guint min_size)
+{
+#if GST_CHECK_VERSION(1,0,0)
+    if (gst_buffer_get_gz_member_meta (in))
+        return FALSE;
+#endif
+    if (!min_size)
+        return FALSE;
+    return gst_adapter_available (dec->input) > 0
+#if GST_CHECK_VERSION(1,0,0)
+        || gst_buffer_get_size (in) < min_size;
+#else
+        || GST_BUFFER_SIZE (in) < min_size;
+#endif
+}
+
+/* Accumulate an input buffer, the buffer is consumed */
+    static void
+gst_gzdec_push_input (GstGzdec * dec, GstBuffer * in)
+{
+    if (!gst_adapter_available (dec->input))
+    {
+        g_mutex_lock (&dec->input_lock);
+        dec->input_start = g_get_monotonic_time ();
+        if (dec->max_input_latency && !dec->input_thread)
+            dec->input_thread = g_thread_new ("gzdec-input",
+                    gst_gzdec_input_thread, dec);
+        g_cond_signal (&dec->input_cond);
+        g_mutex_unlock (&dec->input_lock);
+    }
+    gst_adapter_push (dec->input, in);
+}
+
+/* Flush the accumulated input once min-input-size or max-input-latency is
+ * reached. gst_gzdec_input_thread() flushes it when no buffer comes in. */
+    static GstFlowReturn
+gst_gzdec_check_input (GstGzdec * dec)
+{
+    gsize size = gst_adapter_available (dec->input);
+    guint64 held;
+
+    if (!size)
+        return GST_FLOW_OK;
+    held = (g_get_monotonic_time () - dec->input_start) * GST_USECOND;
+    if (size >= dec->min_input_size
+            || (dec->max_input_latency && held >= dec->max_input_latency))
+        return gst_gzdec_flush_input (dec);
+    return GST_FLOW_OK;
+}
+
+static gboolean
+#if GST_CHECK_VERSION(1,0,0)
+gst_gzdec_event (GstPad * pad, GstObject * parent, GstEvent * e)
+#else
+gst_gzdec_event (GstPad * pad, GstEvent * e)
+#endif
+{
+    GstGzdec *dec;
+    gboolean ret = TRUE;
+
+#if GST_CHECK_VERSION(1,0,0)
+    dec = GST_GZDEC (parent);
+#else
+    dec = GST_GZDEC (gst_pad_get_parent (pad));
+#endif
+    /* Decompress the accumulated input before the next serialized event */
+    if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_STOP)
+        gst_gzdec_clear_input (dec);
+    else if (GST_EVENT_IS_SERIALIZED (e))
+    {
+        GstFlowReturn flow = gst_gzdec_flush_input (dec);
+
+        if (flow != GST_FLOW_OK)
+            dec->input_flow = flow;
+    }
+
+    if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_START)
+        gst_gzdec_set_throttle_flushing (dec, TRUE);
+    else if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_STOP)
+        gst_gzdec_set_throttle_flushing (dec, FALSE);
+#if GST_CHECK_VERSION(1,0,0)
+    /* The output thread drops its queue and pauses until the flush stops */
+    if (dec->output_thread && GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_START)
+        gst_gzdec_set_output_flushing (dec, TRUE);
+    else if (dec->output_thread && GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_STOP)
+    {
+        /* A running job must not queue output from before the flush */
+        if (dec->use_pool)
+            gst_gz_pool_client_wait (dec->pool_client);
+        gst_gzdec_set_output_flushing (dec, FALSE);
+        gst_pad_start_task (dec->src, (GstTaskFunction) gst_gzdec_output_loop,
+                dec->src, NULL);
+    }
+#endif
+
+    if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_START)
+        gst_gz_pool_client_set_flushing (dec->verify_client, TRUE);
+    else if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_STOP)
+        gst_gz_pool_client_set_flushing (dec->verify_client, FALSE);
+
+    if (!dec->use_pool)
+        ret = gst_gzdec_handle_event (dec, e);
+    else if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_START)
+    {
+        gst_gz_pool_client_set_flushing (dec->pool_client, TRUE);
+        ret = gst_gzdec_handle_event (dec, e);
+    }
+    else if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_STOP)
+    {
+        gst_gz_pool_client_set_flushing (dec->pool_client, FALSE);
+        ret = gst_gzdec_handle_event (dec, e);
+    }
+    else if (GST_EVENT_IS_SERIALIZED (e))
+    {
+        /* Keep the event in order with the buffers being decompressed */
+        gst_gz_pool_client_push (dec->pool_client, gst_gzdec_event_job, e,
+                (GDestroyNotify) gst_event_unref);
+    }
+    else
+        ret = gst_gzdec_handle_event (dec, e);
+#if !GST_CHECK_VERSION(1,0,0)
+    gst_object_unref (dec);
+#endif
+    return ret;
+}
+
+static GstFlowReturn
+#if GST_CHECK_VERSION(1,0,0)
+gst_gzdec_chain (GstPad * pad, GstObject * parent, GstBuffer * in)
+#else
+gst_gzdec_chain (GstPad * pad, GstBuffer * in)
+#endif
+{
+    GstGzdec *dec;
+    GstFlowReturn flow;
+
+#if GST_CHECK_VERSION(1,0,0)
+    dec = GST_GZDEC (parent);
+#else
+    dec = GST_GZDEC (GST_PAD_PARENT (pad));
+#endif
+    if (dec->input_flow != GST_FLOW_OK)
+    {
+        gst_buffer_unref (in);
+        return dec->input_flow;
+    }
+    if (!gst_gzdec_hold_input (dec, in, dec->min_input_size))
+    {
+        flow = gst_gzdec_flush_input (dec);
+        if (flow != GST_FLOW_OK)
+        {
+            gst_buffer_unref (in);
+            return flow;
+        }
+        return gst_gzdec_submit (dec, in);
+    }
+
+    gst_gzdec_push_input (dec, in);
+    return gst_gzdec_check_input (dec);
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* The buffers of a list are decompressed together, even when min-input-size
+ * is 0 */
+    static GstFlowReturn
+gst_gzdec_chain_list (GstPad * pad, GstObject * parent, GstBufferList * list)
+{
+    GstGzdec *dec = GST_GZDEC (parent);
+    GstFlowReturn flow = dec->input_flow;
+    guint i, n = gst_buffer_list_length (list);
+
+    for (i = 0; i < n && flow == GST_FLOW_OK; i++)
+    {
+        GstBuffer *in = gst_buffer_ref (gst_buffer_list_get (list, i));
+
+        if (gst_gzdec_hold_input (dec, in, G_MAXUINT))
+            gst_gzdec_push_input (dec, in);
+        else
+        {
+            flow = gst_gzdec_flush_input (dec);
+            if (flow == GST_FLOW_OK)
+                flow = gst_gzdec_submit (dec, in);
+            else
+                gst_buffer_unref (in);
+        }
+    }
+    gst_buffer_list_unref (list);
+    if (flow != GST_FLOW_OK)
+        return flow;
+    if (!dec->min_input_size)
+        return gst_gzdec_flush_input (dec);
+    return gst_gzdec_check_input (dec);
+}
+#endif
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Whole-file decoding in pull mode: the input is read in one go and, using
+ * the ISIZE trailer of gzip files as a hint, inflated into a single output
+ * buffer. */
+    static void
+gst_gzdec_start_pull (GstGzdec * dec)
+{
+    GstSegment segment;
+    gchar *stream_id;
+
+    stream_id = gst_pad_create_stream_id (dec->src, GST_ELEMENT (dec), NULL);
+    gst_gzdec_push_event (dec, gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
+    gst_segment_init (&segment, GST_FORMAT_BYTES);
+    if (dec->segment)
+        gst_event_unref (dec->segment);
+    dec->segment = gst_event_new_segment (&segment);
+}
+
+    static void
+gst_gzdec_pause (GstGzdec * dec, GstPad * pad, GstFlowReturn flow)
+{
+    GST_DEBUG_OBJECT (dec, "Pausing task, reason %s", gst_flow_get_name (flow));
+    gst_pad_pause_task (pad);
+    if (flow == GST_FLOW_EOS)
+    {
+        gst_gzdec_drain (dec);
+        gst_gzdec_push_event (dec, gst_event_new_eos ());
+    }
+    else if (flow == GST_FLOW_NOT_LINKED || flow < GST_FLOW_EOS)
+    {
+        GST_ELEMENT_ERROR (dec, STREAM, FAILED, (NULL),
+                ("Streaming stopped, reason %s.", gst_flow_get_name (flow)));
+        gst_gzdec_push_event (dec, gst_event_new_eos ());
+    }
+}
+
+    static void
+gst_gzdec_loop (GstPad * pad)
+{
+    GstGzdec *dec = GST_GZDEC (GST_PAD_PARENT (pad));
+    GstFlowReturn flow;
+    GstBuffer *in = NULL;
+    GstMapInfo inmap;
+
+    gst_gzdec_start_pull (dec);
+
+    /* Read the trailer first, it gives the uncompressed size (modulo 2^32) */
+    dec->isize = 0;
+    flow = gst_pad_pull_range (pad, dec->input_size - 4, 4, &in);
+    if (flow != GST_FLOW_OK)
+        goto pause;
+    if (gst_buffer_get_size (in) == 4)
+    {
+        guint32 isize;
+
+        gst_buffer_extract (in, 0, &isize, 4);
+        isize = GUINT32_FROM_LE (isize);
+        if (isize / MAX_DEFLATE_RATIO <= dec->input_size)
+            dec->isize = isize;
+    }
+    gst_buffer_unref (in);
+    in = NULL;
+
+    flow = gst_pad_pull_range (pad, 0, dec->input_size, &in);
+    if (flow != GST_FLOW_OK)
+        goto pause;
+    if (gst_gzdec_check_passthrough (dec, in))
+    {
+        if (dec->max_output_bytes && dec->input_size > dec->max_output_bytes)
+        {
+            gst_buffer_unref (in);
+            flow = gst_gzdec_limit_exceeded (dec);
+            goto pause;
+        }
+        dec->isize = dec->input_size;
+        gst_element_post_message (GST_ELEMENT (dec),
+                gst_message_new_duration_changed (GST_OBJECT (dec)));
+        dec->offset = dec->input_size;
+        flow = gst_gzdec_push (dec, in);
+        if (flow == GST_FLOW_OK)
+            flow = GST_FLOW_EOS;
+        goto pause;
+    }
+    gst_buffer_map (in, &inmap, GST_MAP_READ);
+
+    /* zlib streams end with an Adler-32 checksum, not with the size */
+    if (inmap.size < 2 || inmap.data[0] != 0x1f || inmap.data[1] != 0x8b
+            || gst_gzdec_is_raw (dec))
+        dec->isize = 0;
+    if (dec->isize)
+    {
+        GST_DEBUG_OBJECT (dec, "Uncompressed size is %" G_GUINT64_FORMAT,
+                dec->isize);
+        gst_element_post_message (GST_ELEMENT (dec),
+                gst_message_new_duration_changed (GST_OBJECT (dec)));
+    }
+
+    dec->stream.next_in = (z_const Bytef *) inmap.data;
+    dec->stream.avail_in = inmap.size;
+    dec->input_bytes = inmap.size;
+    flow = gst_gzdec_decompress (dec, in, inmap.data, 0,
+            gst_gzdec_size_hint (dec->isize, inmap.size));
+    dec->stream.next_in = Z_NULL;
+    dec->stream.avail_in = 0;
+    gst_buffer_unmap (in, &inmap);
+    gst_buffer_unref (in);
+
+    if (flow == GST_FLOW_OK)
+    {
+        /* ISIZE is modulo 2^32 and only covers the last member */
+        if (dec->isize != dec->offset)
+        {
+            dec->isize = dec->offset;
+            gst_element_post_message (GST_ELEMENT (dec),
+                    gst_message_new_duration_changed (GST_OBJECT (dec)));
+        }
+        flow = GST_FLOW_EOS;
+    }
 
-enum
+pause:
+    gst_gzdec_pause (dec, pad, flow);
+}
+
+#ifdef HAVE_ZERO_COPY_STORED
+/* Feed the input up to byte upto to the sequential decoder, *fed is the
+ * input given so far */
+    static GstFlowReturn
+gst_gzdec_feed (GstGzdec * dec, GstBuffer * in, const guint8 * base,
+        gsize * fed, gsize upto)
 {
-    PROP_0,
-    PROP_FIRST_BUFFER_SIZE,
-    PROP_BUFFER_SIZE
-};
+    GstFlowReturn flow;
 
-struct _GstGzdec
+    dec->stream.next_in = (z_const Bytef *) base + *fed;
+    dec->stream.avail_in = upto - *fed;
+    flow = gst_gzdec_decompress (dec, in, base, 0, 0);
+    *fed = upto - dec->stream.avail_in;
+    dec->stream.next_in = Z_NULL;
+    dec->stream.avail_in = 0;
+    return flow;
+}
+
+/* Push the output of a chunk that starts where the sequential decoder
+ * stopped and move the decoder to the end of the chunk: its window is
+ * amended with the chunk output and the bits of the last byte are primed. */
+    static GstFlowReturn
+gst_gzdec_spec_inject (GstGzdec * dec, GstGzSpecChunk * chunk,
+        guint8 * window, gsize window_size, gsize * fed)
 {
-    GstElement parent;
+    gsize size = chunk->output->len, keep;
+    gsize byte = chunk->end >> 3;
+    guint bits = chunk->end & 7;
+    GstFlowReturn flow = GST_FLOW_OK;
+    GstBuffer *out;
 
-    GstPad *sink;
-    GstPad *src;
+    if (dec->offset + size > gst_gzdec_output_limit (dec))
+        return gst_gzdec_limit_exceeded (dec);
+    gst_gzdec_update_check (dec, chunk->output->data, size);
 
-    /* Properties */
-    guint first_buffer_size;
-    guint buffer_size;
+    /* The new window is the end of the old one followed by the output */
+    keep = size < 32768 ? MIN (window_size, 32768 - size) : 0;
+    memmove (window, window + window_size - keep, keep);
+    if (size < 32768)
+        memcpy (window + keep, chunk->output->data, size);
+    else
+        memcpy (window, chunk->output->data + size - 32768, 32768);
+    inflateReset (&dec->stream);
+    inflateSetDictionary (&dec->stream, window, keep + MIN (size, 32768));
+    if (bits)
+        inflatePrime (&dec->stream, 8 - bits, chunk->data[byte] >> bits);
+    dec->at_boundary = TRUE;
+    dec->boundary_bits = bits ? 8 - bits : 0;
+    dec->last_byte = chunk->data[byte];
+    dec->more_output = FALSE;
+    *fed = byte + (bits ? 1 : 0);
 
-    gboolean ready;
-    z_stream stream;
-    guint64 offset;
-};
+    if (size)
+    {
+        out = gst_buffer_new_wrapped (g_byte_array_free (chunk->output, FALSE),
+                size);
+        chunk->output = NULL;
+        GST_BUFFER_OFFSET (out) = dec->offset;
+        flow = gst_gzdec_push_decoded (dec, out);
+        if (flow == GST_FLOW_OK)
+            dec->offset += size;
+    }
+    return flow;
+}
 
-struct _GstGzdecClass
+    static GstFlowReturn
+gst_gzdec_spec_search_job (gpointer user_data, gpointer data)
 {
-    GstElementClass parent_class;
-};
+    gst_gz_spec_find_start ((GstGzSpecChunk *) data);
+    return GST_FLOW_OK;
+}
 
-#if GST_CHECK_VERSION(1,0,0)
-#define gst_gzdec_parent_class parent_class
-G_DEFINE_TYPE (GstGzdec, gst_gzdec, GST_TYPE_ELEMENT);
-#else
-GST_BOILERPLATE (GstGzdec, gst_gzdec, GstElement, GST_TYPE_ELEMENT);
-#endif
+    static GstFlowReturn
+gst_gzdec_spec_decode_job (gpointer user_data, gpointer data)
+{
+    gst_gz_spec_decode ((GstGzSpecChunk *) data);
+    return GST_FLOW_OK;
+}
 
-    static void
-gst_gzdec_decompress_end (GstGzdec * dec)
+/* Decode the input in parallel: it is pulled a batch at a time, one chunk
+ * per pool thread. The first chunk is left to the sequential decoder, a
+ * block start is searched in each of the others and they are inflated
+ * speculatively up to the start of the next one. Meanwhile the sequential
+ * decoder runs up to the start of each chunk: when it stops at a block boundary
+ * right there, the chunk output is resolved with its window and pushed and
+ * the decoder jumps to the end of the chunk. Otherwise the chunk is dropped
+ * and the sequential decoder goes through it. */
+    static GstFlowReturn
+gst_gzdec_decode_batch (GstGzdec * dec, GstBuffer * in, const guint8 * base,
+        gsize size)
 {
-    g_return_if_fail (GST_IS_GZDEC (dec));
+    GstFlowReturn flow = GST_FLOW_OK;
+    gsize chunk_size = dec->parallel_chunk_size, fed = 0;
+    GstGzSpecChunk *chunks;
+    guint8 window[32768];
+    guint i, n, next;
 
-    if (dec->ready)
+    n = MIN (dec->n_spec_clients, (size + chunk_size - 1) / chunk_size);
+    chunks = g_new0 (GstGzSpecChunk, n);
+    for (i = 1; i < n; i++)
     {
-        GST_DEBUG_OBJECT (dec, "Finalize gzdec decompressing feature");
-        (void)inflateEnd(&dec->stream);
-        memset (&dec->stream, 0, sizeof (dec->stream));
-        dec->ready = FALSE;
+        chunks[i].data = base;
+        chunks[i].size = size;
+        chunks[i].search_from = (guint64) i * chunk_size * 8;
+        chunks[i].search_to = (guint64) MIN ((i + 1) * chunk_size, size) * 8;
+        gst_gz_pool_client_push (dec->spec_clients[i],
+                gst_gzdec_spec_search_job, &chunks[i], NULL);
     }
-}
+    /* The first chunk is decoded while the others are searched, the block
+     * starts found are all past it */
+    flow = gst_gzdec_feed (dec, in, base, &fed, MIN (chunk_size, size));
+    for (i = 1; i < n; i++)
+        gst_gz_pool_client_wait (dec->spec_clients[i]);
 
-    static void
-gst_gzdec_decompress_init (GstGzdec * dec)
-{
-    GST_DEBUG_OBJECT (dec, "Initialize gzdec decompressing feature");
-    g_return_if_fail (GST_IS_GZDEC (dec));
-    gst_gzdec_decompress_end (dec);
+    for (i = 1; i < n && flow == GST_FLOW_OK; i = next)
+    {
+        for (next = i + 1; next < n; next++)
+            if (chunks[next].start != G_MAXUINT64)
+                break;
+        if (chunks[i].start == G_MAXUINT64)
+            continue;
+        chunks[i].stop = next < n ? chunks[next].start : G_MAXUINT64;
+        chunks[i].max_output = chunk_size * MAX_SPEC_EXPANSION;
+        gst_gz_pool_client_push (dec->spec_clients[i],
+                gst_gzdec_spec_decode_job, &chunks[i], NULL);
+    }
 
-    /* Initialise zlib default values for inflateInit() */
-    dec->stream.zalloc = Z_NULL;
-    dec->stream.zfree = Z_NULL;
-    dec->stream.opaque = Z_NULL;
-    dec->stream.avail_in = 0;
-    dec->stream.next_in = Z_NULL;
+    for (i = 1; i < n && flow == GST_FLOW_OK; i++)
+    {
+        GstGzSpecChunk *chunk = &chunks[i];
+        uInt window_size = 0;
 
-    dec->offset = 0;
+        if (chunk->start == G_MAXUINT64)
+            continue;
+        /* The sequential decoder catches up while the chunk is inflated */
+        if ((guint64) fed * 8 < chunk->start)
+            flow = gst_gzdec_feed (dec, in, base, &fed, (chunk->start + 7) / 8);
+        if (flow != GST_FLOW_OK)
+            break;
+        gst_gz_pool_client_wait (dec->spec_clients[i]);
+        if (chunk->end <= chunk->start)
+            continue;
+        if (dec->state != GZDEC_STATE_DEFLATE || !dec->at_boundary
+                || (guint64) fed * 8 - dec->boundary_bits != chunk->start)
+        {
+            GST_DEBUG_OBJECT (dec, "Chunk %u at bit %" G_GUINT64_FORMAT
+                    " does not follow, decoding it sequentially", i,
+                    chunk->start);
+            continue;
+        }
+        inflateGetDictionary (&dec->stream, window, &window_size);
+        if (!gst_gz_spec_resolve (chunk, window, window_size))
+        {
+            GST_DEBUG_OBJECT (dec, "Chunk %u refers to data before the "
+                    "stream start", i);
+            continue;
+        }
+        GST_LOG_OBJECT (dec, "Chunk %u: %u bytes", i, chunk->output->len);
+        flow = gst_gzdec_spec_inject (dec, chunk, window, window_size, &fed);
+    }
+    if (flow == GST_FLOW_OK)
+        flow = gst_gzdec_feed (dec, in, base, &fed, size);
 
-    switch (inflateInit2 (&dec->stream, MAX_WBITS|32))
+    /* The jobs still use the chunks after an error */
+    for (i = 1; i < n; i++)
     {
-        case Z_OK:
-            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_OK");
-            dec->ready = TRUE;
-            return;
-            /* Handle initialisation errors */
-        case Z_MEM_ERROR:
-            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_MEM_ERROR");
-            break;
-        case Z_VERSION_ERROR:
-            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_VERSION_ERROR");
-            break;
-        case Z_STREAM_ERROR:
-            GST_DEBUG_OBJECT (dec, "inflateInit2() return Z_STREAM_ERROR");
-            break;
-        default:
-            GST_DEBUG_OBJECT (dec, "inflateInit2() return unknown error");
-            break;
+        gst_gz_pool_client_wait (dec->spec_clients[i]);
+        gst_gz_spec_chunk_clear (&chunks[i]);
     }
-    dec->ready = FALSE;
-    GST_ELEMENT_ERROR (dec, CORE, FAILED, (NULL), 
-            ("Failed to start decompression."));
-    return;
+    g_free (chunks);
+    return flow;
 }
 
-static GstFlowReturn
-#if GST_CHECK_VERSION(1,0,0)
-gst_gzdec_chain (GstPad * pad, GstObject * parent, GstBuffer * in)
-#else
-gst_gzdec_chain (GstPad * pad, GstBuffer * in)
-#endif
+/* Pull mode for inputs too big to be decoded at once, with
+ * parallel-chunk-size set */
+    static void
+gst_gzdec_parallel_loop (GstPad * pad)
 {
-    GstFlowReturn flow = GST_FLOW_OK;
-    GstBuffer *out;
-    GstGzdec *dec;
-    int ret = Z_OK;
-#if GST_CHECK_VERSION(1,0,0)
-    GstMapInfo inmap = GST_MAP_INFO_INIT, outmap;
+    GstGzdec *dec = GST_GZDEC (GST_PAD_PARENT (pad));
+    GstFlowReturn flow;
+    GstBuffer *in = NULL;
+    GstMapInfo inmap;
+    guint64 size;
+    guint i;
 
-    dec = GST_GZDEC (parent);
-#else
-    dec = GST_GZDEC (GST_PAD_PARENT (pad));
-#endif
-    if (!dec->ready)
+    if (!dec->spec_clients)
     {
-        /* Don't go further if not ready */
-        GST_ELEMENT_ERROR (dec, LIBRARY, FAILED, (NULL), 
-                ("Decompressor not ready."));
-#if GST_CHECK_VERSION(1,0,0)
-        flow = GST_FLOW_FLUSHING;
-#else
-        flow = GST_FLOW_WRONG_STATE;
-#endif
+        dec->n_spec_clients = MAX (gst_gz_pool_get_n_threads (), 1);
+        dec->spec_clients = g_new0 (GstGzPoolClient *, dec->n_spec_clients);
+        for (i = 0; i < dec->n_spec_clients; i++)
+            dec->spec_clients[i] = gst_gz_pool_client_new (dec, 1);
+    }
+    if (!dec->pull_offset)
+        gst_gzdec_start_pull (dec);
+
+    size = MIN ((guint64) dec->n_spec_clients * dec->parallel_chunk_size,
+            dec->input_size - dec->pull_offset);
+    if (!size)
+    {
+        flow = GST_FLOW_EOS;
+        goto pause;
+    }
+    flow = gst_pad_pull_range (pad, dec->pull_offset, size, &in);
+    if (flow != GST_FLOW_OK)
+        goto pause;
+    size = gst_buffer_get_size (in);
+    dec->pull_offset += size;
+
+    if (gst_gzdec_check_passthrough (dec, in))
+    {
+        if (dec->max_output_bytes && dec->offset + size > dec->max_output_bytes)
+        {
+            gst_buffer_unref (in);
+            flow = gst_gzdec_limit_exceeded (dec);
+            goto pause;
+        }
+        flow = gst_gzdec_push (dec, in);
+        if (flow == GST_FLOW_OK)
+            dec->offset += size;
     }
     else
     {
-#if GST_CHECK_VERSION(1,0,0)
-        /* Mapping the input buffer */
         gst_buffer_map (in, &inmap, GST_MAP_READ);
-        dec->stream.next_in = (z_const Bytef *) inmap.data;
-        dec->stream.avail_in = inmap.size;
-        GST_DEBUG_OBJECT (dec, "Input buffer size : dec->stream.avail_in = %d", dec->stream.avail_in);
-#else
-        dec->stream.next_in = (void *) GST_BUFFER_DATA (in);
-        dec->stream.avail_in = GST_BUFFER_SIZE (in);
+        dec->input_bytes += inmap.size;
+        flow = gst_gzdec_decode_batch (dec, in, inmap.data, inmap.size);
+        gst_buffer_unmap (in, &inmap);
+        gst_buffer_unref (in);
+    }
+    if (flow == GST_FLOW_OK && !size)
+        flow = GST_FLOW_EOS;
+    if (flow == GST_FLOW_OK)
+        return;
+
+pause:
+    gst_gzdec_pause (dec, pad, flow);
+}
 #endif
-        do
-        {
-            guint have;
-#if GST_CHECK_VERSION(1,0,0)
-            /* Create and map the output buffer */
-            out = gst_buffer_new_and_alloc (dec->offset ? dec->buffer_size : dec->first_buffer_size);
-            gst_buffer_map (out, &outmap, GST_MAP_WRITE);
-            dec->stream.next_out = (Bytef *) outmap.data;
-            dec->stream.avail_out = outmap.size;
 
-            /* Try to decode */
-            gst_buffer_unmap (out, &outmap);
-#else
-            /* Create the output buffer */
-            flow = gst_pad_alloc_buffer (dec->src, dec->offset,
-                    dec->offset ? dec->buffer_size : dec->first_buffer_size,
-                    GST_PAD_CAPS (dec->src), &out);
-
-            if (flow != GST_FLOW_OK) {
-                GST_DEBUG_OBJECT (dec, "pad alloc failed: %s", gst_flow_get_name (flow));
-                gst_gzdec_decompress_init (dec);
-                break;
-            }
+/* Use pull mode for seekable inputs small enough to be decoded at once */
+    static gboolean
+gst_gzdec_sink_activate (GstPad * pad, GstObject * parent)
+{
+    GstGzdec *dec = GST_GZDEC (parent);
+    GstQuery *query;
+    gboolean pull_mode = FALSE;
+    gint64 size = -1;
 
-            /* Decode */
-            dec->stream.next_out = (void *) GST_BUFFER_DATA (out);
-            dec->stream.avail_out = GST_BUFFER_SIZE (out);
+    if (dec->whole_file_max_size || dec->parallel_chunk_size)
+    {
+        query = gst_query_new_scheduling ();
+        if (gst_pad_peer_query (pad, query))
+            pull_mode = gst_query_has_scheduling_mode_with_flags (query,
+                    GST_PAD_MODE_PULL, GST_SCHEDULING_FLAG_SEEKABLE);
+        gst_query_unref (query);
+    }
+
+    if (pull_mode && gst_pad_activate_mode (pad, GST_PAD_MODE_PULL, TRUE))
+    {
+        if (gst_pad_peer_query_duration (pad, GST_FORMAT_BYTES, &size)
+                && size >= 4 && size <= dec->whole_file_max_size)
+        {
+            GST_DEBUG_OBJECT (dec, "Decoding whole file of %" G_GINT64_FORMAT
+                    " bytes", size);
+            dec->input_size = size;
+            return gst_pad_start_task (pad, (GstTaskFunction) gst_gzdec_loop,
+                    pad, NULL);
+        }
+#ifdef HAVE_ZERO_COPY_STORED
+        if (dec->parallel_chunk_size && size > 0)
+        {
+            GST_DEBUG_OBJECT (dec, "Decoding %" G_GINT64_FORMAT " bytes in "
+                    "parallel", size);
+            dec->input_size = size;
+            dec->pull_offset = 0;
+            return gst_pad_start_task (pad,
+                    (GstTaskFunction) gst_gzdec_parallel_loop, pad, NULL);
+        }
 #endif
-            ret = inflate (&dec->stream, Z_NO_FLUSH);
-            switch (ret)
-            {
-                case Z_OK:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_OK [%s]",dec->stream.msg);
-                    break;
-                case Z_STREAM_END:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_STREAM_END [%s]",dec->stream.msg);
-                    break;
-                case Z_NEED_DICT:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_NEED_DICT [%s]",dec->stream.msg);
-                    break;
-                    /* Errors */
-                case Z_ERRNO:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_ERRNO [%s]",dec->stream.msg);
-                    break;
-                case Z_STREAM_ERROR:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_STREAM_ERROR [%s]",dec->stream.msg);
-                    break;
-                case Z_DATA_ERROR:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_DATA_ERROR [%s]",dec->stream.msg);
-                    break;
-                case Z_MEM_ERROR:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_MEM_ERROR [%s]",dec->stream.msg);
-                    break;
-                case Z_BUF_ERROR:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_BUF_ERROR [%s]",dec->stream.msg);
-                    break;
-                case Z_VERSION_ERROR:
-                    GST_DEBUG_OBJECT (dec, "inflate() return Z_VERSION_ERROR [%s]",dec->stream.msg);
-                default:
-                    GST_DEBUG_OBJECT (dec, "inflate() return unknow code (%d) [%s]", ret, dec->stream.msg);
-                    break;
-            }
+        gst_pad_activate_mode (pad, GST_PAD_MODE_PULL, FALSE);
+    }
+    GST_DEBUG_OBJECT (dec, "Activating in push mode");
+    return gst_pad_activate_mode (pad, GST_PAD_MODE_PUSH, TRUE);
+}
+
+    static gboolean
+gst_gzdec_sink_activate_mode (GstPad * pad, GstObject * parent,
+        GstPadMode mode, gboolean active)
+{
+    switch (mode)
+    {
+        case GST_PAD_MODE_PUSH:
+            return TRUE;
+        case GST_PAD_MODE_PULL:
+            /* The task is started by gst_gzdec_sink_activate() */
+            if (!active)
+                return gst_pad_stop_task (pad);
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
 
-            if (ret == Z_STREAM_ERROR)
+/* The output thread is the src pad task, it runs while the pad is active */
+    static gboolean
+gst_gzdec_src_activate_mode (GstPad * pad, GstObject * parent,
+        GstPadMode mode, gboolean active)
+{
+    GstGzdec *dec = GST_GZDEC (parent);
+
+    if (mode != GST_PAD_MODE_PUSH)
+        return FALSE;
+    if (!active)
+    {
+        gst_gzdec_set_output_flushing (dec, TRUE);
+        return gst_pad_stop_task (pad);
+    }
+    /* The pool jobs never push, the output thread does */
+    dec->use_pool = dec->worker_pool;
+    dec->output_thread = dec->output_queue_buffers > 0 || dec->use_pool;
+    if (!dec->output_thread)
+        return TRUE;
+    dec->output_max_buffers = dec->output_queue_buffers ?
+        dec->output_queue_buffers : POOL_OUTPUT_BUFFERS;
+    GST_DEBUG_OBJECT (dec, "Starting output thread, %u buffers, %"
+            G_GUINT64_FORMAT " bytes", dec->output_max_buffers,
+            dec->output_queue_bytes);
+    gst_gzdec_set_output_flushing (dec, FALSE);
+    return gst_pad_start_task (pad, (GstTaskFunction) gst_gzdec_output_loop,
+            pad, NULL);
+}
+
+/* Positions and durations are reported in uncompressed bytes */
+    static gboolean
+gst_gzdec_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+    GstGzdec *dec = GST_GZDEC (parent);
+    GstCaps *caps, *allowed;
+
+    switch (GST_QUERY_TYPE (query))
+    {
+        case GST_QUERY_CAPS:
+            gst_query_parse_caps (query, &caps);
+            allowed = gst_gzdec_get_sink_caps (dec);
+            if (caps)
             {
-                GST_ELEMENT_ERROR (dec, STREAM, DECODE, (NULL),
-                        ("Failed to decompress data (error code %i).", ret));
-                gst_gzdec_decompress_init (dec);
-                gst_buffer_unref (out);
-                flow = GST_FLOW_ERROR;
-                break;
-            }
-#if GST_CHECK_VERSION(1,0,0)
-            if (dec->stream.avail_out >= gst_buffer_get_size (out))
-#else
-                if (dec->stream.avail_out >= GST_BUFFER_SIZE (out))
-#endif
-                {
-                    gst_buffer_unref (out);
-                    break;
-                }
-#if GST_CHECK_VERSION(1,0,0)
-            /* Resize the output buffer */
-            gst_buffer_resize (out, 0, gst_buffer_get_size (out) - dec->stream.avail_out);
-            GST_BUFFER_OFFSET (out) = dec->stream.total_out - gst_buffer_get_size (out);
-#else
-            GST_BUFFER_SIZE (out) -= dec->stream.avail_out;
-            GST_BUFFER_OFFSET (out) = dec->stream.total_out - GST_BUFFER_SIZE (out);
-#endif
-            /* Configure source pad (if necessary) */
-            if (!dec->offset) {
-                GstCaps *caps = NULL;
+                GstCaps *tmp = gst_caps_intersect_full (caps, allowed,
+                        GST_CAPS_INTERSECT_FIRST);
 
-                caps = gst_type_find_helper_for_buffer (GST_OBJECT (dec), out, NULL);
-                if (caps) {
-#if !GST_CHECK_VERSION(1,0,0)
-                    gst_buffer_set_caps (out, caps);
-#endif
-                    gst_pad_set_caps (dec->src, caps);
-                    gst_pad_use_fixed_caps (dec->src);
-                    gst_caps_unref (caps);
-                } else {
-                    GST_FIXME_OBJECT (dec, "shouldn't we queue output buffers until we have a type?");
-                }
+                gst_caps_unref (allowed);
+                allowed = tmp;
             }
+            gst_query_set_caps_result (query, allowed);
+            gst_caps_unref (allowed);
+            return TRUE;
+        case GST_QUERY_ACCEPT_CAPS:
+            gst_query_parse_accept_caps (query, &caps);
+            allowed = gst_gzdec_get_sink_caps (dec);
+            gst_query_set_accept_caps_result (query,
+                    gst_caps_can_intersect (caps, allowed));
+            gst_caps_unref (allowed);
+            return TRUE;
+        default:
+            break;
+    }
+    return gst_pad_query_default (pad, parent, query);
+}
 
-            /* Push data */
-            GST_DEBUG_OBJECT (dec, "Push data on src pad");
-#if GST_CHECK_VERSION(1,0,0)
-            have = gst_buffer_get_size (out);
-#else
-            have = GST_BUFFER_SIZE (out);
-#endif
-            flow = gst_pad_push (dec->src, out);
-            if (flow != GST_FLOW_OK)
-            {
+    static gboolean
+gst_gzdec_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+    GstGzdec *dec = GST_GZDEC (parent);
+    GstFormat format;
+
+    switch (GST_QUERY_TYPE (query))
+    {
+        case GST_QUERY_POSITION:
+            gst_query_parse_position (query, &format, NULL);
+            if (format != GST_FORMAT_BYTES)
+                break;
+            gst_query_set_position (query, GST_FORMAT_BYTES, dec->offset);
+            return TRUE;
+        case GST_QUERY_DURATION:
+            gst_query_parse_duration (query, &format, NULL);
+            if (format != GST_FORMAT_BYTES)
+                break;
+            /* Upstream only knows the compressed size */
+            if (dec->passthrough && !dec->isize)
                 break;
-            } 
-            dec->offset += have;
-        } while (ret != Z_STREAM_END);
+            if (!dec->isize)
+                return FALSE;
+            gst_query_set_duration (query, GST_FORMAT_BYTES, dec->isize);
+            return TRUE;
+        default:
+            break;
     }
-
-#if GST_CHECK_VERSION(1,0,0)
-    gst_buffer_unmap (in, &inmap);
-#endif
-    gst_buffer_unref (in);
-    return flow; 
+    return gst_pad_query_default (pad, parent, query);
 }
+#endif
 
 static void
 #if GST_CHECK_VERSION(1,0,0)
@@ -334,12 +2742,70 @@ gst_gzdec_init (GstGzdec * dec, GstGzdecClass * klass)
     GST_DEBUG_OBJECT (dec, "Initialize gzdec");
     dec->first_buffer_size = DEFAULT_FIRST_BUFFER_SIZE;
     dec->buffer_size = DEFAULT_BUFFER_SIZE;
+    dec->whole_file_max_size = DEFAULT_WHOLE_FILE_MAX_SIZE;
+    dec->worker_pool = DEFAULT_WORKER_POOL;
+    dec->auto_passthrough = DEFAULT_AUTO_PASSTHROUGH;
+    dec->max_ratio = DEFAULT_MAX_RATIO;
+    dec->max_output_bytes = DEFAULT_MAX_OUTPUT_BYTES;
+    dec->max_output_rate = DEFAULT_MAX_OUTPUT_RATE;
+    dec->parallel_chunk_size = DEFAULT_PARALLEL_CHUNK_SIZE;
+    dec->format = DEFAULT_FORMAT;
+    dec->spec_clients = NULL;
+    dec->n_spec_clients = 0;
+    g_mutex_init (&dec->throttle_lock);
+    g_cond_init (&dec->throttle_cond);
+    g_mutex_init (&dec->verify_lock);
+    g_cond_init (&dec->verify_cond);
+    dec->output_queue_buffers = DEFAULT_OUTPUT_QUEUE_BUFFERS;
+    dec->output_queue_bytes = DEFAULT_OUTPUT_QUEUE_BYTES;
+    g_queue_init (&dec->output_queue);
+    g_mutex_init (&dec->output_lock);
+    g_cond_init (&dec->output_cond);
+    dec->throttle_flushing = FALSE;
+    dec->sink_caps = NULL;
+    dec->pool_client = gst_gz_pool_client_new (dec, MAX_POOL_JOBS);
+    dec->verify = DEFAULT_VERIFY;
+    dec->verify_client = gst_gz_pool_client_new (dec, 1);
+    dec->min_input_size = DEFAULT_MIN_INPUT_SIZE;
+    dec->max_input_latency = DEFAULT_MAX_INPUT_LATENCY;
+    dec->input = gst_adapter_new ();
+    dec->input_start = 0;
+    dec->input_thread = NULL;
+    g_mutex_init (&dec->input_lock);
+    g_cond_init (&dec->input_cond);
+    dec->input_thread_stop = FALSE;
+    dec->input_flow = GST_FLOW_OK;
+    dec->have_caps = FALSE;
+    dec->pending = NULL;
+    dec->segment = NULL;
+    dec->input_size = 0;
+    dec->isize = 0;
+    dec->wrap = g_byte_array_new ();
 
     dec->sink = gst_pad_new_from_static_template (&sink_template, "sink");
     gst_pad_set_chain_function (dec->sink, GST_DEBUG_FUNCPTR (gst_gzdec_chain));
+    gst_pad_set_event_function (dec->sink, GST_DEBUG_FUNCPTR (gst_gzdec_event));
+#if GST_CHECK_VERSION(1,0,0)
+    gst_pad_set_chain_list_function (dec->sink,
+            GST_DEBUG_FUNCPTR (gst_gzdec_chain_list));
+    gst_pad_set_activate_function (dec->sink,
+            GST_DEBUG_FUNCPTR (gst_gzdec_sink_activate));
+    gst_pad_set_activatemode_function (dec->sink,
+            GST_DEBUG_FUNCPTR (gst_gzdec_sink_activate_mode));
+    gst_pad_set_query_function (dec->sink,
+            GST_DEBUG_FUNCPTR (gst_gzdec_sink_query));
+#else
+    gst_pad_set_setcaps_function (dec->sink, GST_DEBUG_FUNCPTR (gst_gzdec_sink_setcaps));
+    gst_pad_set_getcaps_function (dec->sink, GST_DEBUG_FUNCPTR (gst_gzdec_sink_getcaps));
+#endif
     gst_element_add_pad (GST_ELEMENT (dec), dec->sink);
 
     dec->src = gst_pad_new_from_static_template (&src_template, "src");
+#if GST_CHECK_VERSION(1,0,0)
+    gst_pad_set_query_function (dec->src, GST_DEBUG_FUNCPTR (gst_gzdec_src_query));
+    gst_pad_set_activatemode_function (dec->src,
+            GST_DEBUG_FUNCPTR (gst_gzdec_src_activate_mode));
+#endif
     gst_element_add_pad (GST_ELEMENT (dec), dec->src);
     gst_pad_use_fixed_caps (dec->src);
 
@@ -351,8 +2817,27 @@ gst_gzdec_finalize (GObject * object)
 {
 
     GstGzdec *dec = GST_GZDEC (object);
+    guint i;
+
     GST_DEBUG_OBJECT (dec, "Finalize gzdec");
+    gst_gz_pool_client_free (dec->pool_client);
+    gst_gz_pool_client_free (dec->verify_client);
     gst_gzdec_decompress_end (dec);
+    gst_gzdec_reset (dec);
+    g_byte_array_unref (dec->wrap);
+    gst_gzdec_stop_input_thread (dec);
+    g_object_unref (dec->input);
+    g_mutex_clear (&dec->input_lock);
+    g_cond_clear (&dec->input_cond);
+    for (i = 0; i < dec->n_spec_clients; i++)
+        gst_gz_pool_client_free (dec->spec_clients[i]);
+    g_free (dec->spec_clients);
+    g_mutex_clear (&dec->throttle_lock);
+    g_cond_clear (&dec->throttle_cond);
+    g_mutex_clear (&dec->verify_lock);
+    g_cond_clear (&dec->verify_cond);
+    g_mutex_clear (&dec->output_lock);
+    g_cond_clear (&dec->output_cond);
 
     G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -372,6 +2857,59 @@ gst_gzdec_get_property (GObject * object, guint prop_id,
             g_value_set_uint (value, dec->first_buffer_size);
             GST_DEBUG_OBJECT (dec, "Buffer size is : %d",dec->buffer_size);
             break;
+        case PROP_WHOLE_FILE_MAX_SIZE:
+            g_value_set_uint (value, dec->whole_file_max_size);
+            GST_DEBUG_OBJECT (dec, "Whole file max size is : %u",dec->whole_file_max_size);
+            break;
+        case PROP_WORKER_POOL:
+            g_value_set_boolean (value, dec->worker_pool);
+            GST_DEBUG_OBJECT (dec, "Worker pool is : %d",dec->worker_pool);
+            break;
+        case PROP_AUTO_PASSTHROUGH:
+            g_value_set_boolean (value, dec->auto_passthrough);
+            GST_DEBUG_OBJECT (dec, "Auto passthrough is : %d",dec->auto_passthrough);
+            break;
+        case PROP_MAX_RATIO:
+            g_value_set_uint (value, dec->max_ratio);
+            GST_DEBUG_OBJECT (dec, "Max ratio is : %u",dec->max_ratio);
+            break;
+        case PROP_MAX_OUTPUT_BYTES:
+            g_value_set_uint64 (value, dec->max_output_bytes);
+            GST_DEBUG_OBJECT (dec, "Max output bytes is : %" G_GUINT64_FORMAT,dec->max_output_bytes);
+            break;
+        case PROP_MAX_OUTPUT_RATE:
+            g_value_set_uint64 (value, dec->max_output_rate);
+            GST_DEBUG_OBJECT (dec, "Max output rate is : %" G_GUINT64_FORMAT,dec->max_output_rate);
+            break;
+        case PROP_PARALLEL_CHUNK_SIZE:
+            g_value_set_uint (value, dec->parallel_chunk_size);
+            GST_DEBUG_OBJECT (dec, "Parallel chunk size is : %u",dec->parallel_chunk_size);
+            break;
+        case PROP_FORMAT:
+            g_value_set_enum (value, dec->format);
+            GST_DEBUG_OBJECT (dec, "Format is : %d", dec->format);
+            break;
+        case PROP_OUTPUT_QUEUE_BUFFERS:
+            g_value_set_uint (value, dec->output_queue_buffers);
+            GST_DEBUG_OBJECT (dec, "Output queue buffers is : %u",dec->output_queue_buffers);
+            break;
+        case PROP_OUTPUT_QUEUE_BYTES:
+            g_value_set_uint64 (value, dec->output_queue_bytes);
+            GST_DEBUG_OBJECT (dec, "Output queue bytes is : %" G_GUINT64_FORMAT,dec->output_queue_bytes);
+            break;
+        case PROP_VERIFY:
+            g_value_set_enum (value, dec->verify);
+            GST_DEBUG_OBJECT (dec, "Verify is : %d", dec->verify);
+            break;
+        case PROP_MIN_INPUT_SIZE:
+            g_value_set_uint (value, dec->min_input_size);
+            GST_DEBUG_OBJECT (dec, "Min input size is : %u", dec->min_input_size);
+            break;
+        case PROP_MAX_INPUT_LATENCY:
+            g_value_set_uint64 (value, dec->max_input_latency);
+            GST_DEBUG_OBJECT (dec, "Max input latency is : %" GST_TIME_FORMAT,
+                    GST_TIME_ARGS (dec->max_input_latency));
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -392,6 +2930,61 @@ gst_gzdec_set_property (GObject * object, guint prop_id,
             dec->first_buffer_size = g_value_get_uint (value);
             GST_DEBUG_OBJECT (dec, "First buffer size set to : %d",dec->first_buffer_size);
             break;
+        case PROP_WHOLE_FILE_MAX_SIZE:
+            dec->whole_file_max_size = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (dec, "Whole file max size set to : %u",dec->whole_file_max_size);
+            break;
+        case PROP_WORKER_POOL:
+            /* Let the queued buffers go through before switching */
+            gst_gz_pool_client_wait (dec->pool_client);
+            dec->worker_pool = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (dec, "Worker pool set to : %d",dec->worker_pool);
+            break;
+        case PROP_AUTO_PASSTHROUGH:
+            dec->auto_passthrough = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (dec, "Auto passthrough set to : %d",dec->auto_passthrough);
+            break;
+        case PROP_MAX_RATIO:
+            dec->max_ratio = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (dec, "Max ratio set to : %u",dec->max_ratio);
+            break;
+        case PROP_MAX_OUTPUT_BYTES:
+            dec->max_output_bytes = g_value_get_uint64 (value);
+            GST_DEBUG_OBJECT (dec, "Max output bytes set to : %" G_GUINT64_FORMAT,dec->max_output_bytes);
+            break;
+        case PROP_MAX_OUTPUT_RATE:
+            dec->max_output_rate = g_value_get_uint64 (value);
+            GST_DEBUG_OBJECT (dec, "Max output rate set to : %" G_GUINT64_FORMAT,dec->max_output_rate);
+            break;
+        case PROP_PARALLEL_CHUNK_SIZE:
+            dec->parallel_chunk_size = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (dec, "Parallel chunk size set to : %u",dec->parallel_chunk_size);
+            break;
+        case PROP_FORMAT:
+            dec->format = g_value_get_enum (value);
+            GST_DEBUG_OBJECT (dec, "Format set to : %d", dec->format);
+            break;
+        case PROP_OUTPUT_QUEUE_BUFFERS:
+            dec->output_queue_buffers = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (dec, "Output queue buffers set to : %u",dec->output_queue_buffers);
+            break;
+        case PROP_OUTPUT_QUEUE_BYTES:
+            dec->output_queue_bytes = g_value_get_uint64 (value);
+            GST_DEBUG_OBJECT (dec, "Output queue bytes set to : %" G_GUINT64_FORMAT,dec->output_queue_bytes);
+            break;
+        case PROP_VERIFY:
+            dec->verify = g_value_get_enum (value);
+            GST_DEBUG_OBJECT (dec, "Verify set to : %d", dec->verify);
+            break;
+        case PROP_MIN_INPUT_SIZE:
+            dec->min_input_size = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (dec, "Min input size set to : %u", dec->min_input_size);
+            break;
+        case PROP_MAX_INPUT_LATENCY:
+            dec->max_input_latency = g_value_get_uint64 (value);
+            GST_DEBUG_OBJECT (dec, "Max input latency set to : %" GST_TIME_FORMAT,
+                    GST_TIME_ARGS (dec->max_input_latency));
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -403,13 +2996,30 @@ gst_gzdec_change_state (GstElement * element, GstStateChange transition)
     GstGzdec *dec = GST_GZDEC (element);
     GstStateChangeReturn ret;
     GST_DEBUG_OBJECT (dec, "Changing gzdec state");
+    /* A throttled streaming thread has to be woken up to be stopped */
+    if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+        gst_gzdec_set_throttle_flushing (dec, TRUE);
     ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
     if (ret != GST_STATE_CHANGE_SUCCESS)
+    {
+        if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+            gst_gzdec_set_throttle_flushing (dec, FALSE);
         return ret;
+    }
 
     switch (transition) {
         case GST_STATE_CHANGE_PAUSED_TO_READY:
+            /* Drop what is still queued on the worker pool */
+            gst_gz_pool_client_set_flushing (dec->pool_client, TRUE);
+            gst_gz_pool_client_set_flushing (dec->pool_client, FALSE);
+            gst_gz_pool_client_set_flushing (dec->verify_client, TRUE);
+            gst_gz_pool_client_set_flushing (dec->verify_client, FALSE);
+            gst_gzdec_stop_input_thread (dec);
+            gst_gzdec_clear_input (dec);
             gst_gzdec_decompress_init (dec);
+            gst_gzdec_reset (dec);
+            /* Only once nothing that throttles is running anymore */
+            gst_gzdec_set_throttle_flushing (dec, FALSE);
             break;
         default:
             break;
@@ -440,6 +3050,84 @@ gst_gzdec_class_init (GstGzdecClass * klass)
             g_param_spec_uint ("buffer-size", "Buffer size", "Buffer size",
                 1, G_MAXUINT, DEFAULT_BUFFER_SIZE,
                 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_WHOLE_FILE_MAX_SIZE, g_param_spec_uint ("whole-file-max-size",
+                "Whole file max size", "Seekable inputs up to this size are "
+                "read and decompressed in one go (0 = disabled, the default)", 0, G_MAXUINT,
+                DEFAULT_WHOLE_FILE_MAX_SIZE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_WORKER_POOL,
+            g_param_spec_boolean ("worker-pool", "Worker pool", "Decompress on "
+                "the process-wide worker pool shared by all gz elements instead "
+                "of the streaming thread (see GST_GZ_MAX_THREADS and "
+                "GST_GZ_CPU_AFFINITY)", DEFAULT_WORKER_POOL,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_AUTO_PASSTHROUGH, g_param_spec_boolean ("auto-passthrough",
+                "Auto passthrough", "Accept any input and push it unchanged "
+                "when it doesn't start with a gzip or zlib header",
+                DEFAULT_AUTO_PASSTHROUGH,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_MAX_RATIO,
+            g_param_spec_uint ("max-ratio", "Max ratio", "Post an error when "
+                "the output grows beyond this many times the input received "
+                "(0 = unlimited)", 0, G_MAXUINT, DEFAULT_MAX_RATIO,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_MAX_OUTPUT_BYTES, g_param_spec_uint64 ("max-output-bytes",
+                "Max output bytes", "Post an error when the output of a "
+                "stream grows beyond this size (0 = unlimited)", 0,
+                G_MAXUINT64, DEFAULT_MAX_OUTPUT_BYTES,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_MAX_OUTPUT_RATE, g_param_spec_uint64 ("max-output-rate",
+                "Max output rate", "Throttle the output to this many bytes "
+                "per second (0 = unlimited)", 0, G_MAXUINT64,
+                DEFAULT_MAX_OUTPUT_RATE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_PARALLEL_CHUNK_SIZE, g_param_spec_uint ("parallel-chunk-size",
+                "Parallel chunk size", "Seekable inputs bigger than "
+                "whole-file-max-size are split in chunks of this many "
+                "compressed bytes, decoded speculatively on the worker pool "
+                "(0 = disabled)", 0, G_MAXUINT, DEFAULT_PARALLEL_CHUNK_SIZE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_FORMAT,
+            g_param_spec_enum ("format", "Format", "Format of the input, raw "
+                "deflate data can't be detected", GST_TYPE_GZDEC_FORMAT,
+                DEFAULT_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_OUTPUT_QUEUE_BUFFERS, g_param_spec_uint ("output-queue-buffers",
+                "Output queue buffers", "Push the output from a separate "
+                "thread, queueing up to this many buffers while the next ones "
+                "are decompressed (0 = disabled, read when going to PAUSED)",
+                0, G_MAXUINT, DEFAULT_OUTPUT_QUEUE_BUFFERS,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_OUTPUT_QUEUE_BYTES, g_param_spec_uint64 ("output-queue-bytes",
+                "Output queue bytes", "Maximum number of bytes queued for the "
+                "output thread (0 = unlimited)", 0, G_MAXUINT64,
+                DEFAULT_OUTPUT_QUEUE_BYTES,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_VERIFY,
+            g_param_spec_enum ("verify", "Verify", "How the check value of "
+                "gzip and zlib members is verified, taken into account at the "
+                "next member", GST_TYPE_GZDEC_VERIFY, DEFAULT_VERIFY,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_MIN_INPUT_SIZE, g_param_spec_uint ("min-input-size",
+                "Min input size", "Accumulate smaller input buffers until "
+                "this many compressed bytes are received and decompress them "
+                "at once (0 = disabled)", 0, G_MAXUINT,
+                DEFAULT_MIN_INPUT_SIZE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass),
+            PROP_MAX_INPUT_LATENCY, g_param_spec_uint64 ("max-input-latency",
+                "Max input latency", "Decompress the accumulated input once it "
+                "has been held this long in nanoseconds, even below "
+                "min-input-size (0 = unlimited)", 0, G_MAXUINT64,
+                DEFAULT_MAX_INPUT_LATENCY,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 #if GST_CHECK_VERSION(1,0,0)
     gst_element_class_add_pad_template (gstelement_class,
             gst_static_pad_template_get (&sink_template));
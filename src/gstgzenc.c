@@ -45,6 +45,10 @@
 #include "config.h"
 #endif
 #include "gstgzenc.h"
+#include "gstgzarchive.h"
+#include "gstgzhash.h"
+#include "gstgzpool.h"
+#include "gstgzprobes.h"
 
 #include <zlib.h>
 #include <string.h>
@@ -63,6 +67,66 @@ GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS,
 #define DEFAULT_MEMORY_LEVEL 8
 #define DEFAULT_FORMAT 0
 #define DEFAULT_STRATEGY Z_DEFAULT_STRATEGY
+#define DEFAULT_WORKER_POOL FALSE
+#define DEFAULT_AUTO_STORE FALSE
+#define DEFAULT_RSYNCABLE FALSE
+#define DEFAULT_CHECKPOINT_INTERVAL 0
+#define DEFAULT_PER_BUFFER FALSE
+#define DEFAULT_CACHE_SIZE 0
+#define DEFAULT_ARCHIVE FALSE
+#define DEFAULT_ARCHIVE_ITERATIONS 15
+#define DEFAULT_BLOCK_SIZE 0
+#define DEFAULT_OUTPUT_ALIGNMENT 0
+#define DEFAULT_ALLOW_BYPASS FALSE
+#define DEFAULT_BYPASS_IF_BANDWIDTH_ABOVE 0
+
+/* The checkpoints carry the window of the compressor as dictionary so that
+ * the resumed stream keeps referencing the data before the checkpoint */
+#if ZLIB_VERNUM >= 0x1290
+#define HAVE_DEFLATE_GET_DICTIONARY 1
+#endif
+
+/* Auto store: a sample of the input is trial-compressed every PROBE_INTERVAL
+ * bytes, the data is stored when the sample does not shrink by at least
+ * 1 - PROBE_MAX_RATIO. */
+#define PROBE_INTERVAL (1024 * 1024)
+#define PROBE_SAMPLE_SIZE (8 * 1024)
+#define PROBE_MIN_SAMPLE_SIZE 1024
+#define PROBE_MAX_RATIO 0.97
+
+/* Auto strategy: Z_HUFFMAN_ONLY or Z_RLE are used when a sample compressed
+ * with them is at most AUTO_STRATEGY_TOLERANCE bigger than with the default
+ * strategy, they are several times faster */
+#define AUTO_STRATEGY_TOLERANCE 1.05
+
+/* Rsyncable: a rolling hash of the last RSYNC_BITS input bytes picks the
+ * points where the compressor is reset, once every 4 KiB on average */
+#define RSYNC_BITS 12
+#define RSYNC_MASK ((1U << RSYNC_BITS) - 1)
+#define RSYNC_HIT (RSYNC_MASK >> 1)
+
+/* Size of the buffers deflate() writes to, they are shrunk to the output
+ * before being pushed */
+#define OUTPUT_BUFFER_SIZE (32 * 1024)
+
+/* Bypass: the rate downstream takes the output at is measured over
+ * BYPASS_WINDOW microseconds before deciding to compress or not */
+#define BYPASS_WINDOW G_USEC_PER_SEC
+
+/* Largest payload of a stored deflate block */
+#define MAX_STORED_BLOCK_SIZE 65535
+
+/* Buffers queued on the worker pool before the chain function blocks */
+#define MAX_POOL_JOBS 4
+
+/* Output buffers queued by the worker pool jobs before the chain function
+ * blocks, the src pad task pushes them */
+#define POOL_OUTPUT_BUFFERS 16
+
+/* Archive mode: input compressed at a time by a job, and the window kept
+ * before the next chunk */
+#define ARCHIVE_CHUNK_SIZE (1024 * 1024)
+#define ARCHIVE_WINDOW_SIZE 32768
 
 enum
 {
@@ -70,14 +134,28 @@ enum
     PROP_COMPRESSION_LEVEL,
     PROP_MEMORY_LEVEL,
     PROP_STRATEGY,
-    PROP_FORMAT
+    PROP_FORMAT,
+    PROP_WORKER_POOL,
+    PROP_AUTO_STORE,
+    PROP_RSYNCABLE,
+    PROP_CHECKPOINT_INTERVAL,
+    PROP_RESUME_CHECKPOINT,
+    PROP_PER_BUFFER,
+    PROP_CACHE_SIZE,
+    PROP_CACHE_HIT_RATE,
+    PROP_ARCHIVE,
+    PROP_ARCHIVE_ITERATIONS,
+    PROP_BLOCK_SIZE,
+    PROP_OUTPUT_ALIGNMENT,
+    PROP_ALLOW_BYPASS,
+    PROP_BYPASS_IF_BANDWIDTH_ABOVE
 };
 
 /* The gzip format was designed to retain the directory information about a single file, such as the name and last modification date. The zlib format on the other hand was designed for in-memory and communication channel applications, and has a much more compact header and trailer and uses a faster integrity check than gzip. */
 typedef enum {
     GST_GZENC_GZIP,
-    GST_GZENC_ZLIB/*,
-                    GST_GZENC_DEFLATE*/ //TODO: support RFC 1951
+    GST_GZENC_ZLIB,
+    GST_GZENC_DEFLATE
 } GstGzencFormat;
 
 /* The strategy parameter is used to tune the compression algorithm. Use the value Z_DEFAULT_STRATEGY for normal data, Z_FILTERED for data produced by a filter (or predictor), Z_HUFFMAN_ONLY to force Huffman encoding only (no string match), or Z_RLE to limit match distances to one (run-length encoding). Filtered data consists mostly of small values with a somewhat random distribution. In this case, the compression algorithm is tuned to compress them better. The effect of Z_FILTERED is to force more Huffman coding and less string matching; it is somewhat intermediate between Z_DEFAULT_STRATEGY and Z_HUFFMAN_ONLY. Z_RLE is designed to be almost as fast as Z_HUFFMAN_ONLY, but give better compression for PNG image data. The strategy parameter only affects the compression ratio but not the correctness of the compressed output even if it is not set appropriately. Z_FIXED prevents the use of dynamic Huffman codes, allowing for a simpler decoder for special applications. */
@@ -86,9 +164,27 @@ typedef enum {
     GST_GZENC_FILTERED,
     GST_GZENC_HUFFMAN_ONLY,
     GST_GZENC_RLE,
-    GST_GZENC_FIXED
+    GST_GZENC_FIXED,
+    GST_GZENC_AUTO_STRATEGY
 } GstGzencStrategy;
 
+#if GST_CHECK_VERSION(1,0,0)
+/* Output of the worker pool jobs: buffers, buffer lists and serialized
+ * events waiting for the task of a src pad to push them, so that a blocked
+ * downstream never holds a thread of the pool */
+typedef struct
+{
+    GQueue queue;
+    guint queued_buffers;
+    GMutex lock;
+    GCond cond;
+    gboolean flushing;
+    /* Last error returned downstream, the buffers are dropped until the
+     * next flush */
+    GstFlowReturn flow;
+} GstGzencOutput;
+#endif
+
 struct _GstGzenc
 {
     GstElement parent;
@@ -101,17 +197,197 @@ struct _GstGzenc
     guint memory_level;
     GstGzencStrategy strategy;
     GstGzencFormat format;
+    gboolean worker_pool;
+    gboolean auto_store;
+    gboolean rsyncable;
+    guint64 checkpoint_interval;
+    GstStructure *resume;
+    gboolean per_buffer;
+    guint cache_size;
+    gboolean archive;
+    guint archive_iterations;
+    guint block_size;
+    guint output_alignment;
+    gboolean allow_bypass;
+    guint64 bypass_bandwidth;
 
     gboolean ready;
     z_stream stream;
     guint64 offset;
+
+    /* Caps received on the sink pad, advertised downstream as original-caps */
+    GstCaps *sink_caps;
+    gboolean renegotiate;
+#if GST_CHECK_VERSION(1,0,0)
+    /* Allocator proposed by downstream for the output buffers */
+    GstAllocator *allocator;
+    GstAllocationParams params;
+#endif
+
+    GstGzPoolClient *pool_client;
+#if GST_CHECK_VERSION(1,0,0)
+    /* worker-pool, latched when the src pad is activated */
+    gboolean use_pool;
+    GstGzencOutput output;
+    /* The src pad task asks the next job to query the bypass again */
+    gint requery_bypass;
+#endif
+
+#if GST_CHECK_VERSION(1,0,0)
+    /* Request src pads (GstGzencProfile), protected by the object lock */
+    GList *profiles;
+    guint next_profile;
+#endif
+
+    /* Bypass: the input is pushed unchanged with the sink caps. Downstream
+     * accepts them and lists them before the compressed caps */
+    gboolean bypass;
+    gboolean bypass_accepted;
+    gboolean bypass_preferred;
+    /* Output pushed since push_start and time spent in the pushes, in
+     * microseconds, for bypass-if-bandwidth-above */
+    gint64 push_start;
+    guint64 push_bytes;
+    gint64 push_time;
+
+    /* Auto store: level 1 deflate used for trial compression */
+    z_stream probe;
+    gboolean probe_ready;
+    guint8 *probe_out;
+    /* Input bytes left before the next probe */
+    gsize probe_countdown;
+    /* Level 0 is in use because the data looked incompressible */
+    gboolean storing;
+    /* zlib strategy picked by the auto strategy */
+    int auto_strategy;
+
+    /* Header, checksum and trailer written by gzenc itself, for level 0
+     * without deflate() (see gst_gzenc_store()) and resumable streams */
+    gboolean header_sent;
+    guint32 check;
+    guint64 stored_size;
+
+    /* Rsyncable: rolling hash of the input */
+    guint32 rsync_hash;
+
+    /* Block mode: every buffer pushed is block_size bytes but the last one
+     * of the stream. deflate() writes to the block being filled, which is
+     * kept mapped. */
+    gboolean block_mode;
+#if GST_CHECK_VERSION(1,0,0)
+    GstBuffer *block;
+    GstMapInfo block_map;
+    gsize block_fill;
+#endif
+
+    /* The stream can be resumed from the checkpoints, see
+     * gst_gzenc_checkpoint() */
+    gboolean resumable;
+    /* Input bytes left before the next checkpoint */
+    guint64 checkpoint_countdown;
+
+    /* Per-buffer mode: compressed buffers by hash of their input, most
+     * recently used first. The statistics are protected by the object lock */
+    GHashTable *cache;
+    GQueue cache_lru;
+    guint64 cache_lookups;
+    guint64 cache_hits;
+
+    /* Archive mode: input waiting to be compressed, after the window of
+     * the data before it, and one pool client per chunk compressed in
+     * parallel */
+    GByteArray *archive_data;
+    gsize archive_window;
+    GstGzPoolClient **archive_clients;
+    guint n_archive_clients;
 };
 
+/* Compressed output of an input buffer in per-buffer mode */
+typedef struct
+{
+    /* Hash of the input and of the parameters, see gst_gzenc_cache_key() */
+    guint64 key;
+    /* The input, compared on a hit as a hash can be forged. It shares the
+     * memories of the input buffer but not the buffer itself, which can go
+     * back to its pool. */
+    GstBuffer *in;
+    GstBuffer *out;
+} GstGzencCacheEntry;
+
 struct _GstGzencClass
 {
     GstElementClass parent_class;
 };
 
+#if GST_CHECK_VERSION(1,0,0)
+/* Request src pad compressing the input with a level, strategy and format
+ * of its own. It runs its own raw deflate stream on the worker pool, the
+ * header and the trailer are written by gzenc so that the checksum of each
+ * input buffer is computed once for all the profiles. */
+typedef struct
+{
+    GstPad parent;
+
+    /* Properties */
+    gint compression_level;
+    GstGzencStrategy strategy;
+    GstGzencFormat format;
+
+    GstGzPoolClient *client;
+    /* The jobs queue their output, the task of the pad pushes it */
+    GstGzencOutput output;
+    /* Caps last queued on the pad */
+    GstCaps *src_caps;
+
+    gboolean ready;
+    z_stream stream;
+    /* Format of the stream being written, latched when it starts */
+    GstGzencFormat stream_format;
+    guint32 check;
+    guint64 size;
+    guint64 offset;
+
+    /* Caps received on the sink pad, advertised as original-caps */
+    GstCaps *sink_caps;
+} GstGzencProfile;
+
+typedef struct
+{
+    GstPadClass parent_class;
+} GstGzencProfileClass;
+
+/* Input buffer shared by the profile jobs, mapped once. The checksums the
+ * profiles need are computed before the jobs are queued. */
+typedef struct
+{
+    gint ref_count;
+    GstBuffer *buffer;
+    GstMapInfo map;
+    gboolean have_crc;
+    guint32 crc;
+    gboolean have_adler;
+    guint32 adler;
+} GstGzencInput;
+
+enum
+{
+    PROP_PROFILE_0,
+    PROP_PROFILE_COMPRESSION_LEVEL,
+    PROP_PROFILE_STRATEGY,
+    PROP_PROFILE_FORMAT
+};
+
+#define GST_TYPE_GZENC_PROFILE (gst_gzenc_profile_get_type ())
+#define GST_GZENC_PROFILE(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_GZENC_PROFILE, GstGzencProfile))
+
+static GstStaticPadTemplate profile_template =
+GST_STATIC_PAD_TEMPLATE ("src_%u", GST_PAD_SRC, GST_PAD_REQUEST,
+        GST_STATIC_CAPS ("application/x-gzip"));
+
+G_DEFINE_TYPE (GstGzencProfile, gst_gzenc_profile, GST_TYPE_PAD);
+#endif
+
 #define GST_TYPE_GZENC_FORMAT (gst_gzenc_format_get_type ())
 
     static GType
@@ -123,7 +399,7 @@ gst_gzenc_format_get_type (void)
     {
         static GEnumValue format_types[] = {
             { GST_GZENC_ZLIB,  "RFC 1950 (zlib compressed format)", "zlib"},
-            //{ GST_GZENC_DEFLATE, "RFC 1951 (deflate compressed format)", "deflate"},
+            { GST_GZENC_DEFLATE, "RFC 1951 (raw deflate data, no header nor check)", "deflate"},
             { GST_GZENC_GZIP, "RFC 1952 (gzip compressed format)", "gzip"},
             { 0, NULL, NULL },
         };
@@ -149,6 +425,8 @@ gst_gzenc_strategy_get_type (void)
             { GST_GZENC_HUFFMAN_ONLY, "Huffman", "huffman"},
             { GST_GZENC_RLE, "RLE", "rle"},
             { GST_GZENC_FIXED, "Fixed", "fixed"},
+            { GST_GZENC_AUTO_STRATEGY, "Auto (from the caps and sampling)",
+                "auto"},
             { 0, NULL, NULL },
         };
 
@@ -178,11 +456,161 @@ gst_gzenc_compress_end (GstGzenc * enc)
     }
 }
 
+    static int
+gst_gzenc_zlib_strategy (GstGzencStrategy strategy, int auto_strategy)
+{
+    switch (strategy)
+    {
+        case GST_GZENC_FILTERED:
+            return Z_FILTERED;
+        case GST_GZENC_HUFFMAN_ONLY:
+            return Z_HUFFMAN_ONLY;
+        case GST_GZENC_RLE:
+            return Z_RLE;
+        case GST_GZENC_FIXED:
+            return Z_FIXED;
+        case GST_GZENC_AUTO_STRATEGY:
+            return auto_strategy;
+        case GST_GZENC_DEFAULT_STRATEGY:
+        default:
+            return Z_DEFAULT_STRATEGY;
+    }
+}
+
+/* First guess of the auto strategy, from the caps of the input */
+    static int
+gst_gzenc_caps_strategy (GstCaps * caps)
+{
+    const gchar *name;
+
+    if (!caps || gst_caps_is_any (caps) || gst_caps_is_empty (caps))
+        return Z_DEFAULT_STRATEGY;
+    name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+    /* Raw pictures are mostly runs of identical pixels */
+    if (g_str_has_prefix (name, "video/x-raw"))
+        return Z_RLE;
+    /* Raw samples hardly ever repeat, only the entropy coding pays */
+    if (g_str_has_prefix (name, "audio/x-raw"))
+        return Z_HUFFMAN_ONLY;
+    return Z_DEFAULT_STRATEGY;
+}
+
+    static const gchar *
+gst_gzenc_format_name (GstGzencFormat format)
+{
+    switch (format)
+    {
+        case GST_GZENC_ZLIB:
+            return "zlib";
+        case GST_GZENC_DEFLATE:
+            return "deflate";
+        default:
+            return "gzip";
+    }
+}
+
+    static gboolean
+gst_gzenc_structure_get_uint64 (const GstStructure * s, const gchar * name,
+        guint64 * value)
+{
+    const GValue *v = gst_structure_get_value (s, name);
+
+    if (!v || !G_VALUE_HOLDS_UINT64 (v))
+        return FALSE;
+    *value = g_value_get_uint64 (v);
+    return TRUE;
+}
+
+/* Restore the state saved in a checkpoint: the stream continues right
+ * after the data that was compressed before it, in the same member */
+    static gboolean
+gst_gzenc_resume (GstGzenc * enc)
+{
+    const GstStructure *s = enc->resume;
+    const gchar *format;
+    const GValue *v;
+    guint64 offset, size;
+    guint check;
+
+    format = gst_structure_get_string (s, "format");
+    if (!gst_structure_has_name (s, "gzenc-checkpoint") || !format
+            || strcmp (format, gst_gzenc_format_name (enc->format))
+            || !gst_gzenc_structure_get_uint64 (s, "offset", &offset)
+            || !gst_gzenc_structure_get_uint64 (s, "size", &size)
+            || !gst_structure_get_uint (s, "check", &check))
+    {
+        GST_WARNING_OBJECT (enc, "Invalid checkpoint %" GST_PTR_FORMAT, s);
+        return FALSE;
+    }
+
+    v = gst_structure_get_value (s, "dictionary");
+    if (v && GST_VALUE_HOLDS_BUFFER (v))
+    {
+        GstBuffer *dict = gst_value_get_buffer (v);
+        int ret;
+#if GST_CHECK_VERSION(1,0,0)
+        GstMapInfo map;
+
+        gst_buffer_map (dict, &map, GST_MAP_READ);
+        ret = deflateSetDictionary (&enc->stream, map.data, map.size);
+        gst_buffer_unmap (dict, &map);
+#else
+        ret = deflateSetDictionary (&enc->stream, GST_BUFFER_DATA (dict),
+                GST_BUFFER_SIZE (dict));
+#endif
+        if (ret != Z_OK)
+        {
+            GST_WARNING_OBJECT (enc, "deflateSetDictionary() return %d", ret);
+            return FALSE;
+        }
+    }
+
+    GST_DEBUG_OBJECT (enc, "Resuming at offset %" G_GUINT64_FORMAT
+            " after %" G_GUINT64_FORMAT " bytes", offset, size);
+    enc->header_sent = TRUE;
+    enc->offset = offset;
+    enc->stored_size = size;
+    enc->check = check;
+    return TRUE;
+}
+
+/* Per-buffer mode is not available with GStreamer 0.10 */
+    static gboolean
+gst_gzenc_per_buffer (GstGzenc * enc)
+{
+#if GST_CHECK_VERSION(1,0,0)
+    return enc->per_buffer;
+#else
+    return FALSE;
+#endif
+}
+
+/* Archive mode is not used in per-buffer mode */
+    static gboolean
+gst_gzenc_archive (GstGzenc * enc)
+{
+    return enc->archive && !gst_gzenc_per_buffer (enc);
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+    static void
+gst_gzenc_block_clear (GstGzenc * enc)
+{
+    if (!enc->block)
+        return;
+    gst_buffer_unmap (enc->block, &enc->block_map);
+    gst_buffer_unref (enc->block);
+    enc->block = NULL;
+    enc->block_fill = 0;
+}
+#endif
+
     static void
 gst_gzenc_compress_init (GstGzenc * enc)
 {
     GST_DEBUG_OBJECT (enc, "Initialize gzenc compressing feature");
     g_return_if_fail (GST_IS_GZENC (enc));
+    GST_GZ_PROBE_REINIT (enc);
     gst_gzenc_compress_end (enc);
 
     /* Initialise zlib default values for deflateInit() */
@@ -194,48 +622,63 @@ gst_gzenc_compress_init (GstGzenc * enc)
 
     enc->offset = 0;
 
+    enc->storing = FALSE;
+    enc->auto_strategy = gst_gzenc_caps_strategy (enc->sink_caps);
+    enc->probe_countdown = 0;
+    enc->header_sent = FALSE;
+    enc->check = enc->format == GST_GZENC_ZLIB ? adler32 (0L, Z_NULL, 0) :
+        crc32 (0L, Z_NULL, 0);
+    enc->stored_size = 0;
+    enc->rsync_hash = 0;
+    /* Each buffer is a stream of its own in per-buffer mode, the archive
+     * mode doesn't use deflate() */
+    enc->resumable = (enc->checkpoint_interval || enc->resume)
+        && !gst_gzenc_per_buffer (enc) && !gst_gzenc_archive (enc);
+    enc->checkpoint_countdown = enc->checkpoint_interval;
+    g_byte_array_set_size (enc->archive_data, 0);
+    enc->archive_window = 0;
+#if GST_CHECK_VERSION(1,0,0)
+    /* Per-buffer output is one buffer per input buffer */
+    gst_gzenc_block_clear (enc);
+    enc->block_mode = enc->block_size && !enc->per_buffer;
+#else
+    /* Block mode is not available with GStreamer 0.10 */
+    enc->block_mode = FALSE;
+#endif
+
     int windowBits, strategy;
     int ret = Z_OK;
 
-    switch (enc->strategy)
-    {
-        case GST_GZENC_DEFAULT_STRATEGY:
-            strategy = Z_DEFAULT_STRATEGY;
-            break;
-        case GST_GZENC_FILTERED:
-            strategy = Z_FILTERED;
-            break;
-        case GST_GZENC_HUFFMAN_ONLY:
-            strategy = Z_HUFFMAN_ONLY;
-            break;
-        case GST_GZENC_RLE:
-            strategy = Z_RLE;
-            break;
-        case GST_GZENC_FIXED:
-            strategy = Z_FIXED;
-            break;
-        default:
-            strategy = Z_DEFAULT_STRATEGY;
-            break;
-    }
+    strategy = gst_gzenc_zlib_strategy (enc->strategy, enc->auto_strategy);
 
     switch (enc->format)
     {
         case GST_GZENC_GZIP:
             windowBits = MAX_WBITS|16;
-            ret = deflateInit2 (&enc->stream, enc->compression_level, 
-                    Z_DEFLATED, windowBits, enc->memory_level, strategy );
             GST_DEBUG_OBJECT (enc, "Initialize gzenc for gzip");
             break;
         case GST_GZENC_ZLIB:
-            ret = deflateInit (&enc->stream, strategy);
+            windowBits = MAX_WBITS;
             GST_DEBUG_OBJECT (enc, "Initialize gzenc for zlib");
             break;
-            /*		case GST_GZENC_DEFLATE:
-                        windowBits = -MAX_WBITS;
-                        break;*/
+        case GST_GZENC_DEFLATE:
+            windowBits = -MAX_WBITS;
+            GST_DEBUG_OBJECT (enc, "Initialize gzenc for raw deflate");
+            break;
         default:
             GST_DEBUG_OBJECT (enc, "Unknown format");
+            windowBits = MAX_WBITS;
+    }
+    /* Resumable streams are framed by gzenc, deflate() only writes the
+     * deflate data */
+    if (enc->resumable)
+        windowBits = -MAX_WBITS;
+    ret = deflateInit2 (&enc->stream, enc->compression_level, Z_DEFLATED,
+            windowBits, enc->memory_level, strategy);
+    if (ret == Z_OK && enc->resume && !gst_gzenc_resume (enc))
+    {
+        (void)deflateEnd (&enc->stream);
+        ret = Z_STREAM_ERROR;
     }
 
     switch (ret)
@@ -264,222 +707,2690 @@ gst_gzenc_compress_init (GstGzenc * enc)
     return;
 }
 
-static gboolean
 #if GST_CHECK_VERSION(1,0,0)
-gst_gzenc_event (GstPad * pad, GstObject * parent, GstEvent * e)
-#else
-gst_gzenc_event (GstPad * pad, GstEvent * e)
-#endif
+/* Use the allocator downstream proposes for the output buffers, an
+ * fd-backed one lets the compressed data be shared with another process
+ * without copying it. With the worker pool it runs on the src pad task
+ * while the jobs allocate, the allocator is protected by the object lock. */
+    static void
+gst_gzenc_decide_allocation (GstGzenc * enc, GstCaps * caps)
 {
-    GstGzenc *enc;
-    gboolean ret;
+    GstQuery *query;
+    GstAllocator *allocator = NULL, *old;
+    GstAllocationParams params;
 
-#if GST_CHECK_VERSION(1,0,0)
-    enc = GST_GZENC (parent);
-#else
-    enc = GST_GZENC (gst_pad_get_parent (pad));
+    gst_allocation_params_init (&params);
+    query = gst_query_new_allocation (caps, FALSE);
+    if (gst_pad_peer_query (enc->src, query)
+            && gst_query_get_n_allocation_params (query) > 0)
+        gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+    gst_query_unref (query);
+    GST_DEBUG_OBJECT (enc, "Using allocator %s",
+            allocator ? GST_OBJECT_NAME (allocator) : "default");
+
+    GST_OBJECT_LOCK (enc);
+    old = enc->allocator;
+    enc->allocator = allocator;
+    enc->params = params;
+    GST_OBJECT_UNLOCK (enc);
+    if (old)
+        gst_object_unref (old);
+}
+
+    static GstMemory *
+gst_gzenc_alloc_memory (GstGzenc * enc, gsize size)
+{
+    GstAllocator *allocator;
+    GstAllocationParams params;
+    GstMemory *mem;
+
+    GST_OBJECT_LOCK (enc);
+    allocator = enc->allocator ? gst_object_ref (enc->allocator) : NULL;
+    params = enc->params;
+    GST_OBJECT_UNLOCK (enc);
+
+    /* align is a mask, output-alignment is a power of two */
+    if (enc->output_alignment)
+        params.align |= enc->output_alignment - 1;
+    mem = gst_allocator_alloc (allocator, size, &params);
+    if (!mem)
+    {
+        GST_WARNING_OBJECT (enc, "Allocation failed, using the default allocator");
+        mem = gst_allocator_alloc (NULL, size, &params);
+    }
+    if (allocator)
+        gst_object_unref (allocator);
+    return mem;
+}
+
+    static GstBuffer *
+gst_gzenc_alloc_buffer (GstGzenc * enc, gsize size)
+{
+    GstBuffer *out = gst_buffer_new ();
+
+    gst_buffer_append_memory (out, gst_gzenc_alloc_memory (enc, size));
+    return out;
+}
 #endif
-    switch (GST_EVENT_TYPE (e))
+
+    static gboolean
+gst_gzenc_have_sink_caps (GstGzenc * enc)
+{
+    return enc->sink_caps && !gst_caps_is_any (enc->sink_caps)
+        && !gst_caps_is_empty (enc->sink_caps);
+}
+
+/* The format in use and the caps of the uncompressed data are carried as
+ * fields so that gzdec can restore the original caps without having to
+ * typefind the decompressed stream. */
+    static GstCaps *
+gst_gzenc_compressed_caps (GstGzenc * enc)
+{
+    GstCaps *caps;
+
+    caps = gst_caps_new_simple ("application/x-gzip", "format", G_TYPE_STRING,
+            gst_gzenc_format_name (enc->format), NULL);
+    if (gst_gzenc_have_sink_caps (enc))
     {
-        case GST_EVENT_EOS:
-            {
-                GstFlowReturn flow = GST_FLOW_OK;
-                int r = Z_OK;
+        gchar *str = gst_caps_to_string (enc->sink_caps);
+
+        gst_caps_set_simple (caps, "original-caps", G_TYPE_STRING, str, NULL);
+        g_free (str);
+    }
+    /* Tell the receiver which of the two it gets */
+    if (enc->allow_bypass)
+        gst_caps_set_simple (caps, "compressed", G_TYPE_BOOLEAN, TRUE, NULL);
+    return caps;
+}
 
-                do
-                {
-                    GstBuffer *out;
 #if GST_CHECK_VERSION(1,0,0)
-                    GstMapInfo outmap;
-                    guint n;
+/* The sink caps, flagged as not compressed */
+    static GstCaps *
+gst_gzenc_bypass_caps (GstGzenc * enc)
+{
+    GstCaps *caps = gst_caps_copy (enc->sink_caps);
 
-                    out = gst_buffer_new_and_alloc (enc->memory_level);
+    gst_caps_set_simple (caps, "compressed", G_TYPE_BOOLEAN, FALSE, NULL);
+    return caps;
+}
 
-                    gst_buffer_map (out, &outmap, GST_MAP_WRITE);
-                    enc->stream.next_out = (void *) outmap.data;
-                    enc->stream.avail_out = outmap.size;
-#else
-                    flow = gst_pad_alloc_buffer (enc->src, enc->offset, enc->memory_level,
-                            GST_PAD_CAPS (enc->src), &out);
-
-                    if (flow != GST_FLOW_OK) {
-                        GST_DEBUG_OBJECT (enc, "pad alloc on EOS failed: %s",
-                                gst_flow_get_name (flow));
-                        break;
-                    }
-                    enc->stream.next_out = (void *) GST_BUFFER_DATA (out);
-                    enc->stream.avail_out = GST_BUFFER_SIZE (out);
-#endif
-                    r = deflate (&enc->stream, Z_FINISH);
-#if GST_CHECK_VERSION(1,0,0)
-                    gst_buffer_unmap (out, &outmap);
-#endif
-                    if ((r != Z_OK) && (r != Z_STREAM_END))
-                    {
-                        GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
-                                ("Failed to finish to compress (error code %i).", r));
-                        gst_buffer_unref (out);
-                        break;
-                    }
-#if GST_CHECK_VERSION(1,0,0)
-                    n = gst_buffer_get_size (out);
-                    if (enc->stream.avail_out >= n)
-#else
-                        if (enc->stream.avail_out >= GST_BUFFER_SIZE (out))
-#endif
-                        {
-                            gst_buffer_unref (out);
-                            break;
-                        }
-#if GST_CHECK_VERSION(1,0,0)
-                    gst_buffer_resize (out, 0, n - enc->stream.avail_out);
-                    n = gst_buffer_get_size (out);
-                    GST_BUFFER_OFFSET (out) = enc->stream.total_out - n;
-#else
-                    GST_BUFFER_SIZE (out) -= enc->stream.avail_out;
-                    GST_BUFFER_OFFSET (out) =
-                        enc->stream.total_out - GST_BUFFER_SIZE (out);
-#endif
-                    flow = gst_pad_push (enc->src, out);
+/* Find out whether downstream accepts the uncompressed data and lists it
+ * before the compressed data in its caps */
+    static void
+gst_gzenc_query_bypass (GstGzenc * enc)
+{
+    GstCaps *raw, *filter, *peer;
 
-                    if (flow != GST_FLOW_OK)
-                    {
-                        GST_DEBUG_OBJECT (enc, "push on EOS failed: %s",
-                                gst_flow_get_name (flow));
-                        break;
-                    }
-                } while (r != Z_STREAM_END);
-#if GST_CHECK_VERSION(1,0,0)
-                ret = gst_pad_event_default (pad, parent, e);
-#else
-                ret = gst_pad_event_default (pad, e);
-#endif
-                if (r != Z_STREAM_END || flow != GST_FLOW_OK)
-                {
-                    ret = FALSE;
-                }
+    enc->bypass_accepted = FALSE;
+    enc->bypass_preferred = FALSE;
+    /* Resumable streams have to stay one stream */
+    if (!enc->allow_bypass || enc->resumable || !gst_gzenc_have_sink_caps (enc))
+        return;
 
-                gst_gzenc_compress_init (enc);
-                break;
-            }
-        default:
-#if GST_CHECK_VERSION(1,0,0)
-            ret = gst_pad_event_default (pad, parent, e);
-#else
-            ret = gst_pad_event_default (pad, e);
-#endif
-            break;
+    raw = gst_gzenc_bypass_caps (enc);
+    enc->bypass_accepted = gst_pad_peer_query_accept_caps (enc->src, raw);
+    if (enc->bypass_accepted)
+    {
+        filter = gst_caps_merge (gst_gzenc_compressed_caps (enc),
+                gst_caps_ref (raw));
+        peer = gst_pad_peer_query_caps (enc->src, filter);
+        enc->bypass_preferred = !gst_caps_is_empty (peer)
+            && !gst_structure_has_name (gst_caps_get_structure (peer, 0),
+                    "application/x-gzip");
+        gst_caps_unref (peer);
+        gst_caps_unref (filter);
     }
-#if !GST_CHECK_VERSION(1,0,0)
-    gst_object_unref (enc);
-#endif
-    return ret;
+    gst_caps_unref (raw);
+    GST_DEBUG_OBJECT (enc, "Uncompressed caps accepted : %d, preferred : %d",
+            enc->bypass_accepted, enc->bypass_preferred);
 }
+#endif
 
-static GstFlowReturn
 #if GST_CHECK_VERSION(1,0,0)
-gst_gzenc_chain (GstPad * pad, GstObject * parent, GstBuffer * in)
-#else
-gst_gzenc_chain (GstPad * pad, GstBuffer * in)
-#endif
+/* Downstream was relinked or asks for a new allocator. With the worker
+ * pool this runs on the src pad task and the next job queries the bypass,
+ * see gst_gzenc_process(). */
+    static void
+gst_gzenc_reconfigure (GstGzenc * enc)
 {
-    GstFlowReturn flow = GST_FLOW_OK;
-    GstBuffer *out;
-    GstGzenc *enc;
-    guint n;
-    int ret;
-#if GST_CHECK_VERSION(1,0,0)
-    GstMapInfo map = GST_MAP_INFO_INIT, outmap;
+    GstCaps *caps = gst_pad_get_current_caps (enc->src);
 
-    enc = GST_GZENC (parent);
-#else
-    enc = GST_GZENC (GST_PAD_PARENT (pad));
-#endif
-    if (!enc->ready)
+    if (caps)
     {
-        GST_ELEMENT_ERROR (enc, LIBRARY, FAILED, (NULL), ("Compressor not ready."));
-        //gst_gzenc_compress_init (enc);
-        //gst_buffer_unref (out);
+        gst_gzenc_decide_allocation (enc, caps);
+        gst_caps_unref (caps);
+    }
+    if (enc->use_pool)
+        g_atomic_int_set (&enc->requery_bypass, TRUE);
+    else
+        gst_gzenc_query_bypass (enc);
+}
+#endif
+
+/* Bookkeeping around every push on the src pad: reconfiguration requests,
+ * probes and the push time for bypass-if-bandwidth-above. Returns the start
+ * time to give to gst_gzenc_push_done(). */
+    static gint64
+gst_gzenc_push_start (GstGzenc * enc, gsize size)
+{
 #if GST_CHECK_VERSION(1,0,0)
-        flow = GST_FLOW_FLUSHING;
-#else
-        flow = GST_FLOW_WRONG_STATE;
+    if (gst_pad_check_reconfigure (enc->src))
+        gst_gzenc_reconfigure (enc);
 #endif
-        goto done;
+    GST_GZ_PROBE_PUSH_START (enc, size);
+    return enc->bypass_bandwidth ? g_get_monotonic_time () : 0;
+}
+
+    static void
+gst_gzenc_push_done (GstGzenc * enc, gsize size, gint64 start,
+        GstFlowReturn flow)
+{
+    GST_GZ_PROBE_PUSH_DONE (enc, size, flow);
+    if (enc->bypass_bandwidth)
+    {
+        /* gst_gzenc_want_bypass() reads them from the worker pool */
+        GST_OBJECT_LOCK (enc);
+        enc->push_time += g_get_monotonic_time () - start;
+        enc->push_bytes += size;
+        GST_OBJECT_UNLOCK (enc);
     }
+}
 
+/* Push a buffer or a buffer list of size bytes on the src pad */
+    static GstFlowReturn
+gst_gzenc_src_push (GstGzenc * enc, GstMiniObject * obj, gsize size)
+{
+    GstFlowReturn flow;
+    gint64 start;
+
+    start = gst_gzenc_push_start (enc, size);
 #if GST_CHECK_VERSION(1,0,0)
-    gst_buffer_map (in, &map, GST_MAP_READ);
-    enc->stream.next_in = (void *) map.data;
-    enc->stream.avail_in = map.size;
-#else
-    enc->stream.next_in = (void *) GST_BUFFER_DATA (in);
-    enc->stream.avail_in = GST_BUFFER_SIZE (in);
+    if (GST_IS_BUFFER_LIST (obj))
+        flow = gst_pad_push_list (enc->src, GST_BUFFER_LIST_CAST (obj));
+    else
 #endif
+        flow = gst_pad_push (enc->src, GST_BUFFER_CAST (obj));
+    gst_gzenc_push_done (enc, size, start, flow);
+    return flow;
+}
 
-    while (enc->stream.avail_in) {
 #if GST_CHECK_VERSION(1,0,0)
-        out = gst_buffer_new_and_alloc (enc->memory_level);
-        gst_buffer_map (out, &outmap, GST_MAP_WRITE);
-        enc->stream.next_out = (void *) outmap.data;
-        enc->stream.avail_out = outmap.size;
-#else
-        flow = gst_pad_alloc_buffer (enc->src, enc->offset, enc->memory_level, 
-                GST_PAD_CAPS (pad), &out);
-        if (flow != GST_FLOW_OK)
-        {
-            gst_gzenc_compress_init (enc);
+    static void
+gst_gzenc_output_init (GstGzencOutput * output)
+{
+    g_queue_init (&output->queue);
+    output->queued_buffers = 0;
+    g_mutex_init (&output->lock);
+    g_cond_init (&output->cond);
+    output->flushing = TRUE;
+    output->flow = GST_FLOW_OK;
+}
+
+/* When flushing the queued output is dropped and the task pauses. Leaving
+ * the flushing state clears the last error. */
+    static void
+gst_gzenc_output_set_flushing (GstGzencOutput * output, gboolean flushing)
+{
+    GQueue dropped = G_QUEUE_INIT;
+    GstMiniObject *obj;
+
+    g_mutex_lock (&output->lock);
+    output->flushing = flushing;
+    output->flow = GST_FLOW_OK;
+    if (flushing)
+    {
+        dropped = output->queue;
+        g_queue_init (&output->queue);
+        output->queued_buffers = 0;
+    }
+    g_cond_broadcast (&output->cond);
+    g_mutex_unlock (&output->lock);
+
+    while ((obj = g_queue_pop_head (&dropped)))
+        gst_mini_object_unref (obj);
+}
+
+    static void
+gst_gzenc_output_clear (GstGzencOutput * output)
+{
+    gst_gzenc_output_set_flushing (output, TRUE);
+    g_mutex_clear (&output->lock);
+    g_cond_clear (&output->cond);
+}
+
+/* Must be called with the output lock */
+    static GstFlowReturn
+gst_gzenc_output_get_flow (GstGzencOutput * output, GstPad * pad)
+{
+    if (output->flushing)
+        return GST_FLOW_FLUSHING;
+    /* Downstream got linked since */
+    if (output->flow == GST_FLOW_NOT_LINKED && gst_pad_is_linked (pad))
+        output->flow = GST_FLOW_OK;
+    return output->flow;
+}
+
+/* Called from the worker pool, never blocks. Takes the object and returns
+ * the last flow of the task, the buffers are dropped after an error. */
+    static GstFlowReturn
+gst_gzenc_output_enqueue (GstGzencOutput * output, GstPad * pad,
+        GstMiniObject * obj)
+{
+    GstFlowReturn flow;
+    gboolean is_event = GST_IS_EVENT (obj);
+
+    g_mutex_lock (&output->lock);
+    flow = gst_gzenc_output_get_flow (output, pad);
+    if (!output->flushing && (flow == GST_FLOW_OK || is_event))
+    {
+        g_queue_push_tail (&output->queue, obj);
+        if (!is_event)
+            output->queued_buffers++;
+        obj = NULL;
+        g_cond_broadcast (&output->cond);
+    }
+    g_mutex_unlock (&output->lock);
+
+    if (obj)
+        gst_mini_object_unref (obj);
+    return flow;
+}
+
+/* Called from the streaming thread before queuing a job */
+    static GstFlowReturn
+gst_gzenc_output_wait (GstGzencOutput * output, GstPad * pad)
+{
+    GstFlowReturn flow;
+
+    g_mutex_lock (&output->lock);
+    while (!output->flushing && output->flow == GST_FLOW_OK
+            && output->queued_buffers >= POOL_OUTPUT_BUFFERS)
+        g_cond_wait (&output->cond, &output->lock);
+    flow = gst_gzenc_output_get_flow (output, pad);
+    g_mutex_unlock (&output->lock);
+    return flow;
+}
+
+/* Next object to push, NULL when flushing (the task of the pad is paused).
+ * A buffer is returned with the last flow of the task in flow. */
+    static GstMiniObject *
+gst_gzenc_output_pop (GstGzencOutput * output, GstPad * pad,
+        GstFlowReturn * flow)
+{
+    GstMiniObject *obj = NULL;
+
+    g_mutex_lock (&output->lock);
+    while (!output->flushing && g_queue_is_empty (&output->queue))
+        g_cond_wait (&output->cond, &output->lock);
+    if (output->flushing)
+        gst_pad_pause_task (pad);
+    else
+    {
+        obj = g_queue_pop_head (&output->queue);
+        if (!GST_IS_EVENT (obj))
+            output->queued_buffers--;
+        *flow = output->flow;
+        g_cond_broadcast (&output->cond);
+    }
+    g_mutex_unlock (&output->lock);
+    return obj;
+}
+
+    static void
+gst_gzenc_output_set_flow (GstGzencOutput * output, GstFlowReturn flow)
+{
+    g_mutex_lock (&output->lock);
+    if (!output->flushing && output->flow == GST_FLOW_OK)
+        output->flow = flow;
+    g_cond_broadcast (&output->cond);
+    g_mutex_unlock (&output->lock);
+}
+
+    static gsize
+gst_gzenc_output_size (GstMiniObject * obj)
+{
+    GstBufferList *list;
+    gsize size = 0;
+    guint i, n;
+
+    if (!GST_IS_BUFFER_LIST (obj))
+        return gst_buffer_get_size (GST_BUFFER_CAST (obj));
+    list = GST_BUFFER_LIST_CAST (obj);
+    n = gst_buffer_list_length (list);
+    for (i = 0; i < n; i++)
+        size += gst_buffer_get_size (gst_buffer_list_get (list, i));
+    return size;
+}
+
+/* Src pad task with the worker pool */
+    static void
+gst_gzenc_output_loop (GstPad * pad)
+{
+    GstGzenc *enc = GST_GZENC (GST_PAD_PARENT (pad));
+    GstMiniObject *obj;
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    obj = gst_gzenc_output_pop (&enc->output, pad, &flow);
+    if (!obj)
+        return;
+
+    if (GST_IS_EVENT (obj))
+    {
+        GstEvent *e = GST_EVENT_CAST (obj);
+        GstCaps *caps = NULL;
+
+        if (GST_EVENT_TYPE (e) == GST_EVENT_CAPS)
+        {
+            gst_event_parse_caps (e, &caps);
+            gst_caps_ref (caps);
+        }
+        /* The allocation query is serialized, it is only sent from here */
+        if (gst_pad_push_event (pad, e) && caps)
+            gst_gzenc_decide_allocation (enc, caps);
+        if (caps)
+            gst_caps_unref (caps);
+        return;
+    }
+
+    /* Queued before downstream returned an error */
+    if (flow != GST_FLOW_OK)
+    {
+        gst_mini_object_unref (obj);
+        return;
+    }
+    flow = gst_gzenc_src_push (enc, obj, gst_gzenc_output_size (obj));
+    if (flow != GST_FLOW_OK)
+    {
+        GST_DEBUG_OBJECT (enc, "Push failed: %s", gst_flow_get_name (flow));
+        gst_gzenc_output_set_flow (&enc->output, flow);
+    }
+}
+
+    static gboolean
+gst_gzenc_src_activate_mode (GstPad * pad, GstObject * parent,
+        GstPadMode mode, gboolean active)
+{
+    GstGzenc *enc = GST_GZENC (parent);
+
+    if (mode != GST_PAD_MODE_PUSH)
+        return FALSE;
+
+    if (active)
+    {
+        enc->use_pool = enc->worker_pool;
+        g_atomic_int_set (&enc->requery_bypass, FALSE);
+        if (!enc->use_pool)
+            return TRUE;
+        gst_gzenc_output_set_flushing (&enc->output, FALSE);
+        return gst_pad_start_task (pad, (GstTaskFunction) gst_gzenc_output_loop,
+                pad, NULL);
+    }
+    if (!enc->use_pool)
+        return TRUE;
+    gst_gzenc_output_set_flushing (&enc->output, TRUE);
+    return gst_pad_stop_task (pad);
+}
+
+/* Send an event on the src pad. With the worker pool, the serialized events
+ * are pushed by the src pad task after the output queued before them. */
+    static gboolean
+gst_gzenc_push_event (GstGzenc * enc, GstEvent * e)
+{
+    if (enc->use_pool && GST_EVENT_IS_SERIALIZED (e)
+            && GST_EVENT_TYPE (e) != GST_EVENT_FLUSH_STOP)
+    {
+        gst_gzenc_output_enqueue (&enc->output, enc->src, GST_MINI_OBJECT_CAST (e));
+        return TRUE;
+    }
+    return gst_pad_push_event (enc->src, e);
+}
+#endif
+
+/* Push a buffer on the src pad, with the worker pool it is queued for the
+ * src pad task */
+    static GstFlowReturn
+gst_gzenc_pad_push (GstGzenc * enc, GstBuffer * out)
+{
+#if GST_CHECK_VERSION(1,0,0)
+    if (enc->use_pool)
+        return gst_gzenc_output_enqueue (&enc->output, enc->src,
+                GST_MINI_OBJECT_CAST (out));
+    return gst_gzenc_src_push (enc, GST_MINI_OBJECT_CAST (out),
+            gst_buffer_get_size (out));
+#else
+    return gst_gzenc_src_push (enc, GST_MINI_OBJECT_CAST (out),
+            GST_BUFFER_SIZE (out));
+#endif
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Push a list of size bytes, see gst_gzenc_pad_push() */
+    static GstFlowReturn
+gst_gzenc_pad_push_list (GstGzenc * enc, GstBufferList * list, gsize size)
+{
+    if (enc->use_pool)
+        return gst_gzenc_output_enqueue (&enc->output, enc->src,
+                GST_MINI_OBJECT_CAST (list));
+    return gst_gzenc_src_push (enc, GST_MINI_OBJECT_CAST (list), size);
+}
+#endif
+
+/* Configure the source pad caps, compressed or not */
+    static void
+gst_gzenc_set_src_caps (GstGzenc * enc)
+{
+    GstCaps *caps;
+
+#if GST_CHECK_VERSION(1,0,0)
+    gst_gzenc_query_bypass (enc);
+    /* Downstream changed, nothing needs to be finished to stop the bypass */
+    if (enc->bypass && !enc->bypass_accepted)
+        enc->bypass = FALSE;
+    if (enc->bypass)
+        caps = gst_gzenc_bypass_caps (enc);
+    else
+#endif
+        caps = gst_gzenc_compressed_caps (enc);
+    GST_DEBUG_OBJECT (enc, "Setting src caps to %" GST_PTR_FORMAT, caps);
+#if GST_CHECK_VERSION(1,0,0)
+    /* The src pad task pushes the caps and decides the allocation */
+    if (enc->use_pool)
+        gst_gzenc_push_event (enc, gst_event_new_caps (caps));
+    else if (gst_pad_set_caps (enc->src, caps))
+        gst_gzenc_decide_allocation (enc, caps);
+#else
+    gst_pad_set_caps (enc->src, caps);
+#endif
+    gst_caps_unref (caps);
+    enc->renegotiate = FALSE;
+}
+
+    static void
+gst_gzenc_store_sink_caps (GstGzenc * enc, GstCaps * caps)
+{
+    GST_DEBUG_OBJECT (enc, "Received sink caps %" GST_PTR_FORMAT, caps);
+    /* The src pad caps query reads them */
+    GST_OBJECT_LOCK (enc);
+    if (enc->sink_caps)
+        gst_caps_unref (enc->sink_caps);
+    enc->sink_caps = caps ? gst_caps_ref (caps) : NULL;
+    GST_OBJECT_UNLOCK (enc);
+    enc->renegotiate = TRUE;
+}
+
+#if !GST_CHECK_VERSION(1,0,0)
+    static gboolean
+gst_gzenc_sink_setcaps (GstPad * pad, GstCaps * caps)
+{
+    GstGzenc *enc = GST_GZENC (GST_PAD_PARENT (pad));
+
+    gst_gzenc_store_sink_caps (enc, caps);
+    return TRUE;
+}
+#endif
+
+#if GST_CHECK_VERSION(1,0,0)
+    static GstMemory *
+gst_gzenc_new_memory (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstMemory *mem;
+    GstMapInfo map;
+
+    mem = gst_gzenc_alloc_memory (enc, size);
+    gst_memory_map (mem, &map, GST_MAP_WRITE);
+    memcpy (map.data, data, size);
+    gst_memory_unmap (mem, &map);
+    return mem;
+}
+#endif
+
+/* Level 0 without deflate() is not available with GStreamer 0.10 */
+    static gboolean
+gst_gzenc_zero_copy (GstGzenc * enc)
+{
+#if GST_CHECK_VERSION(1,0,0)
+    /* Rsyncable and resumable output need deflate() to place the flush
+     * points */
+    return enc->compression_level == 0 && !enc->rsyncable && !enc->resumable
+        && !enc->per_buffer && !enc->archive && !enc->block_mode;
+#else
+    return FALSE;
+#endif
+}
+
+    static void
+gst_gzenc_update_check (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    /* Raw deflate data has no check value */
+    if (enc->format == GST_GZENC_ZLIB)
+        enc->check = adler32 (enc->check, data, size);
+    else if (enc->format == GST_GZENC_GZIP)
+        enc->check = crc32 (enc->check, data, size);
+    enc->stored_size += size;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Block mode: push the block being filled. A full block is only pushed
+ * when more output comes, so that the last block of the stream is always
+ * pushed by gst_gzenc_block_finish() and flagged with MARKER. */
+    static GstFlowReturn
+gst_gzenc_block_push (GstGzenc * enc, gboolean last)
+{
+    GstBuffer *out = enc->block;
+
+    gst_buffer_unmap (out, &enc->block_map);
+    enc->block = NULL;
+    gst_buffer_resize (out, 0, enc->block_fill);
+    GST_BUFFER_OFFSET (out) = enc->offset - enc->block_fill;
+    if (last)
+        GST_BUFFER_FLAG_SET (out, GST_BUFFER_FLAG_MARKER);
+    enc->block_fill = 0;
+    return gst_gzenc_pad_push (enc, out);
+}
+
+/* Make room in the blocks for more output */
+    static GstFlowReturn
+gst_gzenc_block_next (GstGzenc * enc)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    if (enc->block && enc->block_fill == enc->block_map.size)
+        flow = gst_gzenc_block_push (enc, FALSE);
+    if (flow == GST_FLOW_OK && !enc->block)
+    {
+        enc->block = gst_gzenc_alloc_buffer (enc, enc->block_size);
+        gst_buffer_map (enc->block, &enc->block_map, GST_MAP_WRITE);
+        enc->block_fill = 0;
+        GST_GZ_PROBE_ALLOC (enc, enc->block_size);
+    }
+    return flow;
+}
+
+/* Push the last, possibly partial, block of the stream */
+    static GstFlowReturn
+gst_gzenc_block_finish (GstGzenc * enc)
+{
+    if (!enc->block)
+        return GST_FLOW_OK;
+    if (!enc->block_fill)
+    {
+        gst_gzenc_block_clear (enc);
+        return GST_FLOW_OK;
+    }
+    return gst_gzenc_block_push (enc, TRUE);
+}
+
+/* Block mode: copy output into the blocks */
+    static GstFlowReturn
+gst_gzenc_block_write (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    while (size && flow == GST_FLOW_OK)
+    {
+        gsize n;
+
+        flow = gst_gzenc_block_next (enc);
+        if (flow != GST_FLOW_OK)
+            break;
+        n = MIN (enc->block_map.size - enc->block_fill, size);
+        memcpy (enc->block_map.data + enc->block_fill, data, n);
+        enc->block_fill += n;
+        enc->offset += n;
+        data += n;
+        size -= n;
+    }
+    return flow;
+}
+#endif
+
+/* Push an output buffer, or copy it into the blocks in block mode */
+    static GstFlowReturn
+gst_gzenc_push_buffer (GstGzenc * enc, GstBuffer * out)
+{
+#if GST_CHECK_VERSION(1,0,0)
+    if (enc->block_mode)
+    {
+        GstFlowReturn flow;
+        GstMapInfo map;
+
+        gst_buffer_map (out, &map, GST_MAP_READ);
+        flow = gst_gzenc_block_write (enc, map.data, map.size);
+        gst_buffer_unmap (out, &map);
+        gst_buffer_unref (out);
+        return flow;
+    }
+    GST_BUFFER_OFFSET (out) = enc->offset;
+    enc->offset += gst_buffer_get_size (out);
+#else
+    GST_BUFFER_OFFSET (out) = enc->offset;
+    enc->offset += GST_BUFFER_SIZE (out);
+#endif
+    return gst_gzenc_pad_push (enc, out);
+}
+
+/* Push bytes written by gzenc itself */
+    static GstFlowReturn
+gst_gzenc_push_data (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstBuffer *out;
+
+#if GST_CHECK_VERSION(1,0,0)
+    if (enc->block_mode)
+        return gst_gzenc_block_write (enc, data, size);
+    out = gst_buffer_new ();
+    gst_buffer_append_memory (out, gst_gzenc_new_memory (enc, data, size));
+#else
+    out = gst_buffer_new_and_alloc (size);
+    memcpy (GST_BUFFER_DATA (out), data, size);
+    gst_buffer_set_caps (out, GST_PAD_CAPS (enc->src));
+#endif
+    GST_BUFFER_OFFSET (out) = enc->offset;
+    enc->offset += size;
+    return gst_gzenc_pad_push (enc, out);
+}
+
+/* Write the header deflate() would write at level 0, or at level 9 for
+ * the archive mode */
+    static gsize
+gst_gzenc_write_header (GstGzencFormat format, gboolean archive,
+        guint8 * data)
+{
+    static const guint8 gzip_header[10] = {
+        0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+    };
+
+    if (format == GST_GZENC_DEFLATE)
+        return 0;
+    if (format == GST_GZENC_ZLIB)
+    {
+        /* 32K window, fastest or maximum compression level */
+        data[0] = 0x78;
+        data[1] = archive ? 0xda : 0x01;
+        return 2;
+    }
+    memcpy (data, gzip_header, sizeof (gzip_header));
+    /* XFL: maximum compression */
+    if (archive)
+        data[8] = 2;
+    return sizeof (gzip_header);
+}
+
+/* Write the trailer following the last deflate block */
+    static gsize
+gst_gzenc_write_trailer (GstGzencFormat format, guint32 check, guint64 size,
+        guint8 * data)
+{
+    if (format == GST_GZENC_ZLIB)
+    {
+        GST_WRITE_UINT32_BE (data, check);
+        return 4;
+    }
+    if (format == GST_GZENC_GZIP)
+    {
+        GST_WRITE_UINT32_LE (data, check);
+        GST_WRITE_UINT32_LE (data + 4, (guint32) size);
+        return 8;
+    }
+    return 0;
+}
+
+    static GstFlowReturn
+gst_gzenc_push_header (GstGzenc * enc)
+{
+    guint8 header[10];
+    gsize size;
+
+    if (enc->header_sent)
+        return GST_FLOW_OK;
+    enc->header_sent = TRUE;
+    size = gst_gzenc_write_header (enc->format,
+            gst_gzenc_archive (enc), header);
+    return size ? gst_gzenc_push_data (enc, header, size) : GST_FLOW_OK;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+
+/* Level 0 without deflate(): the stream header and the stored block headers
+ * are small memories and the payload references the input memories, nothing
+ * is copied. Each stored block is an output buffer, pushed as a list. The
+ * checksum is computed on the way. */
+    static GstFlowReturn
+gst_gzenc_store (GstGzenc * enc, GstBuffer * in)
+{
+    GstBufferList *list;
+    guint i, n;
+    gsize pos = 0;
+    guint64 offset = enc->offset;
+
+    list = gst_buffer_list_new ();
+    n = gst_buffer_n_memory (in);
+    for (i = 0; i < n; i++)
+    {
+        GstMemory *mem = gst_buffer_peek_memory (in, i);
+        GstMapInfo map;
+        gsize off, len;
+
+        if (!gst_memory_map (mem, &map, GST_MAP_READ))
+        {
+            GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
+                    ("Failed to map input memory."));
+            gst_buffer_list_unref (list);
+            return GST_FLOW_ERROR;
+        }
+        /* Blocks don't span memories */
+        for (off = 0; off < map.size; off += len)
+        {
+            guint8 header[10 + 5];
+            gsize hlen = 0;
+            GstBuffer *out;
+
+            len = MIN (map.size - off, MAX_STORED_BLOCK_SIZE);
+            if (!enc->header_sent)
+            {
+                hlen = gst_gzenc_write_header (enc->format,
+                        gst_gzenc_archive (enc), header);
+                enc->header_sent = TRUE;
+            }
+            /* BFINAL 0, BTYPE 00, then LEN and NLEN */
+            header[hlen] = 0;
+            GST_WRITE_UINT16_LE (header + hlen + 1, len);
+            GST_WRITE_UINT16_LE (header + hlen + 3, ~len);
+            hlen += 5;
+
+            gst_gzenc_update_check (enc, map.data + off, len);
+
+            out = gst_buffer_new ();
+            gst_buffer_append_memory (out, gst_gzenc_new_memory (enc, header, hlen));
+            gst_buffer_copy_into (out, in, GST_BUFFER_COPY_MEMORY, pos + off, len);
+            GST_BUFFER_OFFSET (out) = enc->offset;
+            enc->offset += hlen + len;
+            gst_buffer_list_add (list, out);
+        }
+        pos += map.size;
+        gst_memory_unmap (mem, &map);
+    }
+
+    if (!gst_buffer_list_length (list))
+    {
+        gst_buffer_list_unref (list);
+        return GST_FLOW_OK;
+    }
+    return gst_gzenc_pad_push_list (enc, list, enc->offset - offset);
+}
+
+#endif
+
+/* End a stream framed by gzenc (level 0 without deflate() or resumable)
+ * with an empty final stored block and the trailer. The deflate data before
+ * it ends on a byte boundary, so that a resumed stream can replace them. */
+    static GstFlowReturn
+gst_gzenc_finish_framed (GstGzenc * enc)
+{
+    guint8 data[10 + 5 + 8];
+    gsize n = 0;
+
+    if (!enc->header_sent)
+        n = gst_gzenc_write_header (enc->format,
+                gst_gzenc_archive (enc), data);
+    data[n++] = 1;
+    GST_WRITE_UINT16_LE (data + n, 0);
+    GST_WRITE_UINT16_LE (data + n + 2, 0xffff);
+    n += 4;
+    n += gst_gzenc_write_trailer (enc->format, enc->check, enc->stored_size,
+            data + n);
+    return gst_gzenc_push_data (enc, data, n);
+}
+
+/* Change the compression level of the running stream. deflateParams() may
+ * have to flush the data compressed so far with the previous level, it is
+ * called again with more output space as long as it reports Z_BUF_ERROR. */
+    static GstFlowReturn
+gst_gzenc_set_params (GstGzenc * enc, int level)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    GstBuffer *out;
+    guint n;
+    int ret;
+#if GST_CHECK_VERSION(1,0,0)
+    GstMapInfo outmap;
+#endif
+
+    do
+    {
+#if GST_CHECK_VERSION(1,0,0)
+        out = gst_gzenc_alloc_buffer (enc, PROBE_SAMPLE_SIZE);
+        gst_buffer_map (out, &outmap, GST_MAP_WRITE);
+        enc->stream.next_out = (void *) outmap.data;
+        enc->stream.avail_out = outmap.size;
+#else
+        flow = gst_pad_alloc_buffer (enc->src, enc->offset, PROBE_SAMPLE_SIZE,
+                GST_PAD_CAPS (enc->src), &out);
+        if (flow != GST_FLOW_OK)
+            return flow;
+        enc->stream.next_out = (void *) GST_BUFFER_DATA (out);
+        enc->stream.avail_out = GST_BUFFER_SIZE (out);
+#endif
+        ret = deflateParams (&enc->stream, level,
+                gst_gzenc_zlib_strategy (enc->strategy, enc->auto_strategy));
+#if GST_CHECK_VERSION(1,0,0)
+        gst_buffer_unmap (out, &outmap);
+        n = gst_buffer_get_size (out);
+#else
+        n = GST_BUFFER_SIZE (out);
+#endif
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            GST_WARNING_OBJECT (enc, "deflateParams() return %d", ret);
+            gst_buffer_unref (out);
+            break;
+        }
+        if (enc->stream.avail_out >= n)
+        {
+            gst_buffer_unref (out);
+            break;
+        }
+#if GST_CHECK_VERSION(1,0,0)
+        gst_buffer_resize (out, 0, n - enc->stream.avail_out);
+#else
+        GST_BUFFER_SIZE (out) -= enc->stream.avail_out;
+#endif
+        flow = gst_gzenc_push_buffer (enc, out);
+        if (flow != GST_FLOW_OK)
+            break;
+    } while (ret == Z_BUF_ERROR);
+
+    return flow;
+}
+
+/* Compress a sample with the probe stream, returns the compressed size or
+ * G_MAXSIZE if it is bigger than max_size */
+    static gsize
+gst_gzenc_trial (GstGzenc * enc, const guint8 * data, gsize size,
+        int level, int strategy, gsize max_size)
+{
+    deflateReset (&enc->probe);
+    deflateParams (&enc->probe, level, strategy);
+    enc->probe.next_in = (z_const Bytef *) data;
+    enc->probe.avail_in = size;
+    enc->probe.next_out = enc->probe_out;
+    enc->probe.avail_out = max_size;
+    if (deflate (&enc->probe, Z_FINISH) != Z_STREAM_END)
+        return G_MAXSIZE;
+    return max_size - enc->probe.avail_out;
+}
+
+    static GstFlowReturn
+gst_gzenc_set_auto_strategy (GstGzenc * enc, int strategy)
+{
+    if (strategy == enc->auto_strategy)
+        return GST_FLOW_OK;
+    GST_DEBUG_OBJECT (enc, "Switching to strategy %d", strategy);
+    enc->auto_strategy = strategy;
+    return gst_gzenc_set_params (enc, enc->storing ? 0 :
+            enc->compression_level);
+}
+
+/* Auto strategy: the fastest strategy that compresses the sample about as
+ * well as the default one at the configured level */
+    static GstFlowReturn
+gst_gzenc_pick_strategy (GstGzenc * enc, const guint8 * data, gsize sample)
+{
+    static const int fast[] = { Z_HUFFMAN_ONLY, Z_RLE };
+    int level = enc->compression_level < 0 ? 6 : enc->compression_level;
+    int strategy = Z_DEFAULT_STRATEGY;
+    gsize best, size;
+    guint i;
+
+    best = gst_gzenc_trial (enc, data, sample, level, Z_DEFAULT_STRATEGY,
+            sample);
+    for (i = 0; i < G_N_ELEMENTS (fast); i++)
+    {
+        size = gst_gzenc_trial (enc, data, sample, level, fast[i], sample);
+        if (best == G_MAXSIZE || (size != G_MAXSIZE
+                    && size <= best * AUTO_STRATEGY_TOLERANCE))
+        {
+            strategy = fast[i];
+            break;
+        }
+    }
+    GST_LOG_OBJECT (enc, "Probed %" G_GSIZE_FORMAT " bytes : %"
+            G_GSIZE_FORMAT " bytes with the default strategy, using %d",
+            sample, best, strategy);
+    return gst_gzenc_set_auto_strategy (enc, strategy);
+}
+
+/* Trial-compress a sample of the input every PROBE_INTERVAL bytes. With
+ * auto-store, switch between stored blocks and the configured level
+ * depending on the result of level 1. With the auto strategy, pick the
+ * strategy. */
+    static GstFlowReturn
+gst_gzenc_probe (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    gsize sample;
+    gboolean incompressible;
+
+    if (enc->probe_countdown > size)
+    {
+        enc->probe_countdown -= size;
+        return GST_FLOW_OK;
+    }
+    /* Too little data to judge, try again on the next buffer */
+    if (size < PROBE_MIN_SAMPLE_SIZE)
+        return GST_FLOW_OK;
+    enc->probe_countdown = PROBE_INTERVAL;
+
+    if (!enc->probe_ready)
+    {
+        memset (&enc->probe, 0, sizeof (enc->probe));
+        if (deflateInit2 (&enc->probe, 1, Z_DEFLATED, -MAX_WBITS, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            GST_WARNING_OBJECT (enc, "Failed to initialize the probe");
+            enc->probe_countdown = G_MAXSIZE;
+            return GST_FLOW_OK;
+        }
+        enc->probe_out = g_malloc (PROBE_SAMPLE_SIZE);
+        enc->probe_ready = TRUE;
+    }
+    sample = MIN (size, PROBE_SAMPLE_SIZE);
+
+    /* The sample is incompressible when the output does not fit in
+     * PROBE_MAX_RATIO of its size */
+    if (enc->auto_store && enc->compression_level != 0)
+    {
+        incompressible = gst_gzenc_trial (enc, data, sample, 1,
+                Z_DEFAULT_STRATEGY, sample * PROBE_MAX_RATIO) == G_MAXSIZE;
+        GST_LOG_OBJECT (enc, "Probed %" G_GSIZE_FORMAT " bytes : %s", sample,
+                incompressible ? "incompressible" : "compressible");
+        if (incompressible != enc->storing)
+        {
+            GST_DEBUG_OBJECT (enc, "Switching to %s", incompressible ?
+                    "stored blocks" : "compression");
+            enc->storing = incompressible;
+            flow = gst_gzenc_set_params (enc, incompressible ? 0 :
+                    enc->compression_level);
+        }
+    }
+
+    if (flow == GST_FLOW_OK && enc->strategy == GST_GZENC_AUTO_STRATEGY
+            && !enc->storing && enc->compression_level != 0)
+        flow = gst_gzenc_pick_strategy (enc, data, sample);
+    return flow;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Block mode: deflate() writes to the blocks directly */
+    static GstFlowReturn
+gst_gzenc_deflate_blocks (GstGzenc * enc, int flush, int * ret)
+{
+    GstFlowReturn flow;
+    uInt avail_in, avail_out;
+
+    *ret = Z_OK;
+    do {
+        flow = gst_gzenc_block_next (enc);
+        if (flow != GST_FLOW_OK)
+            break;
+        enc->stream.next_out = enc->block_map.data + enc->block_fill;
+        enc->stream.avail_out = enc->block_map.size - enc->block_fill;
+        avail_in = enc->stream.avail_in;
+        avail_out = enc->stream.avail_out;
+        GST_GZ_PROBE_CODEC_START (deflate, enc, avail_in, avail_out);
+        *ret = deflate (&enc->stream, flush);
+        GST_GZ_PROBE_CODEC_DONE (deflate, enc, avail_in - enc->stream.avail_in,
+                avail_out - enc->stream.avail_out, *ret);
+        if (*ret == Z_STREAM_ERROR)
+            return GST_FLOW_ERROR;
+        enc->block_fill += avail_out - enc->stream.avail_out;
+        enc->offset += avail_out - enc->stream.avail_out;
+    } while (enc->stream.avail_out == 0 && *ret != Z_STREAM_END);
+
+    return flow;
+}
+#endif
+
+/* Compress the pending input with the given flush mode and push the
+ * output */
+    static GstFlowReturn
+gst_gzenc_deflate (GstGzenc * enc, int flush)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    GstBuffer *out;
+    guint n;
+    uInt avail_in, avail_out;
+    int ret;
+#if GST_CHECK_VERSION(1,0,0)
+    GstMapInfo outmap;
+
+    if (enc->block_mode)
+    {
+        flow = gst_gzenc_deflate_blocks (enc, flush, &ret);
+        if (ret == Z_STREAM_ERROR)
+        {
+            GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
+                    ("Failed to compress data (error code %i)", ret));
+            gst_gzenc_compress_init (enc);
+        }
+        return flow;
+    }
+#endif
+
+    do {
+#if GST_CHECK_VERSION(1,0,0)
+        out = gst_gzenc_alloc_buffer (enc, OUTPUT_BUFFER_SIZE);
+        gst_buffer_map (out, &outmap, GST_MAP_WRITE);
+        enc->stream.next_out = (void *) outmap.data;
+        enc->stream.avail_out = outmap.size;
+#else
+        flow = gst_pad_alloc_buffer (enc->src, enc->offset, OUTPUT_BUFFER_SIZE,
+                GST_PAD_CAPS (enc->sink), &out);
+        if (flow != GST_FLOW_OK)
+        {
+            gst_gzenc_compress_init (enc);
+            break;
+        }
+        enc->stream.next_out = (void *) GST_BUFFER_DATA (out);
+        enc->stream.avail_out = GST_BUFFER_SIZE (out);
+#endif
+        GST_GZ_PROBE_ALLOC (enc, enc->stream.avail_out);
+        avail_in = enc->stream.avail_in;
+        avail_out = enc->stream.avail_out;
+        GST_GZ_PROBE_CODEC_START (deflate, enc, avail_in, avail_out);
+        ret = deflate (&enc->stream, flush);
+        GST_GZ_PROBE_CODEC_DONE (deflate, enc, avail_in - enc->stream.avail_in,
+                avail_out - enc->stream.avail_out, ret);
+#if GST_CHECK_VERSION(1,0,0)
+        gst_buffer_unmap (out, &outmap);
+#endif
+        if (ret == Z_STREAM_ERROR)
+        {
+            GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
+                    ("Failed to compress data (error code %i)", ret));
+            gst_gzenc_compress_init (enc);
+            gst_buffer_unref (out);
+            return GST_FLOW_ERROR;
+        }
+#if GST_CHECK_VERSION(1,0,0)
+        n = gst_buffer_get_size (out);
+#else
+        n = GST_BUFFER_SIZE (out);
+#endif
+        if (enc->stream.avail_out >= n) {
+            gst_buffer_unref (out);
+            break;
+        }
+#if GST_CHECK_VERSION(1,0,0)
+        gst_buffer_resize (out, 0, n - enc->stream.avail_out);
+        n = gst_buffer_get_size (out);
+#else
+        GST_BUFFER_SIZE (out) -= enc->stream.avail_out;
+        n = GST_BUFFER_SIZE (out);
+#endif
+        GST_BUFFER_OFFSET (out) = enc->offset;
+        flow = gst_gzenc_pad_push (enc, out);
+
+        if (flow != GST_FLOW_OK)
+            break;
+
+        enc->offset += n;
+    } while (enc->stream.avail_out == 0);
+
+    return flow;
+}
+
+/* Rsyncable compression: the compressor is reset with a full flush after
+ * every input byte where the rolling hash hits. The points only depend on
+ * the surrounding data, so an unchanged region of the input is compressed
+ * to the same bytes whatever changed before it. */
+    static GstFlowReturn
+gst_gzenc_deflate_rsyncable (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    guint32 hash = enc->rsync_hash;
+    gsize i, start = 0;
+
+    for (i = 0; i < size && flow == GST_FLOW_OK; i++)
+    {
+        hash = ((hash << 1) ^ data[i]) & RSYNC_MASK;
+        if (hash != RSYNC_HIT)
+            continue;
+        enc->stream.next_in = (z_const Bytef *) data + start;
+        enc->stream.avail_in = i + 1 - start;
+        flow = gst_gzenc_deflate (enc, Z_FULL_FLUSH);
+        start = i + 1;
+    }
+    enc->rsync_hash = hash;
+
+    if (flow == GST_FLOW_OK && start < size)
+    {
+        enc->stream.next_in = (z_const Bytef *) data + start;
+        enc->stream.avail_in = size - start;
+        flow = gst_gzenc_deflate (enc, Z_NO_FLUSH);
+    }
+    return flow;
+}
+
+/* Flush the compressor to a byte boundary and post a "gzenc-checkpoint"
+ * element message with what is needed to resume the stream from there: the
+ * size of the output so far, the size and checksum of the input and the
+ * window of the compressor. A new gzenc given this checkpoint in
+ * resume-checkpoint continues the same member (or zlib stream) when its
+ * output is written after the first offset bytes of this output. */
+    static GstFlowReturn
+gst_gzenc_checkpoint (GstGzenc * enc)
+{
+    GstFlowReturn flow;
+    GstStructure *s;
+
+    flow = gst_gzenc_push_header (enc);
+    if (flow != GST_FLOW_OK)
+        return flow;
+    enc->stream.avail_in = 0;
+    flow = gst_gzenc_deflate (enc, Z_SYNC_FLUSH);
+    if (flow != GST_FLOW_OK)
+        return flow;
+    enc->checkpoint_countdown = enc->checkpoint_interval;
+
+    s = gst_structure_new ("gzenc-checkpoint",
+            "format", G_TYPE_STRING, gst_gzenc_format_name (enc->format),
+            "offset", G_TYPE_UINT64, enc->offset,
+            "size", G_TYPE_UINT64, enc->stored_size,
+            "check", G_TYPE_UINT, (guint) enc->check, NULL);
+#ifdef HAVE_DEFLATE_GET_DICTIONARY
+    {
+        GstBuffer *dict;
+        uInt len = 0;
+#if GST_CHECK_VERSION(1,0,0)
+        GstMapInfo map;
+
+        dict = gst_buffer_new_and_alloc (1 << MAX_WBITS);
+        gst_buffer_map (dict, &map, GST_MAP_WRITE);
+        deflateGetDictionary (&enc->stream, map.data, &len);
+        gst_buffer_unmap (dict, &map);
+        gst_buffer_resize (dict, 0, len);
+#else
+        dict = gst_buffer_new_and_alloc (1 << MAX_WBITS);
+        deflateGetDictionary (&enc->stream, GST_BUFFER_DATA (dict), &len);
+        GST_BUFFER_SIZE (dict) = len;
+#endif
+        gst_structure_set (s, "dictionary", GST_TYPE_BUFFER, dict, NULL);
+        gst_buffer_unref (dict);
+    }
+#endif
+    GST_DEBUG_OBJECT (enc, "Checkpoint %" GST_PTR_FORMAT, s);
+    gst_element_post_message (GST_ELEMENT (enc),
+            gst_message_new_element (GST_OBJECT (enc), s));
+    return GST_FLOW_OK;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+    static void
+gst_gzenc_cache_entry_free (GstGzencCacheEntry * entry)
+{
+    gst_buffer_unref (entry->in);
+    gst_buffer_unref (entry->out);
+    g_slice_free (GstGzencCacheEntry, entry);
+}
+
+/* Drop the least recently used entries above the cache size */
+    static void
+gst_gzenc_cache_trim (GstGzenc * enc, guint size)
+{
+    while (g_queue_get_length (&enc->cache_lru) > size)
+    {
+        GstGzencCacheEntry *entry = g_queue_pop_tail (&enc->cache_lru);
+
+        g_hash_table_remove (enc->cache, &entry->key);
+        gst_gzenc_cache_entry_free (entry);
+    }
+}
+
+/* The key covers the parameters the output depends on, so that changing
+ * them doesn't return stale output. Each memory is hashed where it is,
+ * seeded with the hash of the previous ones. FALSE if the input can't be
+ * mapped, the cache is not used then. */
+    static gboolean
+gst_gzenc_cache_key (GstGzenc * enc, GstBuffer * in, guint64 * result)
+{
+    guint64 key;
+    guint i, n;
+
+    key = (guint64) (enc->compression_level + 1) | (guint64) enc->memory_level << 8
+        | (guint64) gst_gzenc_zlib_strategy (enc->strategy,
+                enc->auto_strategy) << 16
+        | (guint64) enc->format << 24;
+    n = gst_buffer_n_memory (in);
+    for (i = 0; i < n; i++)
+    {
+        GstMemory *mem = gst_buffer_peek_memory (in, i);
+        GstMapInfo map;
+
+        if (!gst_memory_map (mem, &map, GST_MAP_READ))
+            return FALSE;
+        key = gst_gz_hash64 (map.data, map.size, key);
+        gst_memory_unmap (mem, &map);
+    }
+    *result = key;
+    return TRUE;
+}
+
+/* Whether the cached input has the same bytes as in */
+    static gboolean
+gst_gzenc_cache_match (GstBuffer * cached, GstBuffer * in)
+{
+    gsize offset = 0;
+    gboolean same = TRUE;
+    guint i, n;
+
+    if (gst_buffer_get_size (cached) != gst_buffer_get_size (in))
+        return FALSE;
+    n = gst_buffer_n_memory (in);
+    for (i = 0; i < n && same; i++)
+    {
+        GstMemory *mem = gst_buffer_peek_memory (in, i);
+        GstMapInfo map;
+
+        if (!gst_memory_map (mem, &map, GST_MAP_READ))
+            return FALSE;
+        same = gst_buffer_memcmp (cached, offset, map.data, map.size) == 0;
+        offset += map.size;
+        gst_memory_unmap (mem, &map);
+    }
+    return same;
+}
+
+/* Return the cached output of an input, NULL if it's not in the cache */
+    static GstBuffer *
+gst_gzenc_cache_lookup (GstGzenc * enc, guint64 key, GstBuffer * in)
+{
+    GList *link = g_hash_table_lookup (enc->cache, &key);
+    GstGzencCacheEntry *entry = link ? link->data : NULL;
+
+    if (entry && !gst_gzenc_cache_match (entry->in, in))
+    {
+        GST_DEBUG_OBJECT (enc, "Hash collision with a cached input");
+        entry = NULL;
+    }
+    GST_OBJECT_LOCK (enc);
+    enc->cache_lookups++;
+    if (entry)
+        enc->cache_hits++;
+    GST_OBJECT_UNLOCK (enc);
+    if (!entry)
+        return NULL;
+
+    g_queue_unlink (&enc->cache_lru, link);
+    g_queue_push_head_link (&enc->cache_lru, link);
+    return entry->out;
+}
+
+    static void
+gst_gzenc_cache_insert (GstGzenc * enc, guint64 key, GstBuffer * in,
+        GstBuffer * out)
+{
+    GstGzencCacheEntry *entry;
+    GstMapInfo map;
+    GList *link;
+    gsize size;
+
+    /* Same hash with another input, keep the newest one */
+    link = g_hash_table_lookup (enc->cache, &key);
+    if (link)
+    {
+        entry = link->data;
+        g_hash_table_remove (enc->cache, &key);
+        g_queue_delete_link (&enc->cache_lru, link);
+        gst_gzenc_cache_entry_free (entry);
+    }
+    gst_gzenc_cache_trim (enc, enc->cache_size - 1);
+
+    /* A copy of the bytes: upstream may reuse the memories of the input,
+     * e.g. from a buffer pool, and they are compared on the next hit */
+    size = gst_buffer_get_size (in);
+    entry = g_slice_new (GstGzencCacheEntry);
+    entry->key = key;
+    entry->in = gst_buffer_new_allocate (NULL, size, NULL);
+    gst_buffer_map (entry->in, &map, GST_MAP_WRITE);
+    gst_buffer_extract (in, 0, map.data, size);
+    gst_buffer_unmap (entry->in, &map);
+    entry->out = gst_buffer_ref (out);
+    g_queue_push_head (&enc->cache_lru, entry);
+    g_hash_table_insert (enc->cache, &entry->key, enc->cache_lru.head);
+}
+
+    static void
+gst_gzenc_cache_clear (GstGzenc * enc)
+{
+    gst_gzenc_cache_trim (enc, 0);
+    GST_OBJECT_LOCK (enc);
+    enc->cache_lookups = 0;
+    enc->cache_hits = 0;
+    GST_OBJECT_UNLOCK (enc);
+}
+
+/* Per-buffer mode: the input buffer is compressed into a complete stream
+ * pushed as one buffer, which can be decompressed on its own */
+    static GstFlowReturn
+gst_gzenc_compress_buffer (GstGzenc * enc, GstBuffer * in)
+{
+    GstBuffer *out, *cached;
+    GstMapInfo outmap;
+    guint64 key = 0;
+    gboolean cache;
+    gsize size;
+    guint i, n;
+    uInt avail_out;
+    int ret = Z_OK;
+
+    size = gst_buffer_get_size (in);
+    gst_gzenc_cache_trim (enc, enc->cache_size);
+    cache = enc->cache_size && gst_gzenc_cache_key (enc, in, &key);
+    if (cache)
+    {
+        cached = gst_gzenc_cache_lookup (enc, key, in);
+        if (cached)
+        {
+            GST_LOG_OBJECT (enc, "Cache hit for %" G_GSIZE_FORMAT " bytes", size);
+            /* The new buffer references the cached memory */
+            out = gst_buffer_copy (cached);
+            goto push;
+        }
+    }
+
+    deflateReset (&enc->stream);
+    /* A single output buffer is enough as no flush point is placed */
+    out = gst_gzenc_alloc_buffer (enc, deflateBound (&enc->stream, size));
+    gst_buffer_map (out, &outmap, GST_MAP_WRITE);
+    enc->stream.next_out = (void *) outmap.data;
+    enc->stream.avail_out = outmap.size;
+    GST_GZ_PROBE_ALLOC (enc, outmap.size);
+    n = gst_buffer_n_memory (in);
+    for (i = 0; i < n && ret == Z_OK; i++)
+    {
+        GstMemory *mem = gst_buffer_peek_memory (in, i);
+        GstMapInfo map;
+
+        if (!gst_memory_map (mem, &map, GST_MAP_READ))
+        {
+            ret = Z_STREAM_ERROR;
+            break;
+        }
+        enc->stream.next_in = (z_const Bytef *) map.data;
+        enc->stream.avail_in = map.size;
+        avail_out = enc->stream.avail_out;
+        GST_GZ_PROBE_CODEC_START (deflate, enc, map.size, avail_out);
+        ret = deflate (&enc->stream, i + 1 < n ? Z_NO_FLUSH : Z_FINISH);
+        GST_GZ_PROBE_CODEC_DONE (deflate, enc, map.size - enc->stream.avail_in,
+                avail_out - enc->stream.avail_out, ret);
+        gst_memory_unmap (mem, &map);
+    }
+    /* An empty buffer still gives a complete stream */
+    if (!n)
+        ret = deflate (&enc->stream, Z_FINISH);
+    gst_buffer_unmap (out, &outmap);
+    enc->stream.avail_in = 0;
+    if (ret != Z_STREAM_END)
+    {
+        GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
+                ("Failed to compress buffer (error code %i)", ret));
+        gst_buffer_unref (out);
+        return GST_FLOW_ERROR;
+    }
+    gst_buffer_resize (out, 0, gst_buffer_get_size (out) - enc->stream.avail_out);
+    if (cache)
+        gst_gzenc_cache_insert (enc, key, in, out);
+
+push:
+    /* Buffers map one to one, they keep the timestamps of the input */
+    GST_BUFFER_PTS (out) = GST_BUFFER_PTS (in);
+    GST_BUFFER_DTS (out) = GST_BUFFER_DTS (in);
+    GST_BUFFER_DURATION (out) = GST_BUFFER_DURATION (in);
+    GST_BUFFER_OFFSET (out) = enc->offset;
+    enc->offset += gst_buffer_get_size (out);
+    return gst_gzenc_pad_push (enc, out);
+}
+#endif
+
+/* Chunks compressed at a time in archive mode, one per thread of the
+ * worker pool. A job of the pool compresses its data itself: jobs waiting
+ * for other jobs could take all the threads. */
+    static guint
+gst_gzenc_archive_batch (GstGzenc * enc)
+{
+#if GST_CHECK_VERSION(1,0,0)
+    if (enc->use_pool)
+        return 1;
+#endif
+    return MAX (gst_gz_pool_get_n_threads (), 1);
+}
+
+    static GstFlowReturn
+gst_gzenc_archive_job (gpointer user_data, gpointer data)
+{
+    gst_gz_archive_deflate ((GstGzArchiveChunk *) data);
+    return GST_FLOW_OK;
+}
+
+/* Compress the full chunks of the data waiting, or all of it at the end of
+ * the stream, and push them in order. Each chunk can reference the 32 KiB
+ * before it and its output ends on a byte boundary, so the chunks are
+ * compressed in parallel and their outputs are simply concatenated. */
+    static GstFlowReturn
+gst_gzenc_archive_flush (GstGzenc * enc, gboolean final)
+{
+    GByteArray *pending = enc->archive_data;
+    GstFlowReturn flow;
+    GstGzArchiveChunk *chunks;
+    gsize size = pending->len - enc->archive_window, pos;
+    guint i, n, n_clients;
+
+    n = size / ARCHIVE_CHUNK_SIZE;
+    if (final && (!n || size % ARCHIVE_CHUNK_SIZE))
+        n++;
+    if (!n)
+        return GST_FLOW_OK;
+    flow = gst_gzenc_push_header (enc);
+    if (flow != GST_FLOW_OK)
+        return flow;
+
+    chunks = g_new0 (GstGzArchiveChunk, n);
+    pos = enc->archive_window;
+    for (i = 0; i < n; i++)
+    {
+        chunks[i].data = pending->data + pos;
+        chunks[i].size = MIN (ARCHIVE_CHUNK_SIZE, pending->len - pos);
+        chunks[i].window = pos;
+        chunks[i].iterations = enc->archive_iterations;
+        chunks[i].final = final && i == n - 1;
+        pos += chunks[i].size;
+    }
+
+    n_clients = n > 1 ? gst_gzenc_archive_batch (enc) : 1;
+    if (n_clients > 1)
+    {
+        if (!enc->archive_clients)
+        {
+            enc->n_archive_clients = n_clients;
+            enc->archive_clients = g_new0 (GstGzPoolClient *, n_clients);
+            for (i = 0; i < n_clients; i++)
+                enc->archive_clients[i] = gst_gz_pool_client_new (enc, 1);
+        }
+        for (i = 0; i < n; i++)
+            gst_gz_pool_client_push (enc->archive_clients[i % enc->n_archive_clients],
+                    gst_gzenc_archive_job, &chunks[i], NULL);
+    }
+    for (i = 0; i < n; i++)
+    {
+        /* The jobs still use the chunks after an error */
+        if (n_clients > 1)
+            gst_gz_pool_client_wait (enc->archive_clients[i % enc->n_archive_clients]);
+        else if (flow == GST_FLOW_OK)
+            gst_gz_archive_deflate (&chunks[i]);
+        if (flow == GST_FLOW_OK && !chunks[i].output)
+            flow = GST_FLOW_ERROR;
+        if (flow == GST_FLOW_OK)
+        {
+            GST_LOG_OBJECT (enc, "Chunk of %" G_GSIZE_FORMAT " bytes compressed "
+                    "to %u bytes", chunks[i].size, chunks[i].output->len);
+            flow = gst_gzenc_push_data (enc, chunks[i].output->data,
+                    chunks[i].output->len);
+        }
+        gst_gz_archive_chunk_clear (&chunks[i]);
+    }
+    g_free (chunks);
+
+    /* Keep the window of the next chunk */
+    pos = MIN (pending->len, ARCHIVE_WINDOW_SIZE);
+    g_byte_array_remove_range (pending, 0, pending->len - pos);
+    enc->archive_window = pos;
+    return flow;
+}
+
+/* Archive mode: the input is gathered until there is a chunk for each
+ * thread of the worker pool */
+    static GstFlowReturn
+gst_gzenc_archive_process (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    gsize limit = (gsize) gst_gzenc_archive_batch (enc) * ARCHIVE_CHUNK_SIZE;
+
+    gst_gzenc_update_check (enc, data, size);
+    while (size && flow == GST_FLOW_OK)
+    {
+        gsize pending = enc->archive_data->len - enc->archive_window;
+        gsize len = pending < limit ? MIN (size, limit - pending) : 0;
+
+        g_byte_array_append (enc->archive_data, data, len);
+        data += len;
+        size -= len;
+        if (pending + len >= limit)
+            flow = gst_gzenc_archive_flush (enc, FALSE);
+    }
+    return flow;
+}
+
+/* Compress a contiguous part of the input */
+    static GstFlowReturn
+gst_gzenc_process_data (GstGzenc * enc, const guint8 * data, gsize size)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    if (gst_gzenc_archive (enc))
+        return gst_gzenc_archive_process (enc, data, size);
+    if (enc->resumable)
+        gst_gzenc_update_check (enc, data, size);
+    if (enc->auto_store || enc->strategy == GST_GZENC_AUTO_STRATEGY)
+        flow = gst_gzenc_probe (enc, data, size);
+    if (flow != GST_FLOW_OK)
+        return flow;
+
+    if (enc->rsyncable)
+        flow = gst_gzenc_deflate_rsyncable (enc, data, size);
+    else if (size)
+    {
+        enc->stream.next_in = (z_const Bytef *) data;
+        enc->stream.avail_in = size;
+        flow = gst_gzenc_deflate (enc, Z_NO_FLUSH);
+    }
+    return flow;
+}
+
+/* Finish the compressed stream: compress what is left and write the
+ * trailer */
+    static GstFlowReturn
+gst_gzenc_finish (GstGzenc * enc)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    int r = Z_OK;
+
+    /* Every buffer was already a complete stream */
+    if (gst_gzenc_per_buffer (enc))
+        r = Z_STREAM_END;
+    else if (gst_gzenc_archive (enc))
+    {
+        guint8 trailer[8];
+        gsize n;
+
+        flow = gst_gzenc_archive_flush (enc, TRUE);
+        n = gst_gzenc_write_trailer (enc->format, enc->check,
+                enc->stored_size, trailer);
+        if (flow == GST_FLOW_OK && n)
+            flow = gst_gzenc_push_data (enc, trailer, n);
+        r = Z_STREAM_END;
+    }
+    else if (gst_gzenc_zero_copy (enc) || enc->resumable)
+    {
+        /* A last checkpoint allows to append to the stream */
+        if (enc->resumable)
+            flow = gst_gzenc_checkpoint (enc);
+        if (flow == GST_FLOW_OK)
+            flow = gst_gzenc_finish_framed (enc);
+        r = Z_STREAM_END;
+    }
+#if GST_CHECK_VERSION(1,0,0)
+    else if (enc->block_mode)
+    {
+        flow = gst_gzenc_deflate (enc, Z_FINISH);
+        r = Z_STREAM_END;
+    }
+#endif
+    while (r != Z_STREAM_END)
+    {
+        GstBuffer *out;
+#if GST_CHECK_VERSION(1,0,0)
+        GstMapInfo outmap;
+        guint n;
+
+        out = gst_gzenc_alloc_buffer (enc, OUTPUT_BUFFER_SIZE);
+
+        gst_buffer_map (out, &outmap, GST_MAP_WRITE);
+        enc->stream.next_out = (void *) outmap.data;
+        enc->stream.avail_out = outmap.size;
+#else
+        flow = gst_pad_alloc_buffer (enc->src, enc->offset,
+                OUTPUT_BUFFER_SIZE, GST_PAD_CAPS (enc->src), &out);
+
+        if (flow != GST_FLOW_OK) {
+            GST_DEBUG_OBJECT (enc, "pad alloc on EOS failed: %s",
+                    gst_flow_get_name (flow));
+            break;
+        }
+        enc->stream.next_out = (void *) GST_BUFFER_DATA (out);
+        enc->stream.avail_out = GST_BUFFER_SIZE (out);
+#endif
+        GST_GZ_PROBE_ALLOC (enc, enc->stream.avail_out);
+        GST_GZ_PROBE_CODEC_START (deflate, enc, enc->stream.avail_in,
+                enc->stream.avail_out);
+        r = deflate (&enc->stream, Z_FINISH);
+        GST_GZ_PROBE_CODEC_DONE (deflate, enc, 0,
+                OUTPUT_BUFFER_SIZE - enc->stream.avail_out, r);
+#if GST_CHECK_VERSION(1,0,0)
+        gst_buffer_unmap (out, &outmap);
+#endif
+        if ((r != Z_OK) && (r != Z_STREAM_END))
+        {
+            GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
+                    ("Failed to finish to compress (error code %i).", r));
+            gst_buffer_unref (out);
+            break;
+        }
+#if GST_CHECK_VERSION(1,0,0)
+        n = gst_buffer_get_size (out);
+        if (enc->stream.avail_out >= n)
+#else
+            if (enc->stream.avail_out >= GST_BUFFER_SIZE (out))
+#endif
+            {
+                gst_buffer_unref (out);
+                break;
+            }
+#if GST_CHECK_VERSION(1,0,0)
+        gst_buffer_resize (out, 0, n - enc->stream.avail_out);
+        n = gst_buffer_get_size (out);
+        GST_BUFFER_OFFSET (out) = enc->stream.total_out - n;
+#else
+        GST_BUFFER_SIZE (out) -= enc->stream.avail_out;
+        GST_BUFFER_OFFSET (out) =
+            enc->stream.total_out - GST_BUFFER_SIZE (out);
+#endif
+        flow = gst_gzenc_pad_push (enc, out);
+
+        if (flow != GST_FLOW_OK)
+        {
+            GST_DEBUG_OBJECT (enc, "push on EOS failed: %s",
+                    gst_flow_get_name (flow));
+            break;
+        }
+    }
+#if GST_CHECK_VERSION(1,0,0)
+    /* The last block is pushed before EOS */
+    if (flow == GST_FLOW_OK && r == Z_STREAM_END)
+        flow = gst_gzenc_block_finish (enc);
+#endif
+    /* A failed deflate() was reported already */
+    if (flow == GST_FLOW_OK && r != Z_STREAM_END)
+        flow = GST_FLOW_ERROR;
+    return flow;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+/* Whether the input should be pushed uncompressed: downstream prefers it,
+ * or it takes the output faster than bypass-if-bandwidth-above. The rate
+ * is measured over a window, the current mode is kept until it is over. */
+    static gboolean
+gst_gzenc_want_bypass (GstGzenc * enc)
+{
+    gint64 now;
+    guint64 rate;
+
+    if (!enc->bypass_accepted)
+        return FALSE;
+    if (enc->bypass_preferred)
+        return TRUE;
+    if (!enc->bypass_bandwidth)
+        return FALSE;
+
+    now = g_get_monotonic_time ();
+    /* The src pad task updates them with the worker pool */
+    GST_OBJECT_LOCK (enc);
+    if (!enc->push_start)
+        enc->push_start = now;
+    if (now - enc->push_start < BYPASS_WINDOW || !enc->push_bytes)
+    {
+        GST_OBJECT_UNLOCK (enc);
+        return enc->bypass;
+    }
+    rate = enc->push_time > 0 ? gst_util_uint64_scale (enc->push_bytes,
+            G_USEC_PER_SEC, enc->push_time) : G_MAXUINT64;
+    enc->push_start = now;
+    enc->push_bytes = 0;
+    enc->push_time = 0;
+    GST_OBJECT_UNLOCK (enc);
+    GST_LOG_OBJECT (enc, "Downstream took %" G_GUINT64_FORMAT " bytes/s",
+            rate);
+    return rate > enc->bypass_bandwidth;
+}
+
+/* Switch between compressing and pushing the input unchanged. The
+ * compressed stream is finished first, so that it can be decoded up to the
+ * switch, and a new one is started when compressing again. */
+    static GstFlowReturn
+gst_gzenc_set_bypass (GstGzenc * enc, gboolean bypass)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    GST_INFO_OBJECT (enc, "%s compression", bypass ? "Bypassing" : "Resuming");
+    if (bypass)
+    {
+        /* Don't write an empty stream */
+        if (enc->offset || enc->stream.total_in || enc->archive_data->len)
+            flow = gst_gzenc_finish (enc);
+        gst_gzenc_compress_init (enc);
+    }
+    enc->bypass = bypass;
+    gst_gzenc_set_src_caps (enc);
+    return flow;
+}
+#endif
+
+/* Compress an input buffer, the buffer is not consumed */
+    static GstFlowReturn
+gst_gzenc_process (GstGzenc * enc, GstBuffer * in)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    gsize size;
+#if GST_CHECK_VERSION(1,0,0)
+    guint i, n;
+#endif
+
+    if (!enc->ready)
+    {
+        GST_ELEMENT_ERROR (enc, LIBRARY, FAILED, (NULL), ("Compressor not ready."));
+        //gst_gzenc_compress_init (enc);
+        //gst_buffer_unref (out);
+#if GST_CHECK_VERSION(1,0,0)
+        return GST_FLOW_FLUSHING;
+#else
+        return GST_FLOW_WRONG_STATE;
+#endif
+    }
+
+    if (enc->renegotiate)
+    {
+        gst_gzenc_set_src_caps (enc);
+        /* New input caps, start again from their guess */
+        if (enc->strategy == GST_GZENC_AUTO_STRATEGY
+                && !gst_gzenc_zero_copy (enc))
+            flow = gst_gzenc_set_auto_strategy (enc,
+                    gst_gzenc_caps_strategy (enc->sink_caps));
+        if (flow != GST_FLOW_OK)
+            return flow;
+    }
+
+#if GST_CHECK_VERSION(1,0,0)
+    if (enc->allow_bypass)
+    {
+        /* The src pad task handles the reconfiguration with the worker
+         * pool, the allocation query must not be sent from here */
+        if (enc->use_pool)
+        {
+            if (g_atomic_int_compare_and_exchange (&enc->requery_bypass,
+                        TRUE, FALSE))
+                gst_gzenc_query_bypass (enc);
+        }
+        else if (gst_pad_check_reconfigure (enc->src))
+            gst_gzenc_reconfigure (enc);
+        if (gst_gzenc_want_bypass (enc) != enc->bypass)
+            flow = gst_gzenc_set_bypass (enc, !enc->bypass);
+        if (flow == GST_FLOW_OK && enc->bypass)
+            flow = gst_gzenc_pad_push (enc, gst_buffer_ref (in));
+        if (flow != GST_FLOW_OK || enc->bypass)
+            return flow;
+    }
+
+    if (gst_gzenc_per_buffer (enc))
+        return gst_gzenc_compress_buffer (enc, in);
+    /* The input is not mapped, the memories are referenced as they are */
+    if (gst_gzenc_zero_copy (enc))
+        return gst_gzenc_store (enc, in);
+#endif
+
+    if (enc->resumable)
+        flow = gst_gzenc_push_header (enc);
+
+#if GST_CHECK_VERSION(1,0,0)
+    /* Each memory is compressed where it is, mapping the whole buffer would
+     * merge the memories into a copy */
+    size = gst_buffer_get_size (in);
+    n = gst_buffer_n_memory (in);
+    for (i = 0; i < n && flow == GST_FLOW_OK; i++)
+    {
+        GstMemory *mem = gst_buffer_peek_memory (in, i);
+        GstMapInfo map;
+
+        if (!gst_memory_map (mem, &map, GST_MAP_READ))
+        {
+            GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
+                    ("Failed to map input memory."));
+            return GST_FLOW_ERROR;
+        }
+        flow = gst_gzenc_process_data (enc, map.data, map.size);
+        gst_memory_unmap (mem, &map);
+    }
+#else
+    size = GST_BUFFER_SIZE (in);
+    if (flow == GST_FLOW_OK)
+        flow = gst_gzenc_process_data (enc, GST_BUFFER_DATA (in), size);
+#endif
+
+    if (flow == GST_FLOW_OK && enc->resumable && enc->checkpoint_interval)
+    {
+        if (enc->checkpoint_countdown > size)
+            enc->checkpoint_countdown -= size;
+        else
+            flow = gst_gzenc_checkpoint (enc);
+    }
+    return flow;
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+    static GstGzencInput *
+gst_gzenc_input_new (GstBuffer * in, GList * profiles)
+{
+    GstGzencInput *input = g_slice_new0 (GstGzencInput);
+    GList *l;
+
+    input->ref_count = 1;
+    if (!gst_buffer_map (in, &input->map, GST_MAP_READ))
+    {
+        g_slice_free (GstGzencInput, input);
+        return NULL;
+    }
+    input->buffer = gst_buffer_ref (in);
+    /* The format of the running stream belongs to the pool job of the pad,
+     * the job computes the checksum itself if the format changes meanwhile */
+    for (l = profiles; l; l = l->next)
+    {
+        GstGzencProfile *profile = l->data;
+        GstGzencFormat format;
+
+        GST_OBJECT_LOCK (profile);
+        format = profile->format;
+        GST_OBJECT_UNLOCK (profile);
+
+        if (format == GST_GZENC_GZIP && !input->have_crc)
+        {
+            input->crc = crc32 (0L, input->map.data, input->map.size);
+            input->have_crc = TRUE;
+        }
+        else if (format == GST_GZENC_ZLIB && !input->have_adler)
+        {
+            input->adler = adler32 (1L, input->map.data, input->map.size);
+            input->have_adler = TRUE;
+        }
+    }
+    return input;
+}
+
+    static GstGzencInput *
+gst_gzenc_input_ref (GstGzencInput * input)
+{
+    g_atomic_int_inc (&input->ref_count);
+    return input;
+}
+
+    static void
+gst_gzenc_input_unref (GstGzencInput * input)
+{
+    if (!g_atomic_int_dec_and_test (&input->ref_count))
+        return;
+    gst_buffer_unmap (input->buffer, &input->map);
+    gst_buffer_unref (input->buffer);
+    g_slice_free (GstGzencInput, input);
+}
+
+    static GList *
+gst_gzenc_get_profiles (GstGzenc * enc)
+{
+    GList *profiles = NULL, *l;
+
+    GST_OBJECT_LOCK (enc);
+    for (l = enc->profiles; l; l = l->next)
+        profiles = g_list_prepend (profiles, gst_object_ref (l->data));
+    GST_OBJECT_UNLOCK (enc);
+    return g_list_reverse (profiles);
+}
+
+    static GstCaps *
+gst_gzenc_profile_caps (GstGzencProfile * profile)
+{
+    GstGzencFormat format;
+    GstCaps *caps;
+
+    GST_OBJECT_LOCK (profile);
+    format = profile->ready ? profile->stream_format : profile->format;
+    GST_OBJECT_UNLOCK (profile);
+
+    caps = gst_caps_new_simple ("application/x-gzip", "format", G_TYPE_STRING,
+            gst_gzenc_format_name (format), NULL);
+    if (profile->sink_caps && !gst_caps_is_any (profile->sink_caps)
+            && !gst_caps_is_empty (profile->sink_caps))
+        gst_caps_set_simple (caps, "original-caps", GST_TYPE_CAPS,
+                profile->sink_caps, NULL);
+    return caps;
+}
+
+    static void
+gst_gzenc_profile_set_caps (GstGzencProfile * profile)
+{
+    GstCaps *caps = gst_gzenc_profile_caps (profile);
+
+    if (!profile->src_caps || !gst_caps_is_equal (caps, profile->src_caps))
+    {
+        gst_caps_replace (&profile->src_caps, caps);
+        gst_gzenc_output_enqueue (&profile->output, GST_PAD (profile),
+                GST_MINI_OBJECT_CAST (gst_event_new_caps (caps)));
+    }
+    gst_caps_unref (caps);
+}
+
+    static void
+gst_gzenc_profile_stop (GstGzencProfile * profile)
+{
+    if (profile->ready)
+    {
+        (void)deflateEnd (&profile->stream);
+        memset (&profile->stream, 0, sizeof (profile->stream));
+        profile->ready = FALSE;
+    }
+    profile->offset = 0;
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_push (GstGzencProfile * profile, GstBuffer * out)
+{
+    GST_BUFFER_OFFSET (out) = profile->offset;
+    profile->offset += gst_buffer_get_size (out);
+    GST_BUFFER_OFFSET_END (out) = profile->offset;
+    return gst_gzenc_output_enqueue (&profile->output, GST_PAD (profile),
+            GST_MINI_OBJECT_CAST (out));
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_push_data (GstGzencProfile * profile, const guint8 * data,
+        gsize size)
+{
+    GstBuffer *out = gst_buffer_new_allocate (NULL, size, NULL);
+
+    gst_buffer_fill (out, 0, data, size);
+    return gst_gzenc_profile_push (profile, out);
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_start (GstGzencProfile * profile)
+{
+    guint8 header[10];
+    gsize size;
+    int strategy;
+
+    GST_OBJECT_LOCK (profile);
+    profile->stream_format = profile->format;
+    GST_OBJECT_UNLOCK (profile);
+    if (profile->strategy == GST_GZENC_AUTO_STRATEGY)
+        strategy = gst_gzenc_caps_strategy (profile->sink_caps);
+    else
+        strategy = gst_gzenc_zlib_strategy (profile->strategy,
+                Z_DEFAULT_STRATEGY);
+    memset (&profile->stream, 0, sizeof (profile->stream));
+    if (deflateInit2 (&profile->stream, profile->compression_level,
+                Z_DEFLATED, -MAX_WBITS, DEFAULT_MEMORY_LEVEL,
+                strategy) != Z_OK)
+    {
+        GST_ELEMENT_ERROR (GST_PAD_PARENT (profile), STREAM, ENCODE, (NULL),
+                ("Failed to start compression on %s", GST_PAD_NAME (profile)));
+        return GST_FLOW_ERROR;
+    }
+    profile->ready = TRUE;
+    profile->check = profile->stream_format == GST_GZENC_ZLIB ? 1 : 0;
+    profile->size = 0;
+
+    /* The format may have changed since the previous stream */
+    gst_gzenc_profile_set_caps (profile);
+    size = gst_gzenc_write_header (profile->stream_format, FALSE, header);
+    return size ? gst_gzenc_profile_push_data (profile, header, size)
+        : GST_FLOW_OK;
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_deflate (GstGzencProfile * profile, int flush)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    GstBuffer *out;
+    GstMapInfo map;
+    gsize n;
+    int ret;
+
+    do
+    {
+        out = gst_buffer_new_allocate (NULL, OUTPUT_BUFFER_SIZE, NULL);
+        if (!gst_buffer_map (out, &map, GST_MAP_WRITE))
+        {
+            gst_buffer_unref (out);
+            return GST_FLOW_ERROR;
+        }
+        profile->stream.next_out = map.data;
+        profile->stream.avail_out = map.size;
+        ret = deflate (&profile->stream, flush);
+        gst_buffer_unmap (out, &map);
+        if (ret == Z_STREAM_ERROR)
+        {
+            gst_buffer_unref (out);
+            GST_ELEMENT_ERROR (GST_PAD_PARENT (profile), STREAM, ENCODE,
+                    (NULL), ("Failed to compress data on %s",
+                        GST_PAD_NAME (profile)));
+            return GST_FLOW_ERROR;
+        }
+        n = OUTPUT_BUFFER_SIZE - profile->stream.avail_out;
+        if (!n)
+        {
+            gst_buffer_unref (out);
+            break;
+        }
+        gst_buffer_resize (out, 0, n);
+        flow = gst_gzenc_profile_push (profile, out);
+    } while (flow == GST_FLOW_OK && profile->stream.avail_out == 0);
+    return flow;
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_finish (GstGzencProfile * profile)
+{
+    GstFlowReturn flow = GST_FLOW_OK;
+    guint8 trailer[8];
+    gsize size;
+
+    /* An empty input still gives a complete stream */
+    if (!profile->ready)
+        flow = gst_gzenc_profile_start (profile);
+    if (flow == GST_FLOW_OK)
+        flow = gst_gzenc_profile_deflate (profile, Z_FINISH);
+    if (flow == GST_FLOW_OK)
+    {
+        size = gst_gzenc_write_trailer (profile->stream_format,
+                profile->check, profile->size, trailer);
+        if (size)
+            flow = gst_gzenc_profile_push_data (profile, trailer, size);
+    }
+    gst_gzenc_profile_stop (profile);
+    return flow;
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_process_job (gpointer user_data, gpointer data)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (user_data);
+    GstGzencInput *input = data;
+    const guint8 *bytes = input->map.data;
+    gsize size = input->map.size;
+    GstFlowReturn flow;
+
+    flow = gst_gz_pool_client_get_flow (profile->client);
+    if (flow != GST_FLOW_OK)
+        return flow;
+    if (!profile->ready)
+    {
+        flow = gst_gzenc_profile_start (profile);
+        if (flow != GST_FLOW_OK)
+            return flow;
+    }
+
+    /* The checksum of the input is combined with the one of the stream, it
+     * is only computed here when the format changed after it was queued */
+    if (profile->stream_format == GST_GZENC_GZIP)
+        profile->check = crc32_combine (profile->check, input->have_crc
+                ? input->crc : crc32 (0L, bytes, size), size);
+    else if (profile->stream_format == GST_GZENC_ZLIB)
+        profile->check = adler32_combine (profile->check, input->have_adler
+                ? input->adler : adler32 (1L, bytes, size), size);
+    profile->size += size;
+
+    profile->stream.next_in = (Bytef *) bytes;
+    profile->stream.avail_in = size;
+    flow = gst_gzenc_profile_deflate (profile, Z_NO_FLUSH);
+    profile->stream.next_in = NULL;
+    profile->stream.avail_in = 0;
+    /* Output was dropped, a new stream starts once the pad is linked */
+    if (flow == GST_FLOW_NOT_LINKED)
+        gst_gzenc_profile_stop (profile);
+    return flow;
+}
+
+    static GstFlowReturn
+gst_gzenc_profile_event_job (gpointer user_data, gpointer data)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (user_data);
+    GstEvent *e = GST_EVENT_CAST (data);
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    switch (GST_EVENT_TYPE (e))
+    {
+        case GST_EVENT_CAPS:
+            {
+                GstCaps *caps;
+
+                gst_event_parse_caps (e, &caps);
+                gst_caps_replace (&profile->sink_caps, caps);
+                gst_gzenc_profile_set_caps (profile);
+                return GST_FLOW_OK;
+            }
+        case GST_EVENT_EOS:
+            /* The stream is incomplete, the next push on the pad fails */
+            flow = gst_gzenc_profile_finish (profile);
+            if (flow != GST_FLOW_OK)
+                gst_gzenc_output_set_flow (&profile->output, flow);
+            break;
+        default:
+            break;
+    }
+    /* The job owns a reference that is released when the job is destroyed */
+    gst_gzenc_output_enqueue (&profile->output, GST_PAD (profile),
+            GST_MINI_OBJECT_CAST (gst_event_ref (e)));
+    return flow;
+}
+
+/* Task of a request pad */
+    static void
+gst_gzenc_profile_loop (GstPad * pad)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (pad);
+    GstMiniObject *obj;
+    GstFlowReturn flow = GST_FLOW_OK;
+
+    obj = gst_gzenc_output_pop (&profile->output, pad, &flow);
+    if (!obj)
+        return;
+    if (GST_IS_EVENT (obj))
+    {
+        gst_pad_push_event (pad, GST_EVENT_CAST (obj));
+        return;
+    }
+    /* Queued before downstream returned an error */
+    if (flow != GST_FLOW_OK)
+    {
+        gst_mini_object_unref (obj);
+        return;
+    }
+    flow = gst_pad_push (pad, GST_BUFFER_CAST (obj));
+    if (flow != GST_FLOW_OK)
+    {
+        GST_DEBUG_OBJECT (pad, "Push failed: %s", gst_flow_get_name (flow));
+        gst_gzenc_output_set_flow (&profile->output, flow);
+    }
+}
+
+/* The input keeps flowing as long as one of the src pads takes it, errors
+ * win whatever pad they come from. FLUSHING and NOT_LINKED from a request
+ * pad are turned into NOT_LINKED by gst_gzenc_profiles_chain(). */
+    static GstFlowReturn
+gst_gzenc_combine_flow (GstFlowReturn a, GstFlowReturn b)
+{
+    if (a == GST_FLOW_FLUSHING || a <= GST_FLOW_NOT_NEGOTIATED)
+        return a;
+    if (b == GST_FLOW_FLUSHING || b <= GST_FLOW_NOT_NEGOTIATED)
+        return b;
+    if (a == GST_FLOW_OK || b == GST_FLOW_OK)
+        return GST_FLOW_OK;
+    return a;
+}
+
+/* Queue the input on every profile. Returns GST_FLOW_NOT_LINKED when there
+ * is none, so that only the always src pad counts */
+    static GstFlowReturn
+gst_gzenc_profiles_chain (GstGzenc * enc, GstBuffer * in)
+{
+    GstFlowReturn flow = GST_FLOW_NOT_LINKED;
+    GstGzencInput *input;
+    GList *profiles, *l;
+
+    profiles = gst_gzenc_get_profiles (enc);
+    if (!profiles)
+        return flow;
+    input = gst_gzenc_input_new (in, profiles);
+    if (!input)
+    {
+        GST_ELEMENT_ERROR (enc, RESOURCE, READ, (NULL),
+                ("Failed to map the input buffer"));
+        g_list_free_full (profiles, gst_object_unref);
+        return GST_FLOW_ERROR;
+    }
+    for (l = profiles; l; l = l->next)
+    {
+        GstGzencProfile *profile = l->data;
+        GstFlowReturn pad_flow;
+
+        pad_flow = gst_gzenc_output_wait (&profile->output, GST_PAD (profile));
+        if (pad_flow == GST_FLOW_OK)
+        {
+            /* The jobs stop at the first error, the pad got linked since */
+            gst_gz_pool_client_clear_flow (profile->client,
+                    GST_FLOW_NOT_LINKED);
+            pad_flow = gst_gz_pool_client_push (profile->client,
+                    gst_gzenc_profile_process_job, gst_gzenc_input_ref (input),
+                    (GDestroyNotify) gst_gzenc_input_unref);
+        }
+        /* Only stops this pad, e.g. while it is being released */
+        if (pad_flow == GST_FLOW_FLUSHING)
+            pad_flow = GST_FLOW_NOT_LINKED;
+        flow = gst_gzenc_combine_flow (flow, pad_flow);
+    }
+    gst_gzenc_input_unref (input);
+    g_list_free_full (profiles, gst_object_unref);
+    return flow;
+}
+
+    static void
+gst_gzenc_profiles_event (GstGzenc * enc, GstEvent * e)
+{
+    GList *profiles, *l;
+
+    profiles = gst_gzenc_get_profiles (enc);
+    for (l = profiles; l; l = l->next)
+    {
+        GstGzencProfile *profile = l->data;
+
+        switch (GST_EVENT_TYPE (e))
+        {
+            case GST_EVENT_FLUSH_START:
+                gst_gz_pool_client_set_flushing (profile->client, TRUE);
+                gst_gzenc_output_set_flushing (&profile->output, TRUE);
+                /* Unblocks the task of the pad, which then pauses */
+                gst_pad_push_event (GST_PAD (profile), gst_event_ref (e));
+                break;
+            case GST_EVENT_FLUSH_STOP:
+                /* Waits for the running job */
+                gst_gz_pool_client_set_flushing (profile->client, FALSE);
+                gst_gzenc_profile_stop (profile);
+                gst_gzenc_output_set_flushing (&profile->output, FALSE);
+                gst_pad_push_event (GST_PAD (profile), gst_event_ref (e));
+                gst_pad_start_task (GST_PAD (profile),
+                        (GstTaskFunction) gst_gzenc_profile_loop, profile, NULL);
+                break;
+            default:
+                if (GST_EVENT_IS_SERIALIZED (e))
+                    gst_gz_pool_client_push (profile->client,
+                            gst_gzenc_profile_event_job, gst_event_ref (e),
+                            (GDestroyNotify) gst_event_unref);
+                else
+                    gst_pad_push_event (GST_PAD (profile), gst_event_ref (e));
+                break;
+        }
+    }
+    g_list_free_full (profiles, gst_object_unref);
+}
+
+    static gboolean
+gst_gzenc_collect_sticky (GstPad * pad, GstEvent ** event, gpointer user_data)
+{
+    GList **events = user_data;
+
+    *events = g_list_prepend (*events, gst_event_ref (*event));
+    return TRUE;
+}
+
+/* A pad requested during the stream gets the sticky events the sink pad
+ * received, with the caps of the profile instead of the input caps. They are
+ * pushed outside of gst_pad_sticky_events_foreach(), which holds the lock of
+ * the sink pad. */
+    static void
+gst_gzenc_profile_copy_sticky (GstGzenc * enc, GstGzencProfile * profile)
+{
+    GList *events = NULL, *l;
+
+    gst_pad_sticky_events_foreach (enc->sink, gst_gzenc_collect_sticky,
+            &events);
+    events = g_list_reverse (events);
+    for (l = events; l; l = l->next)
+    {
+        GstEvent *e = l->data;
+
+        if (GST_EVENT_TYPE (e) == GST_EVENT_CAPS)
+        {
+            GstCaps *caps;
+
+            gst_event_parse_caps (e, &caps);
+            gst_caps_replace (&profile->sink_caps, caps);
+            caps = gst_gzenc_profile_caps (profile);
+            gst_caps_replace (&profile->src_caps, caps);
+            gst_event_unref (e);
+            e = gst_event_new_caps (caps);
+            gst_caps_unref (caps);
+        }
+        gst_pad_push_event (GST_PAD (profile), e);
+    }
+    g_list_free (events);
+}
+
+    static gboolean
+gst_gzenc_profile_activate_mode (GstPad * pad, GstObject * parent,
+        GstPadMode mode, gboolean active)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (pad);
+
+    if (mode != GST_PAD_MODE_PUSH)
+        return FALSE;
+    if (active)
+    {
+        gst_gzenc_output_set_flushing (&profile->output, FALSE);
+        return gst_pad_start_task (pad,
+                (GstTaskFunction) gst_gzenc_profile_loop, pad, NULL);
+    }
+    gst_gzenc_output_set_flushing (&profile->output, TRUE);
+    return gst_pad_stop_task (pad);
+}
+
+    static void
+gst_gzenc_profile_init (GstGzencProfile * profile)
+{
+    profile->compression_level = DEFAULT_COMPRESSION_LEVEL;
+    profile->strategy = GST_GZENC_DEFAULT_STRATEGY;
+    profile->format = GST_GZENC_GZIP;
+    profile->client = gst_gz_pool_client_new (profile, MAX_POOL_JOBS);
+    gst_gzenc_output_init (&profile->output);
+    gst_pad_use_fixed_caps (GST_PAD (profile));
+    gst_pad_set_activatemode_function (GST_PAD (profile),
+            GST_DEBUG_FUNCPTR (gst_gzenc_profile_activate_mode));
+}
+
+    static void
+gst_gzenc_profile_finalize (GObject * object)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (object);
+
+    gst_gz_pool_client_free (profile->client);
+    gst_gzenc_profile_stop (profile);
+    gst_gzenc_output_clear (&profile->output);
+    if (profile->sink_caps)
+        gst_caps_unref (profile->sink_caps);
+    if (profile->src_caps)
+        gst_caps_unref (profile->src_caps);
+
+    G_OBJECT_CLASS (gst_gzenc_profile_parent_class)->finalize (object);
+}
+
+    static void
+gst_gzenc_profile_get_property (GObject * object, guint prop_id,
+        GValue * value, GParamSpec * pspec)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (object);
+
+    switch (prop_id)
+    {
+        case PROP_PROFILE_COMPRESSION_LEVEL:
+            g_value_set_int (value, profile->compression_level);
+            GST_DEBUG_OBJECT (profile, "Compression level is : %d", profile->compression_level);
             break;
-        }
-        enc->stream.next_out = (void *) GST_BUFFER_DATA (out);
-        enc->stream.avail_out = GST_BUFFER_SIZE (out);
+        case PROP_PROFILE_STRATEGY:
+            g_value_set_enum (value, profile->strategy);
+            GST_DEBUG_OBJECT (profile, "Strategy is : %d", profile->strategy);
+            break;
+        case PROP_PROFILE_FORMAT:
+            GST_OBJECT_LOCK (profile);
+            g_value_set_enum (value, profile->format);
+            GST_OBJECT_UNLOCK (profile);
+            GST_DEBUG_OBJECT (profile, "Format is : %d", g_value_get_enum (value));
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+            break;
+    }
+}
+
+/* The settings apply from the next stream, like the ones of the element */
+    static void
+gst_gzenc_profile_set_property (GObject * object, guint prop_id,
+        const GValue * value, GParamSpec * pspec)
+{
+    GstGzencProfile *profile = GST_GZENC_PROFILE (object);
+
+    switch (prop_id)
+    {
+        case PROP_PROFILE_COMPRESSION_LEVEL:
+            profile->compression_level = g_value_get_int (value);
+            GST_DEBUG_OBJECT (profile, "Compression level set to : %d", profile->compression_level);
+            break;
+        case PROP_PROFILE_STRATEGY:
+            profile->strategy = g_value_get_enum (value);
+            GST_DEBUG_OBJECT (profile, "Strategy set to : %d", profile->strategy);
+            break;
+        case PROP_PROFILE_FORMAT:
+            GST_OBJECT_LOCK (profile);
+            profile->format = g_value_get_enum (value);
+            GST_OBJECT_UNLOCK (profile);
+            GST_DEBUG_OBJECT (profile, "Format set to : %d", g_value_get_enum (value));
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+            break;
+    }
+}
+
+    static void
+gst_gzenc_profile_class_init (GstGzencProfileClass * klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->set_property = gst_gzenc_profile_set_property;
+    gobject_class->get_property = gst_gzenc_profile_get_property;
+    gobject_class->finalize = gst_gzenc_profile_finalize;
+
+    g_object_class_install_property (gobject_class, PROP_PROFILE_COMPRESSION_LEVEL,
+            g_param_spec_int ("compression-level", "Compression level", "Compression level of this pad, -1 or between 0 and 9 as for the element",
+                -1, 9, DEFAULT_COMPRESSION_LEVEL,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (gobject_class, PROP_PROFILE_STRATEGY,
+            g_param_spec_enum ("strategy", "Strategy", "Strategy of this pad, auto only picks from the caps of the input",
+                GST_TYPE_GZENC_STRATEGY, GST_GZENC_DEFAULT_STRATEGY,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (gobject_class, PROP_PROFILE_FORMAT,
+            g_param_spec_enum ("format", "Format", "Type of format generated on this pad",
+                GST_TYPE_GZENC_FORMAT, GST_GZENC_GZIP,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
 #endif
-        ret = deflate (&enc->stream, Z_NO_FLUSH);
+
+    static gboolean
+gst_gzenc_handle_event (GstGzenc * enc, GstEvent * e)
+{
+    gboolean ret;
+
+    switch (GST_EVENT_TYPE (e))
+    {
 #if GST_CHECK_VERSION(1,0,0)
-        gst_buffer_unmap (out, &outmap);
+        case GST_EVENT_CAPS:
+            {
+                GstCaps *caps;
+
+                gst_event_parse_caps (e, &caps);
+                gst_gzenc_store_sink_caps (enc, caps);
+                gst_gzenc_set_src_caps (enc);
+                /* The uncompressed caps are not forwarded as such */
+                gst_event_unref (e);
+                ret = TRUE;
+                break;
+            }
 #endif
-        if (ret == Z_STREAM_ERROR)
-        {
-            GST_ELEMENT_ERROR (enc, STREAM, ENCODE, (NULL),
-                    ("Failed to compress data (error code %i)", ret));
-            gst_gzenc_compress_init (enc);
-            gst_buffer_unref (out);
-            flow = GST_FLOW_ERROR;
-            goto done;
-        }
+        case GST_EVENT_EOS:
+            {
+                GstFlowReturn flow = GST_FLOW_OK;
+
+                /* Nothing was compressed since the bypass started */
+                if (!enc->bypass)
+                    flow = gst_gzenc_finish (enc);
 #if GST_CHECK_VERSION(1,0,0)
-        n = gst_buffer_get_size (out);
+                ret = gst_gzenc_push_event (enc, e);
 #else
-        n = GST_BUFFER_SIZE (out);
+                ret = gst_pad_event_default (enc->sink, e);
+#endif
+                if (flow != GST_FLOW_OK)
+                {
+                    ret = FALSE;
+                }
+
+                /* The checkpoint only applies to the stream it resumed */
+                if (enc->resume)
+                {
+                    gst_structure_free (enc->resume);
+                    enc->resume = NULL;
+                }
+                gst_gzenc_compress_init (enc);
+                break;
+            }
+        default:
+#if GST_CHECK_VERSION(1,0,0)
+            /* The profiles get the event from gst_gzenc_profiles_event() */
+            ret = gst_gzenc_push_event (enc, e);
+#else
+            ret = gst_pad_event_default (enc->sink, e);
 #endif
-        if (enc->stream.avail_out >= n) {
-            gst_buffer_unref (out);
             break;
-        }
+    }
+    return ret;
+}
+
+    static GstFlowReturn
+gst_gzenc_process_job (gpointer user_data, gpointer data)
+{
+    GstGzenc *enc = GST_GZENC (user_data);
+    GstFlowReturn flow;
+
+    /* Stop compressing once downstream returned an error */
+    flow = gst_gz_pool_client_get_flow (enc->pool_client);
+    if (flow != GST_FLOW_OK)
+        return flow;
+    return gst_gzenc_process (enc, GST_BUFFER_CAST (data));
+}
+
+    static GstFlowReturn
+gst_gzenc_event_job (gpointer user_data, gpointer data)
+{
+    GstGzenc *enc = GST_GZENC (user_data);
+
+    /* The job owns a reference that is released when the job is destroyed */
+    gst_gzenc_handle_event (enc, gst_event_ref (GST_EVENT_CAST (data)));
+    return GST_FLOW_OK;
+}
+
+static gboolean
 #if GST_CHECK_VERSION(1,0,0)
-        gst_buffer_resize (out, 0, n - enc->stream.avail_out);
-        n = gst_buffer_get_size (out);
-        GST_BUFFER_OFFSET (out) = enc->stream.total_out - n;
+gst_gzenc_event (GstPad * pad, GstObject * parent, GstEvent * e)
 #else
-        GST_BUFFER_SIZE (out) -= enc->stream.avail_out;
-        GST_BUFFER_OFFSET (out) = enc->stream.total_out - GST_BUFFER_SIZE (out);
-        n = GST_BUFFER_SIZE (out);
+gst_gzenc_event (GstPad * pad, GstEvent * e)
 #endif
-        flow = gst_pad_push (enc->src, out);
+{
+    GstGzenc *enc;
+    gboolean ret = TRUE;
 
-        if (flow != GST_FLOW_OK)
-            break;
+#if GST_CHECK_VERSION(1,0,0)
+    enc = GST_GZENC (parent);
+    gst_gzenc_profiles_event (enc, e);
+#else
+    enc = GST_GZENC (gst_pad_get_parent (pad));
+#endif
+#if GST_CHECK_VERSION(1,0,0)
+    if (!enc->use_pool)
+        ret = gst_gzenc_handle_event (enc, e);
+    else if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_START)
+    {
+        gst_gz_pool_client_set_flushing (enc->pool_client, TRUE);
+        gst_gzenc_output_set_flushing (&enc->output, TRUE);
+        /* Unblocks the src pad task, which then pauses */
+        ret = gst_gzenc_handle_event (enc, e);
+    }
+    else if (GST_EVENT_TYPE (e) == GST_EVENT_FLUSH_STOP)
+    {
+        /* Waits for the running job, its output is dropped */
+        gst_gz_pool_client_set_flushing (enc->pool_client, FALSE);
+        gst_gzenc_output_set_flushing (&enc->output, FALSE);
+        ret = gst_gzenc_handle_event (enc, e);
+        gst_pad_start_task (enc->src, (GstTaskFunction) gst_gzenc_output_loop,
+                enc->src, NULL);
+    }
+    else if (GST_EVENT_IS_SERIALIZED (e))
+    {
+        /* Keep the event in order with the buffers being compressed */
+        gst_gz_pool_client_push (enc->pool_client, gst_gzenc_event_job, e,
+                (GDestroyNotify) gst_event_unref);
+    }
+    else
+        ret = gst_gzenc_handle_event (enc, e);
+#else
+    ret = gst_gzenc_handle_event (enc, e);
+    gst_object_unref (enc);
+#endif
+    return ret;
+}
 
-        enc->offset += n;
+#if GST_CHECK_VERSION(1,0,0)
+/* With allow-bypass, the uncompressed caps are offered after the compressed
+ * ones */
+    static gboolean
+gst_gzenc_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+    GstGzenc *enc = GST_GZENC (parent);
+    GstCaps *filter, *caps, *raw = NULL;
+
+    if (GST_QUERY_TYPE (query) != GST_QUERY_CAPS || !enc->allow_bypass)
+        return gst_pad_query_default (pad, parent, query);
+
+    GST_OBJECT_LOCK (enc);
+    if (gst_gzenc_have_sink_caps (enc))
+        raw = gst_caps_ref (enc->sink_caps);
+    GST_OBJECT_UNLOCK (enc);
+    if (!raw)
+        raw = gst_pad_peer_query_caps (enc->sink, NULL);
+    caps = gst_caps_merge (gst_pad_get_pad_template_caps (pad), raw);
+
+    gst_query_parse_caps (query, &filter);
+    if (filter)
+    {
+        GstCaps *tmp = gst_caps_intersect_full (filter, caps,
+                GST_CAPS_INTERSECT_FIRST);
+
+        gst_caps_unref (caps);
+        caps = tmp;
     }
+    GST_LOG_OBJECT (enc, "Returning caps %" GST_PTR_FORMAT, caps);
+    gst_query_set_caps_result (query, caps);
+    gst_caps_unref (caps);
+    return TRUE;
+}
+#endif
 
-done:
+static GstFlowReturn
 #if GST_CHECK_VERSION(1,0,0)
-    gst_buffer_unmap (in, &map);
+gst_gzenc_chain (GstPad * pad, GstObject * parent, GstBuffer * in)
+#else
+gst_gzenc_chain (GstPad * pad, GstBuffer * in)
 #endif
+{
+    GstGzenc *enc;
+    GstFlowReturn flow;
+#if GST_CHECK_VERSION(1,0,0)
+    GstFlowReturn profiles_flow;
+
+    enc = GST_GZENC (parent);
+    profiles_flow = gst_gzenc_profiles_chain (enc, in);
+
+    if (enc->use_pool)
+    {
+        /* Return right away, the buffer is compressed by the worker pool
+         * and the output pushed by the src pad task */
+        flow = gst_gzenc_output_wait (&enc->output, enc->src);
+        if (flow == GST_FLOW_OK)
+        {
+            /* The jobs stop at the first error, downstream got linked */
+            gst_gz_pool_client_clear_flow (enc->pool_client,
+                    GST_FLOW_NOT_LINKED);
+            flow = gst_gz_pool_client_push (enc->pool_client,
+                    gst_gzenc_process_job, in, (GDestroyNotify) gst_buffer_unref);
+        }
+        else
+            gst_buffer_unref (in);
+    }
+    else
+    {
+        flow = gst_gzenc_process (enc, in);
+        gst_buffer_unref (in);
+    }
+    return gst_gzenc_combine_flow (flow, profiles_flow);
+#else
+    enc = GST_GZENC (GST_PAD_PARENT (pad));
+    flow = gst_gzenc_process (enc, in);
     gst_buffer_unref (in);
     return flow;
-
+#endif
 }
 
 static void
@@ -492,17 +3403,49 @@ gst_gzenc_init (GstGzenc * enc, GstGzencClass * klass)
     enc->sink = gst_pad_new_from_static_template (&sink_template, "sink");
     gst_pad_set_chain_function (enc->sink, GST_DEBUG_FUNCPTR (gst_gzenc_chain));
     gst_pad_set_event_function (enc->sink, GST_DEBUG_FUNCPTR (gst_gzenc_event));
+#if !GST_CHECK_VERSION(1,0,0)
+    gst_pad_set_setcaps_function (enc->sink, GST_DEBUG_FUNCPTR (gst_gzenc_sink_setcaps));
+#endif
     gst_element_add_pad (GST_ELEMENT (enc), enc->sink);
 
     enc->src = gst_pad_new_from_static_template (&src_template, "src");
     gst_pad_set_caps (enc->src, gst_static_pad_template_get_caps (&src_template));
     gst_pad_use_fixed_caps (enc->src);
+#if GST_CHECK_VERSION(1,0,0)
+    gst_pad_set_query_function (enc->src, GST_DEBUG_FUNCPTR (gst_gzenc_src_query));
+    gst_pad_set_activatemode_function (enc->src,
+            GST_DEBUG_FUNCPTR (gst_gzenc_src_activate_mode));
+    gst_gzenc_output_init (&enc->output);
+#endif
     gst_element_add_pad (GST_ELEMENT (enc), enc->src);
 
     enc->compression_level = DEFAULT_COMPRESSION_LEVEL;
     enc->memory_level = DEFAULT_MEMORY_LEVEL;
     enc->format = DEFAULT_FORMAT;
     enc->strategy = DEFAULT_STRATEGY;
+    enc->worker_pool = DEFAULT_WORKER_POOL;
+    enc->auto_store = DEFAULT_AUTO_STORE;
+    enc->rsyncable = DEFAULT_RSYNCABLE;
+    enc->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    enc->resume = NULL;
+    enc->probe_ready = FALSE;
+    enc->probe_out = NULL;
+    enc->sink_caps = NULL;
+    enc->renegotiate = TRUE;
+    enc->pool_client = gst_gz_pool_client_new (enc, MAX_POOL_JOBS);
+    enc->per_buffer = DEFAULT_PER_BUFFER;
+    enc->cache_size = DEFAULT_CACHE_SIZE;
+    enc->cache = g_hash_table_new (g_int64_hash, g_int64_equal);
+    g_queue_init (&enc->cache_lru);
+    enc->archive = DEFAULT_ARCHIVE;
+    enc->archive_iterations = DEFAULT_ARCHIVE_ITERATIONS;
+    enc->archive_data = g_byte_array_new ();
+    enc->archive_clients = NULL;
+    enc->n_archive_clients = 0;
+    enc->block_size = DEFAULT_BLOCK_SIZE;
+    enc->output_alignment = DEFAULT_OUTPUT_ALIGNMENT;
+    enc->allow_bypass = DEFAULT_ALLOW_BYPASS;
+    enc->bypass_bandwidth = DEFAULT_BYPASS_IF_BANDWIDTH_ABOVE;
     gst_gzenc_compress_init (enc);
 }
 
@@ -510,8 +3453,35 @@ gst_gzenc_init (GstGzenc * enc, GstGzencClass * klass)
 gst_gzenc_finalize (GObject * object)
 {
     GstGzenc *enc = GST_GZENC (object);
+    guint i;
+
     GST_DEBUG_OBJECT (enc, "Finalize gzenc");
+    gst_gz_pool_client_free (enc->pool_client);
+    for (i = 0; i < enc->n_archive_clients; i++)
+        gst_gz_pool_client_free (enc->archive_clients[i]);
+    g_free (enc->archive_clients);
+    g_byte_array_unref (enc->archive_data);
     gst_gzenc_compress_end (enc);
+    if (enc->probe_ready)
+        (void)deflateEnd (&enc->probe);
+    g_free (enc->probe_out);
+    if (enc->sink_caps)
+        gst_caps_unref (enc->sink_caps);
+#if GST_CHECK_VERSION(1,0,0)
+    if (enc->allocator)
+        gst_object_unref (enc->allocator);
+    gst_gzenc_output_clear (&enc->output);
+#endif
+    if (enc->resume)
+        gst_structure_free (enc->resume);
+#if GST_CHECK_VERSION(1,0,0)
+    gst_gzenc_cache_clear (enc);
+#endif
+    g_hash_table_unref (enc->cache);
+#if GST_CHECK_VERSION(1,0,0)
+    gst_gzenc_block_clear (enc);
+    g_list_free (enc->profiles);
+#endif
 
     G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -540,6 +3510,65 @@ gst_gzenc_get_property (GObject * object, guint prop_id,
             g_value_set_enum (value, enc->format);
             GST_DEBUG_OBJECT (enc, "Format is : %d", enc->format);
             break;
+        case PROP_WORKER_POOL:
+            g_value_set_boolean (value, enc->worker_pool);
+            GST_DEBUG_OBJECT (enc, "Worker pool is : %d", enc->worker_pool);
+            break;
+        case PROP_AUTO_STORE:
+            g_value_set_boolean (value, enc->auto_store);
+            GST_DEBUG_OBJECT (enc, "Auto store is : %d", enc->auto_store);
+            break;
+        case PROP_RSYNCABLE:
+            g_value_set_boolean (value, enc->rsyncable);
+            GST_DEBUG_OBJECT (enc, "Rsyncable is : %d", enc->rsyncable);
+            break;
+        case PROP_CHECKPOINT_INTERVAL:
+            g_value_set_uint64 (value, enc->checkpoint_interval);
+            GST_DEBUG_OBJECT (enc, "Checkpoint interval is : %" G_GUINT64_FORMAT, enc->checkpoint_interval);
+            break;
+        case PROP_RESUME_CHECKPOINT:
+            g_value_set_boxed (value, enc->resume);
+            GST_DEBUG_OBJECT (enc, "Resume checkpoint is : %" GST_PTR_FORMAT, enc->resume);
+            break;
+        case PROP_PER_BUFFER:
+            g_value_set_boolean (value, enc->per_buffer);
+            GST_DEBUG_OBJECT (enc, "Per buffer is : %d", enc->per_buffer);
+            break;
+        case PROP_CACHE_SIZE:
+            g_value_set_uint (value, enc->cache_size);
+            GST_DEBUG_OBJECT (enc, "Cache size is : %u", enc->cache_size);
+            break;
+        case PROP_CACHE_HIT_RATE:
+            GST_OBJECT_LOCK (enc);
+            g_value_set_double (value, enc->cache_lookups ?
+                    (gdouble) enc->cache_hits / enc->cache_lookups : 0.0);
+            GST_OBJECT_UNLOCK (enc);
+            GST_DEBUG_OBJECT (enc, "Cache hit rate is : %f", g_value_get_double (value));
+            break;
+        case PROP_ARCHIVE:
+            g_value_set_boolean (value, enc->archive);
+            GST_DEBUG_OBJECT (enc, "Archive is : %d", enc->archive);
+            break;
+        case PROP_ARCHIVE_ITERATIONS:
+            g_value_set_uint (value, enc->archive_iterations);
+            GST_DEBUG_OBJECT (enc, "Archive iterations is : %u", enc->archive_iterations);
+            break;
+        case PROP_BLOCK_SIZE:
+            g_value_set_uint (value, enc->block_size);
+            GST_DEBUG_OBJECT (enc, "Block size is : %u", enc->block_size);
+            break;
+        case PROP_OUTPUT_ALIGNMENT:
+            g_value_set_uint (value, enc->output_alignment);
+            GST_DEBUG_OBJECT (enc, "Output alignment is : %u", enc->output_alignment);
+            break;
+        case PROP_ALLOW_BYPASS:
+            g_value_set_boolean (value, enc->allow_bypass);
+            GST_DEBUG_OBJECT (enc, "Allow bypass is : %d", enc->allow_bypass);
+            break;
+        case PROP_BYPASS_IF_BANDWIDTH_ABOVE:
+            g_value_set_uint64 (value, enc->bypass_bandwidth);
+            GST_DEBUG_OBJECT (enc, "Bypass if bandwidth above is : %" G_GUINT64_FORMAT, enc->bypass_bandwidth);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -570,19 +3599,201 @@ gst_gzenc_set_property (GObject * object, guint prop_id,
         case PROP_FORMAT:
             enc->format = g_value_get_enum (value);
             GST_DEBUG_OBJECT (enc, "Format set to : %d",enc->format);
+            enc->renegotiate = TRUE;
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_WORKER_POOL:
+            /* Let the queued buffers go through before switching */
+            gst_gz_pool_client_wait (enc->pool_client);
+            enc->worker_pool = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (enc, "Worker pool set to : %d", enc->worker_pool);
+            break;
+        case PROP_AUTO_STORE:
+            enc->auto_store = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (enc, "Auto store set to : %d", enc->auto_store);
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_RSYNCABLE:
+            enc->rsyncable = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (enc, "Rsyncable set to : %d", enc->rsyncable);
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_CHECKPOINT_INTERVAL:
+            enc->checkpoint_interval = g_value_get_uint64 (value);
+            GST_DEBUG_OBJECT (enc, "Checkpoint interval set to : %" G_GUINT64_FORMAT, enc->checkpoint_interval);
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_RESUME_CHECKPOINT:
+            if (enc->resume)
+                gst_structure_free (enc->resume);
+            enc->resume = g_value_dup_boxed (value);
+            GST_DEBUG_OBJECT (enc, "Resume checkpoint set to : %" GST_PTR_FORMAT, enc->resume);
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_PER_BUFFER:
+            enc->per_buffer = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (enc, "Per buffer set to : %d", enc->per_buffer);
             gst_gzenc_compress_init (enc);
             break;
+        case PROP_CACHE_SIZE:
+            enc->cache_size = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (enc, "Cache size set to : %u", enc->cache_size);
+            break;
+        case PROP_ARCHIVE:
+            enc->archive = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (enc, "Archive set to : %d", enc->archive);
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_ARCHIVE_ITERATIONS:
+            enc->archive_iterations = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (enc, "Archive iterations set to : %u", enc->archive_iterations);
+            break;
+        case PROP_BLOCK_SIZE:
+            enc->block_size = g_value_get_uint (value);
+            GST_DEBUG_OBJECT (enc, "Block size set to : %u", enc->block_size);
+            gst_gzenc_compress_init (enc);
+            break;
+        case PROP_OUTPUT_ALIGNMENT:
+            enc->output_alignment = g_value_get_uint (value);
+            /* Allocators take the alignment as a mask */
+            if (enc->output_alignment & (enc->output_alignment - 1))
+            {
+                GST_WARNING_OBJECT (enc, "Output alignment %u is not a power "
+                        "of two, rounding it up", enc->output_alignment);
+                enc->output_alignment = 1U << g_bit_storage (enc->output_alignment);
+            }
+            GST_DEBUG_OBJECT (enc, "Output alignment set to : %u", enc->output_alignment);
+            break;
+        case PROP_ALLOW_BYPASS:
+            enc->allow_bypass = g_value_get_boolean (value);
+            GST_DEBUG_OBJECT (enc, "Allow bypass set to : %d", enc->allow_bypass);
+            /* The caps change, with or without the compressed field */
+            enc->renegotiate = TRUE;
+            break;
+        case PROP_BYPASS_IF_BANDWIDTH_ABOVE:
+            enc->bypass_bandwidth = g_value_get_uint64 (value);
+            GST_DEBUG_OBJECT (enc, "Bypass if bandwidth above set to : %" G_GUINT64_FORMAT, enc->bypass_bandwidth);
+            enc->push_start = 0;
+            enc->push_bytes = 0;
+            enc->push_time = 0;
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
 }
 
+#if GST_CHECK_VERSION(1,0,0)
+    static GstPad *
+gst_gzenc_request_new_pad (GstElement * element, GstPadTemplate * templ,
+        const gchar * name, const GstCaps * caps)
+{
+    GstGzenc *enc = GST_GZENC (element);
+    GstGzencProfile *profile;
+    gchar *pad_name;
+
+    GST_OBJECT_LOCK (enc);
+    if (name)
+        pad_name = g_strdup (name);
+    else
+        pad_name = g_strdup_printf ("src_%u", enc->next_profile++);
+    GST_OBJECT_UNLOCK (enc);
+
+    profile = g_object_new (GST_TYPE_GZENC_PROFILE, "name", pad_name,
+            "direction", GST_PAD_SRC, "template", templ, NULL);
+    g_free (pad_name);
+    if (!gst_element_add_pad (element, GST_PAD (profile)))
+    {
+        gst_object_unref (profile);
+        return NULL;
+    }
+    gst_gzenc_profile_copy_sticky (enc, profile);
+
+    GST_OBJECT_LOCK (enc);
+    enc->profiles = g_list_append (enc->profiles, profile);
+    GST_OBJECT_UNLOCK (enc);
+    GST_DEBUG_OBJECT (enc, "Added profile %s", GST_PAD_NAME (profile));
+    return GST_PAD (profile);
+}
+
+    static void
+gst_gzenc_release_pad (GstElement * element, GstPad * pad)
+{
+    GstGzenc *enc = GST_GZENC (element);
+    GstGzencProfile *profile = GST_GZENC_PROFILE (pad);
+
+    GST_OBJECT_LOCK (enc);
+    enc->profiles = g_list_remove (enc->profiles, profile);
+    GST_OBJECT_UNLOCK (enc);
+
+    /* Drop the queued jobs and wait for the running one, which returns as
+     * soon as the pad is inactive */
+    gst_gz_pool_client_set_flushing (profile->client, TRUE);
+    gst_pad_set_active (pad, FALSE);
+    gst_gz_pool_client_set_flushing (profile->client, FALSE);
+    gst_element_remove_pad (element, pad);
+}
+
+    static void
+gst_gzenc_profiles_reset (GstGzenc * enc)
+{
+    GList *profiles, *l;
+
+    profiles = gst_gzenc_get_profiles (enc);
+    for (l = profiles; l; l = l->next)
+    {
+        GstGzencProfile *profile = l->data;
+
+        gst_gz_pool_client_set_flushing (profile->client, TRUE);
+        gst_gz_pool_client_set_flushing (profile->client, FALSE);
+        gst_gzenc_profile_stop (profile);
+        /* The pad dropped its sticky events when it was deactivated */
+        gst_caps_replace (&profile->src_caps, NULL);
+    }
+    g_list_free_full (profiles, gst_object_unref);
+}
+#endif
+
+    static GstStateChangeReturn
+gst_gzenc_change_state (GstElement * element, GstStateChange transition)
+{
+    GstGzenc *enc = GST_GZENC (element);
+    GstStateChangeReturn ret;
+
+    ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+    if (ret == GST_STATE_CHANGE_FAILURE)
+        return ret;
+
+    switch (transition) {
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            /* Drop what is still queued on the worker pool */
+            gst_gz_pool_client_set_flushing (enc->pool_client, TRUE);
+            gst_gz_pool_client_set_flushing (enc->pool_client, FALSE);
+#if GST_CHECK_VERSION(1,0,0)
+            gst_gzenc_cache_clear (enc);
+            gst_gzenc_profiles_reset (enc);
+#endif
+            enc->bypass = FALSE;
+            enc->push_start = 0;
+            enc->push_bytes = 0;
+            enc->push_time = 0;
+            break;
+        default:
+            break;
+    }
+    return ret;
+}
+
     static void
 gst_gzenc_class_init (GstGzencClass * klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
-#if GST_CHECK_VERSION(1,0,0)
     GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+
+    gstelement_class->change_state = GST_DEBUG_FUNCPTR (gst_gzenc_change_state);
+#if GST_CHECK_VERSION(1,0,0)
+    gstelement_class->request_new_pad =
+        GST_DEBUG_FUNCPTR (gst_gzenc_request_new_pad);
+    gstelement_class->release_pad = GST_DEBUG_FUNCPTR (gst_gzenc_release_pad);
 #endif
     gobject_class->set_property = gst_gzenc_set_property;
     gobject_class->get_property = gst_gzenc_get_property;
@@ -605,11 +3816,69 @@ gst_gzenc_class_init (GstGzencClass * klass)
             g_param_spec_enum ("format", "Format", "Type of format generated",
                 GST_TYPE_GZENC_FORMAT, GST_GZENC_GZIP,
                 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_WORKER_POOL,
+            g_param_spec_boolean ("worker-pool", "Worker pool", "Compress on the process-wide worker pool shared by all gz elements instead of the streaming thread (see GST_GZ_MAX_THREADS and GST_GZ_CPU_AFFINITY)",
+                DEFAULT_WORKER_POOL,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_AUTO_STORE,
+            g_param_spec_boolean ("auto-store", "Auto store", "Probe the input every MiB by trial compression and use stored blocks (level 0) while it looks incompressible, e.g. for already compressed or encrypted payloads",
+                DEFAULT_AUTO_STORE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_RSYNCABLE,
+            g_param_spec_boolean ("rsyncable", "Rsyncable", "Reset the compressor at points chosen by a rolling hash of the input, so that unchanged parts of the input give the same compressed bytes (like gzip --rsyncable)",
+                DEFAULT_RSYNCABLE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_CHECKPOINT_INTERVAL,
+            g_param_spec_uint64 ("checkpoint-interval", "Checkpoint interval", "Post a gzenc-checkpoint element message every this many input bytes and at the end of the stream, with the state needed to resume the stream after a restart (0 = disabled)",
+                0, G_MAXUINT64, DEFAULT_CHECKPOINT_INTERVAL,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_RESUME_CHECKPOINT,
+            g_param_spec_boxed ("resume-checkpoint", "Resume checkpoint", "Structure of a gzenc-checkpoint message: the stream continues the one the checkpoint was taken from, the output has to be written after its first offset bytes. Cleared at the end of the stream",
+                GST_TYPE_STRUCTURE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_PER_BUFFER,
+            g_param_spec_boolean ("per-buffer", "Per buffer", "Compress each input buffer into a complete stream pushed as one buffer, which can be decompressed on its own (GStreamer 1.0 only)",
+                DEFAULT_PER_BUFFER,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_CACHE_SIZE,
+            g_param_spec_uint ("cache-size", "Cache size", "In per-buffer mode, keep the output of this many recent inputs and push it again by reference when the same input comes back (0 = disabled)",
+                0, G_MAXUINT, DEFAULT_CACHE_SIZE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_CACHE_HIT_RATE,
+            g_param_spec_double ("cache-hit-rate", "Cache hit rate", "Fraction of the input buffers found in the cache since the element started",
+                0.0, 1.0, 0.0,
+                G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_ARCHIVE,
+            g_param_spec_boolean ("archive", "Archive", "Maximum compression for cold storage: zopfli-like optimal parsing and block splitting, much slower than level 9 and a few percent smaller. 1 MiB chunks are compressed in parallel on the worker pool threads",
+                DEFAULT_ARCHIVE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_ARCHIVE_ITERATIONS,
+            g_param_spec_uint ("archive-iterations", "Archive iterations", "Parsing iterations per block in archive mode, more is slower and slightly smaller",
+                1, 1000, DEFAULT_ARCHIVE_ITERATIONS,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_BLOCK_SIZE,
+            g_param_spec_uint ("block-size", "Block size", "Push the output in buffers of exactly this many bytes but the last one of the stream, which is flagged with MARKER, e.g. for direct I/O (0 = disabled, GStreamer 1.0 only, ignored in per-buffer mode)",
+                0, G_MAXINT, DEFAULT_BLOCK_SIZE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_OUTPUT_ALIGNMENT,
+            g_param_spec_uint ("output-alignment", "Output alignment", "Allocate the output memory aligned to this many bytes, a power of two such as the page size (0 = as downstream asks, GStreamer 1.0 only)",
+                0, 1 << 20, DEFAULT_OUTPUT_ALIGNMENT,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_ALLOW_BYPASS,
+            g_param_spec_boolean ("allow-bypass", "Allow bypass", "Push the input unchanged with its own caps, flagged with compressed=false, when downstream accepts them and lists them first (GStreamer 1.0 only)",
+                DEFAULT_ALLOW_BYPASS,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (G_OBJECT_CLASS (klass), PROP_BYPASS_IF_BANDWIDTH_ABOVE,
+            g_param_spec_uint64 ("bypass-if-bandwidth-above", "Bypass if bandwidth above", "With allow-bypass, also push the input unchanged while downstream takes the output faster than this many bytes per second (0 = disabled)",
+                0, G_MAXUINT64, DEFAULT_BYPASS_IF_BANDWIDTH_ABOVE,
+                G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 #if GST_CHECK_VERSION(1,0,0)
     gst_element_class_add_pad_template (gstelement_class,
             gst_static_pad_template_get (&sink_template));
     gst_element_class_add_pad_template (gstelement_class,
             gst_static_pad_template_get (&src_template));
+    gst_element_class_add_pad_template (gstelement_class,
+            gst_static_pad_template_get (&profile_template));
     gst_element_class_set_static_metadata (gstelement_class, "GZ encoder",
             "Codec/Encoder", "Compresses streams",
             "Alexandre Esse <alexandre.esse.dev@gmail.com>");
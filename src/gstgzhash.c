@@ -0,0 +1,147 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstgzhash.h"
+
+#include <string.h>
+
+#define PRIME64_1 G_GUINT64_CONSTANT (0x9E3779B185EBCA87)
+#define PRIME64_2 G_GUINT64_CONSTANT (0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 G_GUINT64_CONSTANT (0x165667B19E3779F9)
+#define PRIME64_4 G_GUINT64_CONSTANT (0x85EBCA77C2B2AE63)
+#define PRIME64_5 G_GUINT64_CONSTANT (0x27D4EB2F165667C5)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+    static inline guint64
+read64 (const guint8 * p)
+{
+    guint64 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT64_FROM_LE (v);
+}
+
+    static inline guint32
+read32 (const guint8 * p)
+{
+    guint32 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT32_FROM_LE (v);
+}
+
+    static inline guint64
+xxh64_round (guint64 acc, guint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64 (acc, 31);
+    return acc * PRIME64_1;
+}
+
+    static inline guint64
+xxh64_merge (guint64 acc, guint64 val)
+{
+    acc ^= xxh64_round (0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+    guint64
+gst_gz_hash64 (const guint8 * data, gsize size, guint64 seed)
+{
+    const guint8 *end = data + size;
+    guint64 h;
+
+    if (size >= 32)
+    {
+        const guint8 *limit = end - 32;
+        guint64 v1 = seed + PRIME64_1 + PRIME64_2;
+        guint64 v2 = seed + PRIME64_2;
+        guint64 v3 = seed;
+        guint64 v4 = seed - PRIME64_1;
+
+        do {
+            v1 = xxh64_round (v1, read64 (data));
+            v2 = xxh64_round (v2, read64 (data + 8));
+            v3 = xxh64_round (v3, read64 (data + 16));
+            v4 = xxh64_round (v4, read64 (data + 24));
+            data += 32;
+        } while (data <= limit);
+
+        h = ROTL64 (v1, 1) + ROTL64 (v2, 7) + ROTL64 (v3, 12) + ROTL64 (v4, 18);
+        h = xxh64_merge (h, v1);
+        h = xxh64_merge (h, v2);
+        h = xxh64_merge (h, v3);
+        h = xxh64_merge (h, v4);
+    }
+    else
+        h = seed + PRIME64_5;
+
+    h += size;
+    for (; data + 8 <= end; data += 8)
+    {
+        h ^= xxh64_round (0, read64 (data));
+        h = ROTL64 (h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (data + 4 <= end)
+    {
+        h ^= (guint64) read32 (data) * PRIME64_1;
+        h = ROTL64 (h, 23) * PRIME64_2 + PRIME64_3;
+        data += 4;
+    }
+    for (; data < end; data++)
+    {
+        h ^= *data * PRIME64_5;
+        h = ROTL64 (h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,124 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstgzmeta.h"
+
+#if GST_CHECK_VERSION(1,0,0)
+    GType
+gst_gz_member_meta_api_get_type (void)
+{
+    static volatile GType type;
+    static const gchar *tags[] = { NULL };
+
+    if (g_once_init_enter (&type))
+    {
+        GType _type = gst_meta_api_type_register ("GstGzMemberMetaAPI", tags);
+        g_once_init_leave (&type, _type);
+    }
+    return type;
+}
+
+    static gboolean
+gst_gz_member_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+    GstGzMemberMeta *gzmeta = (GstGzMemberMeta *) meta;
+
+    gzmeta->offset = 0;
+    gzmeta->isize = 0;
+    gzmeta->crc = 0;
+    return TRUE;
+}
+
+    static gboolean
+gst_gz_member_meta_transform (GstBuffer * dest, GstMeta * meta,
+        GstBuffer * buffer, GQuark type, gpointer data)
+{
+    GstGzMemberMeta *gzmeta = (GstGzMemberMeta *) meta;
+
+    /* The values only describe the whole member */
+    if (GST_META_TRANSFORM_IS_COPY (type))
+    {
+        GstMetaTransformCopy *copy = data;
+
+        if (copy->region)
+            return TRUE;
+        gst_buffer_add_gz_member_meta (dest, gzmeta->offset, gzmeta->isize,
+                gzmeta->crc);
+    }
+    return TRUE;
+}
+
+    const GstMetaInfo *
+gst_gz_member_meta_get_info (void)
+{
+    static const GstMetaInfo *info = NULL;
+
+    if (g_once_init_enter ((GstMetaInfo **) & info))
+    {
+        const GstMetaInfo *meta = gst_meta_register (GST_GZ_MEMBER_META_API_TYPE,
+                "GstGzMemberMeta", sizeof (GstGzMemberMeta),
+                gst_gz_member_meta_init, NULL, gst_gz_member_meta_transform);
+        g_once_init_leave ((GstMetaInfo **) & info, (GstMetaInfo *) meta);
+    }
+    return info;
+}
+
+    GstGzMemberMeta *
+gst_buffer_add_gz_member_meta (GstBuffer * buffer, guint64 offset,
+        guint32 isize, guint32 crc)
+{
+    GstGzMemberMeta *gzmeta;
+
+    g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+    gzmeta = (GstGzMemberMeta *) gst_buffer_add_meta (buffer,
+            GST_GZ_MEMBER_META_INFO, NULL);
+    gzmeta->offset = offset;
+    gzmeta->isize = isize;
+    gzmeta->crc = crc;
+    return gzmeta;
+}
+#endif
@@ -0,0 +1,80 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __GST_GZ_META_H__
+#define __GST_GZ_META_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#if GST_CHECK_VERSION(1,0,0)
+#define GST_GZ_MEMBER_META_API_TYPE (gst_gz_member_meta_api_get_type())
+#define GST_GZ_MEMBER_META_INFO     (gst_gz_member_meta_get_info())
+typedef struct _GstGzMemberMeta GstGzMemberMeta;
+
+/* Attached by gzparse to each gzip member (or BGZF block, or zlib stream) it
+ * outputs. For zlib streams crc holds the Adler-32 of the trailer. */
+struct _GstGzMemberMeta
+{
+    GstMeta meta;
+
+    /* Offset of the member in the compressed stream */
+    guint64 offset;
+    /* Uncompressed size modulo 2^32 */
+    guint32 isize;
+    guint32 crc;
+};
+
+GType gst_gz_member_meta_api_get_type (void);
+const GstMetaInfo *gst_gz_member_meta_get_info (void);
+
+#define gst_buffer_get_gz_member_meta(b) \
+    ((GstGzMemberMeta *) gst_buffer_get_meta ((b), GST_GZ_MEMBER_META_API_TYPE))
+
+GstGzMemberMeta *gst_buffer_add_gz_member_meta (GstBuffer * buffer,
+        guint64 offset, guint32 isize, guint32 crc);
+#endif
+
+G_END_DECLS
+#endif /* __GST_GZ_META_H__ */
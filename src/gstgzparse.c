@@ -0,0 +1,572 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstgzparse.h"
+#include "gstgzmeta.h"
+
+#if GST_CHECK_VERSION(1,0,0)
+#include <gst/base/gstbaseparse.h>
+#include <zlib.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gzparse_debug);
+#define GST_CAT_DEFAULT gzparse_debug
+
+static GstStaticPadTemplate sink_template = 
+GST_STATIC_PAD_TEMPLATE ("sink", GST_PAD_SINK, GST_PAD_ALWAYS, 
+        GST_STATIC_CAPS ("application/x-gzip"));
+static GstStaticPadTemplate src_template = 
+GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS, 
+        GST_STATIC_CAPS ("application/x-gzip, parsed = (boolean) true"));
+
+/* Smallest complete stream: an empty zlib stream */
+#define MIN_FRAME_SIZE 8
+
+/* gzip header with the BGZF extra field (SAM/BAM specification) */
+#define BGZF_HEADER_SIZE 18
+
+/* Largest expansion deflate can achieve, used to sanity check ISIZE */
+#define MAX_DEFLATE_RATIO 1032
+
+#define SCRATCH_SIZE (32 * 1024)
+
+typedef enum
+{
+    GZPARSE_FORMAT_UNKNOWN,
+    GZPARSE_FORMAT_GZIP,
+    GZPARSE_FORMAT_BGZF,
+    GZPARSE_FORMAT_ZLIB
+} GstGzparseFormat;
+
+struct _GstGzparse
+{
+    GstBaseParse parent;
+
+    GstGzparseFormat format;
+
+    /* Inflate used to find the end of members without a size in the header */
+    z_stream scan;
+    gboolean scan_ready;
+    gboolean scanning;
+    /* Bytes of the current member already fed to the scan */
+    gsize scanned;
+    guint8 *scratch;
+
+    /* Offset of the next member in the compressed stream */
+    guint64 offset;
+    /* Uncompressed bytes of the members parsed so far */
+    guint64 position;
+    /* Total uncompressed size, 0 if unknown */
+    guint64 total;
+    /* The total was looked for in the pulled input, see
+     * gst_gzparse_scan_total() */
+    gboolean total_scanned;
+    /* Compressed size, when upstream knows it */
+    gint64 input_size;
+};
+
+struct _GstGzparseClass
+{
+    GstBaseParseClass parent_class;
+};
+
+#define gst_gzparse_parent_class parent_class
+G_DEFINE_TYPE (GstGzparse, gst_gzparse, GST_TYPE_BASE_PARSE);
+
+    static gboolean
+gst_gzparse_is_gzip (const guint8 * data, gsize size)
+{
+    return size >= 3 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8;
+}
+
+    static gboolean
+gst_gzparse_is_zlib (const guint8 * data, gsize size)
+{
+    return size >= 2 && (data[0] & 0x0f) == 8 && (data[0] >> 4) <= 7
+        && ((data[0] << 8) | data[1]) % 31 == 0;
+}
+
+/* Return the size of the BGZF block starting at data, 0 if the gzip header
+ * has no BGZF extra field */
+    static guint
+gst_gzparse_bgzf_size (const guint8 * data, gsize size)
+{
+    if (size < BGZF_HEADER_SIZE || !(data[3] & 0x04))
+        return 0;
+    if (GST_READ_UINT16_LE (data + 10) < 6 || data[12] != 'B'
+            || data[13] != 'C' || GST_READ_UINT16_LE (data + 14) != 2)
+        return 0;
+    return GST_READ_UINT16_LE (data + 16) + 1;
+}
+
+    static void
+gst_gzparse_set_src_caps (GstGzparse * parse)
+{
+    GstCaps *caps;
+
+    caps = gst_pad_get_current_caps (GST_BASE_PARSE_SINK_PAD (parse));
+    if (caps && !gst_caps_is_empty (caps) && !gst_caps_is_any (caps))
+        caps = gst_caps_make_writable (caps);
+    else
+    {
+        if (caps)
+            gst_caps_unref (caps);
+        caps = gst_caps_new_empty_simple ("application/x-gzip");
+    }
+    gst_caps_set_simple (caps,
+            "format", G_TYPE_STRING,
+            parse->format == GZPARSE_FORMAT_ZLIB ? "zlib" : "gzip",
+            "framing", G_TYPE_STRING,
+            parse->format == GZPARSE_FORMAT_BGZF ? "bgzf" : "member",
+            "parsed", G_TYPE_BOOLEAN, TRUE, NULL);
+    GST_DEBUG_OBJECT (parse, "Setting src caps to %" GST_PTR_FORMAT, caps);
+    gst_pad_set_caps (GST_BASE_PARSE_SRC_PAD (parse), caps);
+    gst_caps_unref (caps);
+}
+
+    static gboolean
+gst_gzparse_pull_uint32 (GstGzparse * parse, guint64 offset, guint32 * value)
+{
+    GstBuffer *buf = NULL;
+    gboolean ret = FALSE;
+
+    if (gst_pad_pull_range (GST_BASE_PARSE_SINK_PAD (parse), offset, 4, &buf)
+            != GST_FLOW_OK)
+        return FALSE;
+    if (gst_buffer_extract (buf, 0, value, 4) == 4)
+    {
+        *value = GUINT32_FROM_LE (*value);
+        ret = TRUE;
+    }
+    gst_buffer_unref (buf);
+    return ret;
+}
+
+/* Compute the total uncompressed size when the input can be pulled: BGZF
+ * block headers are walked and their ISIZE summed, for plain gzip files the
+ * ISIZE of the last member is used (exact for single-member files, it is
+ * dropped as soon as a second member shows up). Only done once, on the
+ * first duration query: the walk reads every block header of the file. */
+    static void
+gst_gzparse_scan_total (GstGzparse * parse)
+{
+    GstPad *sink = GST_BASE_PARSE_SINK_PAD (parse);
+    guint64 offset = 0, total = 0;
+    guint32 isize;
+
+    if (parse->total_scanned || parse->format == GZPARSE_FORMAT_UNKNOWN)
+        return;
+    parse->total_scanned = TRUE;
+    if (GST_PAD_MODE (sink) != GST_PAD_MODE_PULL || parse->input_size <= 0)
+        return;
+
+    /* The first member did not end the file, there are several of them */
+    if (parse->format == GZPARSE_FORMAT_GZIP && parse->offset > 0
+            && parse->offset < (guint64) parse->input_size)
+        return;
+
+    if (parse->format == GZPARSE_FORMAT_GZIP)
+    {
+        if (gst_gzparse_pull_uint32 (parse, parse->input_size - 4, &isize)
+                && isize / MAX_DEFLATE_RATIO <= parse->input_size)
+            total = isize;
+    }
+    else if (parse->format == GZPARSE_FORMAT_BGZF)
+    {
+        while (offset + BGZF_HEADER_SIZE <= parse->input_size)
+        {
+            GstBuffer *buf = NULL;
+            guint8 header[BGZF_HEADER_SIZE];
+            guint bsize = 0;
+
+            if (gst_pad_pull_range (sink, offset, BGZF_HEADER_SIZE, &buf)
+                    != GST_FLOW_OK)
+                return;
+            if (gst_buffer_extract (buf, 0, header, BGZF_HEADER_SIZE)
+                    == BGZF_HEADER_SIZE && gst_gzparse_is_gzip (header,
+                        BGZF_HEADER_SIZE))
+                bsize = gst_gzparse_bgzf_size (header, BGZF_HEADER_SIZE);
+            gst_buffer_unref (buf);
+            if (!bsize || offset + bsize > parse->input_size
+                    || !gst_gzparse_pull_uint32 (parse, offset + bsize - 4, &isize))
+            {
+                GST_DEBUG_OBJECT (parse, "Not a BGZF block at %"
+                        G_GUINT64_FORMAT ", total size unknown", offset);
+                return;
+            }
+            total += isize;
+            offset += bsize;
+        }
+    }
+
+    if (total)
+    {
+        GST_DEBUG_OBJECT (parse, "Total uncompressed size is %"
+                G_GUINT64_FORMAT, total);
+        parse->total = total;
+    }
+}
+
+/* Detect the format on the first member */
+    static gboolean
+gst_gzparse_detect (GstGzparse * parse, const guint8 * data, gsize size)
+{
+    if (gst_gzparse_is_gzip (data, size))
+        parse->format = gst_gzparse_bgzf_size (data, size) ?
+            GZPARSE_FORMAT_BGZF : GZPARSE_FORMAT_GZIP;
+    else if (gst_gzparse_is_zlib (data, size))
+        parse->format = GZPARSE_FORMAT_ZLIB;
+    else
+        return FALSE;
+
+    GST_DEBUG_OBJECT (parse, "Detected %s stream",
+            parse->format == GZPARSE_FORMAT_BGZF ? "BGZF" :
+            parse->format == GZPARSE_FORMAT_ZLIB ? "zlib" : "gzip");
+    gst_gzparse_set_src_caps (parse);
+    if (!gst_pad_peer_query_duration (GST_BASE_PARSE_SINK_PAD (parse),
+                GST_FORMAT_BYTES, &parse->input_size))
+        parse->input_size = -1;
+    return TRUE;
+}
+
+/* Inflate the new data of the current member into the scratch buffer.
+ * Returns the size of the member once its end is found, 0 if more data is
+ * needed and -1 if the data is not a valid member. */
+    static gssize
+gst_gzparse_scan (GstGzparse * parse, const guint8 * data, gsize size)
+{
+    int ret;
+
+    if (!parse->scanning)
+    {
+        inflateReset2 (&parse->scan,
+                parse->format == GZPARSE_FORMAT_ZLIB ? MAX_WBITS : MAX_WBITS|16);
+        parse->scanned = 0;
+        parse->scanning = TRUE;
+    }
+
+    parse->scan.next_in = (z_const Bytef *) data + parse->scanned;
+    parse->scan.avail_in = size - parse->scanned;
+    do
+    {
+        parse->scan.next_out = parse->scratch;
+        parse->scan.avail_out = SCRATCH_SIZE;
+        ret = inflate (&parse->scan, Z_NO_FLUSH);
+    } while (ret == Z_OK && parse->scan.avail_out == 0);
+    parse->scanned = size - parse->scan.avail_in;
+    parse->scan.next_in = Z_NULL;
+    parse->scan.avail_in = 0;
+
+    if (ret == Z_STREAM_END)
+    {
+        parse->scanning = FALSE;
+        return parse->scanned;
+    }
+    if (ret == Z_OK || ret == Z_BUF_ERROR)
+        return 0;
+
+    GST_DEBUG_OBJECT (parse, "inflate() return %d [%s]", ret, parse->scan.msg);
+    parse->scanning = FALSE;
+    return -1;
+}
+
+    static GstFlowReturn
+gst_gzparse_handle_frame (GstBaseParse * bparse, GstBaseParseFrame * frame,
+        gint * skipsize)
+{
+    GstGzparse *parse = GST_GZPARSE (bparse);
+    GstMapInfo map;
+    const guint8 *data;
+    gsize size, framesize = 0, skip = 0;
+    guint32 isize = 0, crc = 0;
+    gboolean draining;
+
+    draining = GST_BASE_PARSE_DRAINING (bparse);
+    gst_buffer_map (frame->buffer, &map, GST_MAP_READ);
+    data = map.data;
+    size = map.size;
+
+    if (!parse->scanning)
+    {
+        /* Look for the start of a member */
+        if (parse->format == GZPARSE_FORMAT_UNKNOWN)
+        {
+            if (!draining && size < BGZF_HEADER_SIZE && size >= 4
+                    && gst_gzparse_is_gzip (data, size) && (data[3] & 0x04))
+                goto need_more;
+            if (!gst_gzparse_detect (parse, data, size))
+                skip = 1;
+        }
+        else if (parse->format == GZPARSE_FORMAT_ZLIB)
+        {
+            /* zlib streams can't be concatenated, skip what follows */
+            skip = size;
+        }
+        else if (!gst_gzparse_is_gzip (data, size))
+        {
+            const guint8 *sync;
+
+            sync = memchr (data + 1, 0x1f, size - 1);
+            skip = sync ? (gsize) (sync - data) : size;
+        }
+        if (skip)
+        {
+            GST_DEBUG_OBJECT (parse, "Skipping %" G_GSIZE_FORMAT " bytes", skip);
+            parse->offset += skip;
+            *skipsize = skip;
+            gst_buffer_unmap (frame->buffer, &map);
+            return GST_FLOW_OK;
+        }
+    }
+
+    if (parse->format == GZPARSE_FORMAT_BGZF && !parse->scanning)
+    {
+        framesize = gst_gzparse_bgzf_size (data, size);
+        if (!framesize)
+        {
+            if (!draining && size < BGZF_HEADER_SIZE)
+                goto need_more;
+            /* Not a BGZF block, find its end by inflating it */
+            parse->format = GZPARSE_FORMAT_GZIP;
+            gst_gzparse_set_src_caps (parse);
+        }
+        else if (framesize > size)
+        {
+            if (!draining)
+                goto need_more;
+            framesize = 0;
+        }
+    }
+
+    if (parse->format != GZPARSE_FORMAT_BGZF)
+    {
+        gssize ret = gst_gzparse_scan (parse, data, size);
+
+        if (ret < 0)
+        {
+            /* Resync on the next member */
+            parse->offset += 1;
+            *skipsize = 1;
+            gst_buffer_unmap (frame->buffer, &map);
+            return GST_FLOW_OK;
+        }
+        if (ret == 0 && !draining)
+            goto need_more;
+        framesize = ret;
+    }
+
+    if (framesize)
+    {
+        if (parse->format == GZPARSE_FORMAT_ZLIB)
+        {
+            isize = (guint32) parse->scan.total_out;
+            crc = GST_READ_UINT32_BE (data + framesize - 4);
+        }
+        else
+        {
+            crc = GST_READ_UINT32_LE (data + framesize - 8);
+            isize = GST_READ_UINT32_LE (data + framesize - 4);
+        }
+    }
+    else
+    {
+        /* Truncated member at the end of the stream, let the decoder deal
+         * with it */
+        GST_WARNING_OBJECT (parse, "Truncated member at offset %"
+                G_GUINT64_FORMAT, parse->offset);
+        parse->scanning = FALSE;
+        framesize = size;
+    }
+    gst_buffer_unmap (frame->buffer, &map);
+
+    /* A second gzip member, the last ISIZE was not the total size */
+    if (parse->format == GZPARSE_FORMAT_GZIP && parse->offset == 0
+            && parse->input_size > 0 && framesize < parse->input_size)
+        parse->total = 0;
+
+    GST_LOG_OBJECT (parse, "Member at offset %" G_GUINT64_FORMAT ", size %"
+            G_GSIZE_FORMAT ", isize %u, crc %08x", parse->offset, framesize,
+            isize, crc);
+    frame->out_buffer = gst_buffer_copy_region (frame->buffer,
+            GST_BUFFER_COPY_ALL, 0, framesize);
+    GST_BUFFER_OFFSET (frame->out_buffer) = parse->offset;
+    GST_BUFFER_OFFSET_END (frame->out_buffer) = parse->offset + framesize;
+    gst_buffer_add_gz_member_meta (frame->out_buffer, parse->offset, isize, crc);
+    /* Every member can be decoded on its own. The stream has no time, the
+     * index is keyed on the uncompressed position of the members. */
+    gst_base_parse_add_index_entry (bparse, parse->offset, parse->position,
+            TRUE, FALSE);
+    parse->offset += framesize;
+    parse->position += isize;
+    return gst_base_parse_finish_frame (bparse, frame, framesize);
+
+need_more:
+    gst_buffer_unmap (frame->buffer, &map);
+    *skipsize = 0;
+    return GST_FLOW_OK;
+}
+
+    static gboolean
+gst_gzparse_src_query (GstBaseParse * bparse, GstQuery * query)
+{
+    GstGzparse *parse = GST_GZPARSE (bparse);
+    GstFormat format;
+
+    switch (GST_QUERY_TYPE (query))
+    {
+        case GST_QUERY_POSITION:
+            gst_query_parse_position (query, &format, NULL);
+            if (format == GST_FORMAT_BYTES)
+            {
+                gst_query_set_position (query, format, parse->position);
+                return TRUE;
+            }
+            break;
+        case GST_QUERY_DURATION:
+            gst_query_parse_duration (query, &format, NULL);
+            if (format == GST_FORMAT_BYTES)
+            {
+                if (!parse->total)
+                    gst_gzparse_scan_total (parse);
+                if (!parse->total)
+                    return FALSE;
+                gst_query_set_duration (query, format, parse->total);
+                return TRUE;
+            }
+            break;
+        default:
+            break;
+    }
+    return GST_BASE_PARSE_CLASS (parent_class)->src_query (bparse, query);
+}
+
+    static gboolean
+gst_gzparse_sink_event (GstBaseParse * bparse, GstEvent * e)
+{
+    GstGzparse *parse = GST_GZPARSE (bparse);
+
+    /* Every member went through, the total size is known for sure */
+    if (GST_EVENT_TYPE (e) == GST_EVENT_EOS && parse->position != parse->total)
+    {
+        parse->total = parse->position;
+        gst_element_post_message (GST_ELEMENT (parse),
+                gst_message_new_duration_changed (GST_OBJECT (parse)));
+    }
+    return GST_BASE_PARSE_CLASS (parent_class)->sink_event (bparse, e);
+}
+
+    static gboolean
+gst_gzparse_start (GstBaseParse * bparse)
+{
+    GstGzparse *parse = GST_GZPARSE (bparse);
+
+    GST_DEBUG_OBJECT (parse, "Start gzparse");
+    memset (&parse->scan, 0, sizeof (parse->scan));
+    if (inflateInit2 (&parse->scan, MAX_WBITS|32) != Z_OK)
+    {
+        GST_ELEMENT_ERROR (parse, LIBRARY, INIT, (NULL),
+                ("Failed to initialize the member scanner."));
+        return FALSE;
+    }
+    parse->scan_ready = TRUE;
+    parse->scanning = FALSE;
+    parse->scanned = 0;
+    parse->scratch = g_malloc (SCRATCH_SIZE);
+    parse->format = GZPARSE_FORMAT_UNKNOWN;
+    parse->offset = 0;
+    parse->position = 0;
+    parse->total = 0;
+    parse->total_scanned = FALSE;
+    parse->input_size = -1;
+    gst_base_parse_set_min_frame_size (bparse, MIN_FRAME_SIZE);
+    return TRUE;
+}
+
+    static gboolean
+gst_gzparse_stop (GstBaseParse * bparse)
+{
+    GstGzparse *parse = GST_GZPARSE (bparse);
+
+    GST_DEBUG_OBJECT (parse, "Stop gzparse");
+    if (parse->scan_ready)
+    {
+        (void)inflateEnd (&parse->scan);
+        parse->scan_ready = FALSE;
+    }
+    g_free (parse->scratch);
+    parse->scratch = NULL;
+    return TRUE;
+}
+
+    static void
+gst_gzparse_init (GstGzparse * parse)
+{
+    GST_DEBUG_OBJECT (parse, "Initialize gzparse");
+    gst_base_parse_set_pts_interpolation (GST_BASE_PARSE (parse), FALSE);
+}
+
+    static void
+gst_gzparse_class_init (GstGzparseClass * klass)
+{
+    GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+    GstBaseParseClass *parse_class = GST_BASE_PARSE_CLASS (klass);
+
+    parse_class->start = GST_DEBUG_FUNCPTR (gst_gzparse_start);
+    parse_class->stop = GST_DEBUG_FUNCPTR (gst_gzparse_stop);
+    parse_class->handle_frame = GST_DEBUG_FUNCPTR (gst_gzparse_handle_frame);
+    parse_class->src_query = GST_DEBUG_FUNCPTR (gst_gzparse_src_query);
+    parse_class->sink_event = GST_DEBUG_FUNCPTR (gst_gzparse_sink_event);
+
+    gst_element_class_add_pad_template (gstelement_class,
+            gst_static_pad_template_get (&sink_template));
+    gst_element_class_add_pad_template (gstelement_class,
+            gst_static_pad_template_get (&src_template));
+    gst_element_class_set_static_metadata (gstelement_class, "GZ parser",
+            "Codec/Parser", "Splits compressed streams into gzip members "
+            "or BGZF blocks", "Alexandre Esse <alexandre.esse.dev@gmail.com>");
+    GST_DEBUG_CATEGORY_INIT (gzparse_debug, "gzparse", 0, "GZ parser");
+}
+#endif
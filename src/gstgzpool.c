@@ -0,0 +1,343 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstgzpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+GST_DEBUG_CATEGORY_STATIC (gzpool_debug);
+#define GST_CAT_DEFAULT gzpool_debug
+
+typedef struct
+{
+    GstGzPoolFunc func;
+    gpointer data;
+    GDestroyNotify destroy;
+} GstGzPoolJob;
+
+struct _GstGzPoolClient
+{
+    gpointer user_data;
+    guint max_jobs;
+
+    GQueue jobs;
+    /* In the ready queue or running a job */
+    gboolean scheduled;
+    gboolean flushing;
+    GstFlowReturn flow;
+};
+
+/* The pool is created on the first job and lives until the process exits */
+static GMutex pool_lock;
+static GCond pool_cond;
+static GThreadPool *pool = NULL;
+/* Clients with pending jobs, one entry per job to run */
+static GQueue ready = G_QUEUE_INIT;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+static cpu_set_t pool_cpus;
+static gboolean pool_use_affinity = FALSE;
+static GPrivate pool_thread_pinned = G_PRIVATE_INIT (NULL);
+
+/* Parse a CPU list such as "0-3,6" */
+    static gboolean
+gst_gz_pool_parse_cpus (const gchar * str, cpu_set_t * cpus)
+{
+    gchar **ranges, **range;
+    gboolean ret = FALSE;
+
+    CPU_ZERO (cpus);
+    ranges = g_strsplit (str, ",", -1);
+    for (range = ranges; *range; range++)
+    {
+        gchar *end;
+        guint64 first, last, cpu;
+
+        first = g_ascii_strtoull (*range, &end, 10);
+        if (end == *range)
+            continue;
+        last = first;
+        if (*end == '-')
+            last = g_ascii_strtoull (end + 1, NULL, 10);
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET (cpu, cpus);
+            ret = TRUE;
+        }
+    }
+    g_strfreev (ranges);
+    return ret;
+}
+
+    static void
+gst_gz_pool_pin_thread (void)
+{
+    if (!pool_use_affinity || g_private_get (&pool_thread_pinned))
+        return;
+    if (sched_setaffinity (0, sizeof (pool_cpus), &pool_cpus) != 0)
+        GST_WARNING ("Failed to set the CPU affinity of a worker thread");
+    g_private_set (&pool_thread_pinned, GINT_TO_POINTER (1));
+}
+#endif
+
+    static void
+gst_gz_pool_worker (gpointer data, gpointer user_data)
+{
+    GstGzPoolClient *client;
+    GstGzPoolJob *job;
+    GstFlowReturn flow = GST_FLOW_OK;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+    gst_gz_pool_pin_thread ();
+#endif
+    g_mutex_lock (&pool_lock);
+    client = g_queue_pop_head (&ready);
+    job = g_queue_pop_head (&client->jobs);
+    /* Wake up a producer waiting for room in the queue */
+    g_cond_broadcast (&pool_cond);
+    g_mutex_unlock (&pool_lock);
+
+    /* The queue is emptied when flushing */
+    if (job)
+    {
+        flow = job->func (client->user_data, job->data);
+        if (job->destroy)
+            job->destroy (job->data);
+        g_slice_free (GstGzPoolJob, job);
+    }
+
+    g_mutex_lock (&pool_lock);
+    if (flow != GST_FLOW_OK && client->flow == GST_FLOW_OK)
+        client->flow = flow;
+    if (!g_queue_is_empty (&client->jobs))
+    {
+        /* Go back to the end of the line to let the other clients run */
+        g_queue_push_tail (&ready, client);
+        g_thread_pool_push (pool, client, NULL);
+    }
+    else
+        client->scheduled = FALSE;
+    g_cond_broadcast (&pool_cond);
+    g_mutex_unlock (&pool_lock);
+}
+
+/* Must be called with the pool lock */
+    static void
+gst_gz_pool_ensure (void)
+{
+    const gchar *env;
+    gint max_threads = 0;
+
+    if (pool)
+        return;
+
+    GST_DEBUG_CATEGORY_INIT (gzpool_debug, "gzpool", 0, "GZ worker pool");
+
+    env = g_getenv ("GST_GZ_MAX_THREADS");
+    if (env)
+        max_threads = atoi (env);
+    if (max_threads <= 0)
+        max_threads = g_get_num_processors ();
+
+#ifdef HAVE_SCHED_SETAFFINITY
+    env = g_getenv ("GST_GZ_CPU_AFFINITY");
+    if (env)
+        pool_use_affinity = gst_gz_pool_parse_cpus (env, &pool_cpus);
+#endif
+
+    GST_INFO ("Creating worker pool with %d threads", max_threads);
+    pool = g_thread_pool_new (gst_gz_pool_worker, NULL, max_threads, TRUE, NULL);
+}
+
+    GstGzPoolClient *
+gst_gz_pool_client_new (gpointer user_data, guint max_jobs)
+{
+    GstGzPoolClient *client = g_slice_new0 (GstGzPoolClient);
+
+    client->user_data = user_data;
+    client->max_jobs = MAX (max_jobs, 1);
+    g_queue_init (&client->jobs);
+    client->flow = GST_FLOW_OK;
+    return client;
+}
+
+    void
+gst_gz_pool_client_free (GstGzPoolClient * client)
+{
+    gst_gz_pool_client_set_flushing (client, TRUE);
+    g_mutex_lock (&pool_lock);
+    while (client->scheduled)
+        g_cond_wait (&pool_cond, &pool_lock);
+    g_mutex_unlock (&pool_lock);
+    g_slice_free (GstGzPoolClient, client);
+}
+
+/* Queue a job, blocking while the client already has max_jobs pending jobs.
+ * Returns the first error returned by a job of the client. */
+    GstFlowReturn
+gst_gz_pool_client_push (GstGzPoolClient * client, GstGzPoolFunc func,
+        gpointer data, GDestroyNotify destroy)
+{
+    GstGzPoolJob *job;
+    GstFlowReturn flow;
+
+    g_mutex_lock (&pool_lock);
+    gst_gz_pool_ensure ();
+    while (!client->flushing && g_queue_get_length (&client->jobs) >= client->max_jobs)
+        g_cond_wait (&pool_cond, &pool_lock);
+
+    if (client->flushing)
+    {
+        g_mutex_unlock (&pool_lock);
+        if (destroy)
+            destroy (data);
+#if GST_CHECK_VERSION(1,0,0)
+        return GST_FLOW_FLUSHING;
+#else
+        return GST_FLOW_WRONG_STATE;
+#endif
+    }
+
+    job = g_slice_new (GstGzPoolJob);
+    job->func = func;
+    job->data = data;
+    job->destroy = destroy;
+    g_queue_push_tail (&client->jobs, job);
+    if (!client->scheduled)
+    {
+        client->scheduled = TRUE;
+        g_queue_push_tail (&ready, client);
+        g_thread_pool_push (pool, client, NULL);
+    }
+    flow = client->flow;
+    g_mutex_unlock (&pool_lock);
+    return flow;
+}
+
+/* Wait until all the queued jobs of the client are done */
+    GstFlowReturn
+gst_gz_pool_client_wait (GstGzPoolClient * client)
+{
+    GstFlowReturn flow;
+
+    g_mutex_lock (&pool_lock);
+    while (client->scheduled)
+        g_cond_wait (&pool_cond, &pool_lock);
+    flow = client->flow;
+    g_mutex_unlock (&pool_lock);
+    return flow;
+}
+
+    GstFlowReturn
+gst_gz_pool_client_get_flow (GstGzPoolClient * client)
+{
+    GstFlowReturn flow;
+
+    g_mutex_lock (&pool_lock);
+    flow = client->flow;
+    g_mutex_unlock (&pool_lock);
+    return flow;
+}
+
+/* Clear the last error if it is flow, once its cause went away (e.g.
+ * NOT_LINKED and the pad got linked) */
+    void
+gst_gz_pool_client_clear_flow (GstGzPoolClient * client, GstFlowReturn flow)
+{
+    g_mutex_lock (&pool_lock);
+    if (client->flow == flow)
+        client->flow = GST_FLOW_OK;
+    g_mutex_unlock (&pool_lock);
+}
+
+/* When flushing the pending jobs are dropped and new ones are refused. Leaving
+ * the flushing state waits for the running job and clears the last error. */
+    void
+gst_gz_pool_client_set_flushing (GstGzPoolClient * client, gboolean flushing)
+{
+    GstGzPoolJob *job;
+    GQueue dropped = G_QUEUE_INIT;
+
+    g_mutex_lock (&pool_lock);
+    client->flushing = flushing;
+    if (flushing)
+    {
+        while ((job = g_queue_pop_head (&client->jobs)))
+            g_queue_push_tail (&dropped, job);
+        g_cond_broadcast (&pool_cond);
+    }
+    else
+    {
+        while (client->scheduled)
+            g_cond_wait (&pool_cond, &pool_lock);
+        client->flow = GST_FLOW_OK;
+    }
+    g_mutex_unlock (&pool_lock);
+
+    while ((job = g_queue_pop_head (&dropped)))
+    {
+        if (job->destroy)
+            job->destroy (job->data);
+        g_slice_free (GstGzPoolJob, job);
+    }
+}
+
+/* Number of threads of the pool, for clients that split their work */
+    guint
+gst_gz_pool_get_n_threads (void)
+{
+    guint n;
+
+    g_mutex_lock (&pool_lock);
+    gst_gz_pool_ensure ();
+    n = g_thread_pool_get_max_threads (pool);
+    g_mutex_unlock (&pool_lock);
+    return n;
+}
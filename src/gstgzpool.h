@@ -0,0 +1,75 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __GST_GZ_POOL_H__
+#define __GST_GZ_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Process-wide pool of worker threads shared by all the gz elements. Each
+ * element instance owns a client: the jobs of a client run one at a time and
+ * in order, while the clients are served in a round-robin fashion. The number
+ * of threads is given by the GST_GZ_MAX_THREADS environment variable (the
+ * number of CPUs by default) and the threads can be bound to the CPUs listed
+ * in GST_GZ_CPU_AFFINITY (e.g. "0-3,6"). */
+typedef struct _GstGzPoolClient GstGzPoolClient;
+
+typedef GstFlowReturn (*GstGzPoolFunc) (gpointer user_data, gpointer data);
+
+GstGzPoolClient *gst_gz_pool_client_new (gpointer user_data, guint max_jobs);
+void gst_gz_pool_client_free (GstGzPoolClient * client);
+
+GstFlowReturn gst_gz_pool_client_push (GstGzPoolClient * client,
+    GstGzPoolFunc func, gpointer data, GDestroyNotify destroy);
+GstFlowReturn gst_gz_pool_client_wait (GstGzPoolClient * client);
+GstFlowReturn gst_gz_pool_client_get_flow (GstGzPoolClient * client);
+void gst_gz_pool_client_clear_flow (GstGzPoolClient * client,
+    GstFlowReturn flow);
+void gst_gz_pool_client_set_flushing (GstGzPoolClient * client,
+    gboolean flushing);
+guint gst_gz_pool_get_n_threads (void);
+
+G_END_DECLS
+#endif /* __GST_GZ_POOL_H__ */
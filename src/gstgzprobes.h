@@ -0,0 +1,92 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __GST_GZ_PROBES_H__
+#define __GST_GZ_PROBES_H__
+
+/* Static tracepoints of the gz elements, built with --enable-usdt. They are
+ * a nop instruction until a tracer (perf, bpftrace, systemtap) attaches to
+ * them, e.g.:
+ *   bpftrace -e 'usdt:libgstgz.so:gstgz:inflate__done { @[arg0] = sum(arg3); }'
+ * The first argument is always the element. */
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+/* Entering deflate()/inflate(): input and output space available */
+#define GST_GZ_PROBE_CODEC_START(name, obj, avail_in, avail_out) \
+    DTRACE_PROBE3 (gstgz, name##__start, obj, avail_in, avail_out)
+/* Leaving deflate()/inflate(): bytes consumed and produced, return code */
+#define GST_GZ_PROBE_CODEC_DONE(name, obj, consumed, produced, ret) \
+    DTRACE_PROBE4 (gstgz, name##__done, obj, consumed, produced, ret)
+#define GST_GZ_PROBE_PUSH_START(obj, size) \
+    DTRACE_PROBE2 (gstgz, push__start, obj, size)
+#define GST_GZ_PROBE_PUSH_DONE(obj, size, flow) \
+    DTRACE_PROBE3 (gstgz, push__done, obj, size, flow)
+#define GST_GZ_PROBE_ALLOC(obj, size) \
+    DTRACE_PROBE2 (gstgz, alloc, obj, size)
+#define GST_GZ_PROBE_REINIT(obj) \
+    DTRACE_PROBE1 (gstgz, reinit, obj)
+#else
+/* The arguments are still used, to keep the same warnings either way */
+#define GST_GZ_PROBE_CODEC_START(name, obj, avail_in, avail_out) \
+    G_STMT_START { (void) (avail_in); (void) (avail_out); } G_STMT_END
+#define GST_GZ_PROBE_CODEC_DONE(name, obj, consumed, produced, ret) \
+    G_STMT_START { (void) (consumed); (void) (produced); } G_STMT_END
+#define GST_GZ_PROBE_PUSH_START(obj, size) \
+    G_STMT_START { (void) (size); } G_STMT_END
+#define GST_GZ_PROBE_PUSH_DONE(obj, size, flow) \
+    G_STMT_START { (void) (size); } G_STMT_END
+#define GST_GZ_PROBE_ALLOC(obj, size) G_STMT_START { } G_STMT_END
+#define GST_GZ_PROBE_REINIT(obj) G_STMT_START { } G_STMT_END
+#endif
+
+/* Debug lines run for every buffer or every deflate()/inflate() call. Even
+ * disabled, GST_LOG has a cost at that rate: they are only compiled in with
+ * --enable-hot-path-logging. */
+#ifdef ENABLE_HOT_PATH_LOGGING
+#define GST_GZ_HOT_LOG GST_LOG_OBJECT
+#else
+#define GST_GZ_HOT_LOG(...) G_STMT_START { } G_STMT_END
+#endif
+
+#endif /* __GST_GZ_PROBES_H__ */
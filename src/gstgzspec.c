@@ -0,0 +1,356 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "gstgzspec.h"
+
+#include <zlib.h>
+#include <string.h>
+
+/* Size of the deflate window */
+#define WINDOW_SIZE 32768
+
+/* Output space given to inflate() at a time */
+#define OUTPUT_STEP (64 * 1024)
+
+/* Marker dictionaries: a byte copied from position j of the window is
+ * j & 0xff with the first one and j >> 8 with the second one, with the high
+ * bit set to the opposite of the high bit of the first one. A byte that
+ * differs between the two outputs comes from the window, the others are the
+ * real data. */
+#define N_DICTS 2
+static guint8 spec_dicts[N_DICTS][WINDOW_SIZE];
+
+    static void
+gst_gz_spec_init_dicts (void)
+{
+    static gsize init = 0;
+    guint j;
+
+    if (!g_once_init_enter (&init))
+        return;
+    for (j = 0; j < WINDOW_SIZE; j++)
+    {
+        spec_dicts[0][j] = j & 0xff;
+        spec_dicts[1][j] = (j >> 8) | (~j & 0x80);
+    }
+    g_once_init_leave (&init, 1);
+}
+
+/* Read n bits (at most 16) at bit position pos, G_MAXUINT past the end */
+    static guint
+gst_gz_spec_bits (const guint8 * data, gsize size, guint64 pos, guint n)
+{
+    guint32 v = 0;
+    gsize byte = pos >> 3;
+    guint i;
+
+    if (((pos + n + 7) >> 3) > size)
+        return G_MAXUINT;
+    for (i = 0; i < 3 && byte + i < size; i++)
+        v |= (guint32) data[byte + i] << (8 * i);
+    return (v >> (pos & 7)) & ((1U << n) - 1);
+}
+
+/* Make a raw inflate start at bit position pos */
+    static void
+gst_gz_spec_prime (z_stream * stream, const guint8 * data, gsize size,
+        guint64 pos)
+{
+    gsize byte = pos >> 3;
+    guint bits = pos & 7;
+
+    if (bits)
+    {
+        inflatePrime (stream, 8 - bits, data[byte] >> bits);
+        byte++;
+    }
+    stream->next_in = (z_const Bytef *) data + byte;
+    stream->avail_in = size - byte;
+}
+
+/* Bit position reached by a raw inflate that started in data */
+    static guint64
+gst_gz_spec_position (z_stream * stream, const guint8 * data)
+{
+    return (guint64) (stream->next_in - data) * 8 - (stream->data_type & 7);
+}
+
+/* A stored block header: LEN and NLEN on the next byte boundary, zlib pads
+ * with zero bits */
+    static gboolean
+gst_gz_spec_is_stored (const guint8 * data, gsize size, guint64 pos)
+{
+    guint64 aligned = (pos + 3 + 7) & ~(guint64) 7;
+    guint len, nlen;
+
+    if (aligned > pos + 3 && gst_gz_spec_bits (data, size, pos + 3,
+                aligned - pos - 3) != 0)
+        return FALSE;
+    len = gst_gz_spec_bits (data, size, aligned, 16);
+    nlen = gst_gz_spec_bits (data, size, aligned + 16, 16);
+    return len != G_MAXUINT && nlen != G_MAXUINT && len == (~nlen & 0xffff);
+}
+
+/* Look for the start of a non-final stored or dynamic block in the search
+ * range. Candidates for dynamic blocks are inflated up to the end of their
+ * first block, false positives are rejected by inflate on the way. A false
+ * positive that gets through only costs time: the chunk will not follow the
+ * data before it and is dropped. */
+    gboolean
+gst_gz_spec_find_start (GstGzSpecChunk * chunk)
+{
+    z_stream stream;
+    guint8 *scratch;
+    guint64 pos;
+
+    chunk->start = G_MAXUINT64;
+    gst_gz_spec_init_dicts ();
+    memset (&stream, 0, sizeof (stream));
+    if (inflateInit2 (&stream, -MAX_WBITS) != Z_OK)
+        return FALSE;
+    /* A full window avoids distance errors, it is kept by inflateResetKeep() */
+    inflateSetDictionary (&stream, spec_dicts[0], WINDOW_SIZE);
+    scratch = g_malloc (OUTPUT_STEP);
+
+    for (pos = chunk->search_from; pos < chunk->search_to; pos++)
+    {
+        guint header = gst_gz_spec_bits (chunk->data, chunk->size, pos, 3);
+        int ret;
+
+        if (header == G_MAXUINT)
+            break;
+        /* BFINAL 0, BTYPE 00 */
+        if (header == 0)
+        {
+            if (!gst_gz_spec_is_stored (chunk->data, chunk->size, pos))
+                continue;
+            chunk->start = pos;
+            break;
+        }
+        /* BFINAL 0, BTYPE 10, at most 286 literal/length and 30 distance
+         * codes */
+        if (header != 4 || gst_gz_spec_bits (chunk->data, chunk->size,
+                    pos + 3, 5) > 29 || gst_gz_spec_bits (chunk->data,
+                    chunk->size, pos + 8, 5) > 29)
+            continue;
+
+        inflateResetKeep (&stream);
+        gst_gz_spec_prime (&stream, chunk->data, chunk->size, pos);
+        do
+        {
+            stream.next_out = scratch;
+            stream.avail_out = OUTPUT_STEP;
+            ret = inflate (&stream, Z_BLOCK);
+        } while (ret == Z_OK && !stream.avail_out
+                && !(stream.data_type & 128));
+        /* Reaching the end of the block or of the data is a success */
+        if (ret == Z_OK || ret == Z_BUF_ERROR)
+        {
+            chunk->start = pos;
+            break;
+        }
+    }
+
+    g_free (scratch);
+    inflateEnd (&stream);
+    return chunk->start != G_MAXUINT64;
+}
+
+typedef enum
+{
+    SPEC_BOUNDARY,
+    SPEC_STREAM_END,
+    SPEC_NEED_DATA,
+    SPEC_ERROR
+} GstGzSpecResult;
+
+/* Inflate up to the next block boundary, appending to output */
+    static GstGzSpecResult
+gst_gz_spec_inflate_block (z_stream * stream, GByteArray * output)
+{
+    int ret;
+
+    do
+    {
+        guint len = output->len;
+
+        g_byte_array_set_size (output, len + OUTPUT_STEP);
+        stream->next_out = output->data + len;
+        stream->avail_out = OUTPUT_STEP;
+        ret = inflate (stream, Z_BLOCK);
+        g_byte_array_set_size (output, len + OUTPUT_STEP - stream->avail_out);
+    } while (ret == Z_OK && !stream->avail_out && !(stream->data_type & 128));
+
+    /* The end of the final block is reported as a boundary, with bit 64 */
+    if (ret == Z_STREAM_END
+            || (ret == Z_OK && (stream->data_type & 192) == 192))
+        return SPEC_STREAM_END;
+    if (ret == Z_OK && (stream->data_type & 128))
+        return SPEC_BOUNDARY;
+    if ((ret == Z_OK || ret == Z_BUF_ERROR) && !stream->avail_in)
+        return SPEC_NEED_DATA;
+    return SPEC_ERROR;
+}
+
+/* Inflate the blocks from chunk->start with the marker dictionaries. Once the
+ * last 32 KiB of output hold no byte from the window, no later byte can
+ * refer to it and only the first dictionary is kept. The output ends at the
+ * last block boundary reached: the final block of the stream and a block cut
+ * by the end of the data are left to the sequential decoder. */
+    gboolean
+gst_gz_spec_decode (GstGzSpecChunk * chunk)
+{
+    z_stream streams[N_DICTS];
+    guint i, active = 0;
+    gssize last_marker = -1;
+    gsize end_len = 0;
+
+    chunk->end = chunk->start;
+    if (chunk->start == G_MAXUINT64)
+        return FALSE;
+    gst_gz_spec_init_dicts ();
+
+    chunk->output = g_byte_array_new ();
+    chunk->alt = g_byte_array_new ();
+    memset (streams, 0, sizeof (streams));
+    for (i = 0; i < N_DICTS; i++)
+    {
+        if (inflateInit2 (&streams[i], -MAX_WBITS) != Z_OK)
+            break;
+        active++;
+        inflateSetDictionary (&streams[i], spec_dicts[i], WINDOW_SIZE);
+        gst_gz_spec_prime (&streams[i], chunk->data, chunk->size,
+                chunk->start);
+    }
+    if (active < N_DICTS)
+        goto failed;
+
+    while (TRUE)
+    {
+        GstGzSpecResult result;
+        gsize len = chunk->output->len, k;
+
+        result = gst_gz_spec_inflate_block (&streams[0], chunk->output);
+        /* The other stream goes through the same blocks */
+        if (active > 1 && (gst_gz_spec_inflate_block (&streams[1],
+                        chunk->alt) != result
+                    || chunk->alt->len != chunk->output->len))
+            result = SPEC_ERROR;
+        if (result == SPEC_ERROR)
+            goto failed;
+        if (result != SPEC_BOUNDARY)
+            break;
+
+        chunk->end = gst_gz_spec_position (&streams[0], chunk->data);
+        end_len = chunk->output->len;
+        if (active > 1)
+        {
+            for (k = len; k < end_len; k++)
+            {
+                if (chunk->output->data[k] != chunk->alt->data[k])
+                    last_marker = k;
+            }
+            if (end_len >= WINDOW_SIZE
+                    && (gsize) (last_marker + 1) <= end_len - WINDOW_SIZE)
+            {
+                inflateEnd (&streams[1]);
+                active = 1;
+            }
+        }
+        if (chunk->end >= chunk->stop || end_len >= chunk->max_output)
+            break;
+    }
+
+    for (i = 0; i < active; i++)
+        inflateEnd (&streams[i]);
+    g_byte_array_set_size (chunk->output, end_len);
+    chunk->zone = MIN ((gsize) (last_marker + 1), end_len);
+    g_byte_array_set_size (chunk->alt, chunk->zone);
+    return chunk->end > chunk->start;
+
+failed:
+    for (i = 0; i < active; i++)
+        inflateEnd (&streams[i]);
+    gst_gz_spec_chunk_clear (chunk);
+    chunk->end = chunk->start;
+    return FALSE;
+}
+
+/* Replace the bytes copied from the window by the real data, window holding
+ * the last size bytes decoded before the chunk. Fails if the chunk refers to
+ * data before the start of the window. */
+    gboolean
+gst_gz_spec_resolve (GstGzSpecChunk * chunk, const guint8 * window,
+        gsize size)
+{
+    guint8 *data = chunk->output->data;
+    gsize missing = WINDOW_SIZE - size, k;
+
+    for (k = 0; k < chunk->zone; k++)
+    {
+        gsize j;
+
+        if (data[k] == chunk->alt->data[k])
+            continue;
+        j = ((chunk->alt->data[k] & 0x7f) << 8) | data[k];
+        if (j < missing)
+            return FALSE;
+        data[k] = window[j - missing];
+    }
+    return TRUE;
+}
+
+    void
+gst_gz_spec_chunk_clear (GstGzSpecChunk * chunk)
+{
+    if (chunk->output)
+        g_byte_array_unref (chunk->output);
+    if (chunk->alt)
+        g_byte_array_unref (chunk->alt);
+    chunk->output = NULL;
+    chunk->alt = NULL;
+    chunk->zone = 0;
+}
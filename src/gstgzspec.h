@@ -0,0 +1,89 @@
+/*
+ * GstGz
+ * Copyright, (C) 2017 Alexandre Esse, <alexandre.esse.dev@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __GST_GZ_SPEC_H__
+#define __GST_GZ_SPEC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Speculative decoding of a part of a deflate stream, in the way of
+ * rapidgzip: a block boundary is searched in the compressed data and the
+ * blocks are inflated from there without knowing the preceding window. The
+ * window is replaced by marker dictionaries, the bytes copied from it are
+ * resolved by gst_gz_spec_resolve() once the real window is known. Bit
+ * positions are counted from the start of data. */
+typedef struct
+{
+    const guint8 *data;
+    gsize size;
+
+    /* Search a block start in [search_from, search_to) */
+    guint64 search_from;
+    guint64 search_to;
+    /* Found block start, G_MAXUINT64 if none */
+    guint64 start;
+
+    /* Inflate from start up to the first block boundary at or after stop,
+     * or until max_output bytes are decoded */
+    guint64 stop;
+    gsize max_output;
+
+    /* Block boundary where decoding ended, the output ends there too */
+    guint64 end;
+    GByteArray *output;
+    /* Output of the second marker dictionary for the first zone bytes, the
+     * only ones that can depend on the window */
+    GByteArray *alt;
+    gsize zone;
+} GstGzSpecChunk;
+
+gboolean gst_gz_spec_find_start (GstGzSpecChunk * chunk);
+gboolean gst_gz_spec_decode (GstGzSpecChunk * chunk);
+gboolean gst_gz_spec_resolve (GstGzSpecChunk * chunk, const guint8 * window,
+    gsize size);
+void gst_gz_spec_chunk_clear (GstGzSpecChunk * chunk);
+
+G_END_DECLS
+#endif /* __GST_GZ_SPEC_H__ */